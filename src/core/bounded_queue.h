@@ -0,0 +1,100 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _DEADLOCK_CORE_BOUNDED_QUEUE_H_
+#define _DEADLOCK_CORE_BOUNDED_QUEUE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace deadlock
+{
+  namespace core
+  {
+    /// A first-in first-out queue that passes items from one thread to another, and holds at most a fixed number of them.
+    /// Pushing to a full queue waits until there is room, and popping from an empty queue waits for an item,
+    /// so a fast producer cannot run ahead of a slow consumer. Items are moved, so large buffers are never copied.
+    template <typename T> class bounded_queue
+    {
+    protected:
+
+      /// The items, oldest first
+      std::deque<T> items;
+
+      /// The maximum number of items
+      const size_t capacity;
+
+      /// Whether the queue accepts no more items
+      bool closed;
+
+      /// Guards the items and the closed flag
+      std::mutex mutex;
+
+      /// Signalled when an item is pushed or the queue is closed
+      std::condition_variable not_empty;
+
+      /// Signalled when an item is popped or the queue is closed
+      std::condition_variable not_full;
+
+    public:
+
+      /// Creates an empty queue that holds at most the given number of items
+      explicit bounded_queue(size_t capacity) : capacity(capacity)
+      {
+        closed = false;
+      }
+
+      /// Waits for room and appends the item. Returns false if the queue was closed, in which case the item is not added.
+      bool push(T&& item)
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) return false;
+
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+      }
+
+      /// Waits for an item and removes it. Returns false once the queue is closed and no items remain.
+      bool pop(T& item)
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+      }
+
+      /// Stops accepting items, and wakes all waiting threads. Items already in the queue can still be popped.
+      void close()
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+      }
+    };
+  }
+}
+
+#endif
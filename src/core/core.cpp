@@ -21,5 +21,5 @@ using namespace deadlock::core;
 
 version assembly_information::get_version()
 {
-  return version(1, 1, 0, 0);
+  return version(1, 5, 0, 0);
 }
@@ -15,6 +15,9 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "aes_cbc_decrypt_stream.h"
+
+#include <cstring>
+
 #include "../errors.h"
 
 using namespace deadlock::core::cryptography;
@@ -23,10 +26,23 @@ using namespace deadlock::core;
 using deadlock::core::crypt_error;
 
 aes_cbc_decrypt_streambuffer::aes_cbc_decrypt_streambuffer(std::basic_istream<char>& istr, const cryptography::key& dkey)
-  : key(dkey), input_stream(istr)
+  : input_stream(&istr), input_current(nullptr), input_end(nullptr), key(dkey)
+{
+  initialise();
+}
+
+aes_cbc_decrypt_streambuffer::aes_cbc_decrypt_streambuffer(const char* begin, const char* end, const cryptography::key& dkey)
+  : input_stream(nullptr), input_current(begin), input_end(end), key(dkey)
+{
+  initialise();
+}
+
+void aes_cbc_decrypt_streambuffer::initialise()
 {
   // No IV yet
   iv_read = false;
+  input_done = false;
+  ciphertext_held = 0;
 
   // Set buffer pointers
   setp(0, 0);
@@ -36,67 +52,142 @@ aes_cbc_decrypt_streambuffer::aes_cbc_decrypt_streambuffer(std::basic_istream<ch
   int err;
   if ((err = aes_setup(key.get_key(), key.key_size, 0, &skey)) != CRYPT_OK)
     throw crypt_error("Could not initialise AES algorithm: " + std::string(error_to_string(err)));
+
+  if (has_aes_instructions()) block_decryptor.reset(new aes_cbc_block_decryptor(key.get_key()));
 }
 
 aes_cbc_decrypt_streambuffer::~aes_cbc_decrypt_streambuffer()
 {
   // Zero the buffers, so no data remains in memory
-  data::detail::secure_memzero(plaintext, block_size);
-  data::detail::secure_memzero(iv,        block_size);
-  data::detail::secure_memzero(buffer,    block_size);
+  data::detail::secure_memzero(plaintext,  buffer_size);
+  data::detail::secure_memzero(iv,         block_size);
+  data::detail::secure_memzero(ciphertext, buffer_size + block_size);
 
   // Finalise the crypt key and zero it
   aes_done(&skey); // Do not check return value because throwing from a destructor would make things worse anyway
   data::detail::secure_memzero(&skey, sizeof(symmetric_key));
 }
 
-aes_cbc_decrypt_streambuffer::int_type aes_cbc_decrypt_streambuffer::underflow()
+bool aes_cbc_decrypt_streambuffer::read_iv()
 {
-  // If the underlying stream ended, this one is EOF as well
-  if (!input_stream.good()) return traits_type::eof();
+  if (input_stream != nullptr)
+  {
+    input_stream->read(iv, block_size);
+    return input_stream->gcount() == static_cast<std::streamsize>(block_size);
+  }
 
-  // First of all, read the IV if this is the first block
-  if (!iv_read)
+  if (static_cast<size_t>(input_end - input_current) < block_size) return false;
+  std::memcpy(iv, input_current, block_size);
+  input_current += block_size;
+  return true;
+}
+
+bool aes_cbc_decrypt_streambuffer::next_blocks(const char*& source, size_t& blocks)
+{
+  // A trailing part of a block cannot be decrypted, and is ignored
+  if (input_stream == nullptr)
   {
-    input_stream.read(iv, block_size);
-    iv_read = true;
+    // Take the blocks straight from memory; only when all of them fit, the last one is among them
+    const size_t available = static_cast<size_t>(input_end - input_current) / block_size;
+    const bool last = available <= buffer_size / block_size;
+    blocks = last ? available : buffer_size / block_size;
+    source = input_current;
+    input_current += blocks * block_size;
+    return last;
+  }
+
+  // Fill the buffer, and one block more to know whether the buffer holds the last block
+  const size_t wanted = buffer_size + block_size - ciphertext_held;
+  input_stream->read(ciphertext + ciphertext_held, wanted);
+  const size_t read = static_cast<size_t>(input_stream->gcount());
+  source = ciphertext;
 
-    // Then read the first block of ciphertext
-    input_stream.read(ciphertext, block_size);
+  if (read < wanted)
+  {
+    blocks = (ciphertext_held + read) / block_size;
+    ciphertext_held = 0;
+    return true;
   }
 
-  // Read one block to the buffer
-  input_stream.read(buffer, block_size);
-  bool read_last_block = !input_stream.good();
+  blocks = buffer_size / block_size;
+  ciphertext_held = block_size;
+  return false;
+}
 
-  //  Decrypt one block
-  int err;
-  if ((err = aes_ecb_decrypt(reinterpret_cast<std::uint8_t*>(ciphertext),
-                reinterpret_cast<std::uint8_t*>(plaintext), &skey)) != CRYPT_OK)
-    throw crypt_error("Could not decrypt block: " + std::string(error_to_string(err)));
+void aes_cbc_decrypt_streambuffer::decrypt_blocks(const char* source, size_t blocks)
+{
+  if (block_decryptor)
+  {
+    block_decryptor->decrypt(source, plaintext, blocks, iv);
+    return;
+  }
+
+  for (size_t b = 0; b < blocks; b++)
+  {
+    const char* block = source + b * block_size;
+    char* output = plaintext + b * block_size;
+
+    int err;
+    if ((err = aes_ecb_decrypt(reinterpret_cast<const std::uint8_t*>(block),
+                  reinterpret_cast<std::uint8_t*>(output), &skey)) != CRYPT_OK)
+      throw crypt_error("Could not decrypt block: " + std::string(error_to_string(err)));
+
+    // Undo the xor with the previous block of ciphertext, eight bytes at a time
+    const char* previous = b == 0 ? iv : block - block_size;
+    for (size_t i = 0; i < block_size; i += sizeof(std::uint64_t))
+    {
+      std::uint64_t x, y;
+      std::memcpy(&x, output + i, sizeof(x));
+      std::memcpy(&y, previous + i, sizeof(y));
+      x ^= y;
+      std::memcpy(output + i, &x, sizeof(x));
+    }
+  }
+
+  // The last block of ciphertext is the IV of the next one
+  if (blocks > 0) std::memcpy(iv, source + (blocks - 1) * block_size, block_size);
+}
+
+aes_cbc_decrypt_streambuffer::int_type aes_cbc_decrypt_streambuffer::underflow()
+{
+  // Once the last block has been decrypted, this stream is EOF
+  if (input_done) return traits_type::eof();
 
-  // Undo the xor with the IV
-  for (size_t i = 0; i < block_size; i++)
+  // First of all, read the IV if this is the first block
+  if (!iv_read)
   {
-    plaintext[i] ^= iv[i]; // TODO: use 4-byte xor
+    iv_read = true;
+    if (!read_iv())
+    {
+      input_done = true;
+      return traits_type::eof();
+    }
   }
 
-  // Set next IV and ciphertext
-  std::memcpy(iv, ciphertext, block_size); // TODO: is memcpy safe?
-  std::memcpy(ciphertext, buffer, block_size);
+  const char* source;
+  size_t blocks;
+  input_done = next_blocks(source, blocks);
+  if (blocks == 0) return traits_type::eof();
+
+  decrypt_blocks(source, blocks);
+
+  // The block read in advance is the start of the next buffer
+  if (!input_done && input_stream != nullptr) std::memcpy(ciphertext, ciphertext + buffer_size, block_size);
 
-  size_t out_length = block_size;
+  size_t out_length = blocks * block_size;
 
   // Remove padding from last block
-  if (read_last_block)
+  if (input_done)
   {
-    size_t padding_size = plaintext[block_size - 1];
-    out_length = block_size - padding_size;
+    const size_t padding_size = static_cast<std::uint8_t>(plaintext[out_length - 1]);
+    if (padding_size == 0 || padding_size > block_size)
+      throw crypt_error("Encountered invalid padding.");
+    out_length -= padding_size;
 
     // Validate that the padding is correct
-    for (size_t i = out_length; i < block_size; i++)
+    for (size_t i = out_length; i < blocks * block_size; i++)
     {
-      if (plaintext[i] != padding_size)
+      if (static_cast<std::uint8_t>(plaintext[i]) != padding_size)
         throw crypt_error("Encountered invalid padding.");
     }
   }
@@ -110,9 +201,16 @@ aes_cbc_decrypt_streambuffer::int_type aes_cbc_decrypt_streambuffer::underflow()
 }
 
 aes_cbc_decrypt_stream::aes_cbc_decrypt_stream(std::basic_istream<char>& istr, const cryptography::key& dkey)
-  : streambuffer(istr, dkey), basic_istream<char>(&streambuffer)
+  : basic_istream<char>(nullptr), streambuffer(istr, dkey)
+{
+  // The base is constructed before the streambuffer, so it can only be given the streambuffer now
+  rdbuf(&streambuffer);
+}
+
+aes_cbc_decrypt_stream::aes_cbc_decrypt_stream(const char* begin, const char* end, const cryptography::key& dkey)
+  : basic_istream<char>(nullptr), streambuffer(begin, end, dkey)
 {
-    
+  rdbuf(&streambuffer);
 }
 
 aes_cbc_decrypt_stream::~aes_cbc_decrypt_stream()
@@ -18,6 +18,7 @@
 #define _DEADLOCK_CORE_CRYPTOGRAPHY_AES_CBC_DECRYPT_STREAM_H_
 
 #include <cstdint>
+#include <memory>
 #include <stdexcept>
 #include <streambuf>
 #include <ostream>
@@ -28,6 +29,7 @@ extern "C"
 }
 
 #include "key.h"
+#include "aes_instructions.h"
 
 namespace deadlock
 {
@@ -42,23 +44,35 @@ namespace deadlock
         {
         protected:
 
-          /// The stream that all encrypted data will be read from
-          std::basic_istream<char>& input_stream;
+          /// The stream that all encrypted data will be read from, or nullptr if it is read from memory
+          std::basic_istream<char>* input_stream;
+
+          /// The next byte of encrypted data in memory
+          const char* input_current;
+
+          /// The end of the encrypted data in memory
+          const char* input_end;
+
+          /// Whether all encrypted data has been decrypted
+          bool input_done;
 
           /// AES has a block size of 16 bytes
           static const size_t block_size = 16;
 
+          /// The number of bytes decrypted at a time, so the blocks can be decrypted side by side
+          static const size_t buffer_size = 16384;
+
           /// Buffer for the initialisation vector, or previous block when initialisation is done
           char iv[block_size];
 
           /// Buffer for non-encrypted data
-          char plaintext[block_size];
+          char plaintext[buffer_size];
 
-          /// Holds one block of ciphertext
-          char ciphertext[block_size];
+          /// Ciphertext read from the stream, with room for one block in advance, to detect EOF
+          char ciphertext[buffer_size + block_size];
 
-          /// A buffer of one block in advance, to detected EOF
-          char buffer[block_size];
+          /// The number of bytes at the start of the ciphertext buffer that were read in advance
+          size_t ciphertext_held;
 
           /// The key used for encryption
           const cryptography::key& key;
@@ -69,18 +83,38 @@ namespace deadlock
           /// The LibTomCrypt scheduled key
           symmetric_key skey;
 
+          /// Decrypts with the AES instructions if the processor has them, or nullptr to use LibTomCrypt
+          std::unique_ptr<aes_cbc_block_decryptor> block_decryptor;
+
         public:
 
           /// Creates a streambuffer that reads its input from to the given stream,
           /// and decrypts with the given key
           aes_cbc_decrypt_streambuffer(std::basic_istream<char>& istr, const cryptography::key& key);
 
+          /// Creates a streambuffer that reads its input from the memory from begin up to end,
+          /// and decrypts with the given key. The memory must outlive the streambuffer.
+          aes_cbc_decrypt_streambuffer(const char* begin, const char* end, const cryptography::key& key);
+
           /// Zeroes the buffers
           virtual ~aes_cbc_decrypt_streambuffer();
 
         protected:
 
-          /// Once the buffer (one block) is empty, reads a new block and decrypts the data
+          /// Sets up the buffers and the crypt key
+          void initialise();
+
+          /// Reads the initialisation vector, and returns whether it was complete
+          bool read_iv();
+
+          /// Finds the next blocks of ciphertext to decrypt, and returns whether they include the last block.
+          /// The blocks are in the ciphertext buffer, or straight in the memory that is read from.
+          bool next_blocks(const char*& source, size_t& blocks);
+
+          /// Decrypts whole blocks of ciphertext into the plaintext buffer
+          void decrypt_blocks(const char* source, size_t blocks);
+
+          /// Once the buffer is empty, reads new blocks and decrypts them
           virtual int_type underflow();
         };
       }
@@ -100,6 +134,10 @@ namespace deadlock
         /// with the given key. The key must outlive the stream object.
         aes_cbc_decrypt_stream(std::basic_istream<char>& istr, const cryptography::key& key);
 
+        /// Creates a decryption stream that reads the encrypted data from the memory from begin up to end,
+        /// with the given key. The key and the memory must outlive the stream object.
+        aes_cbc_decrypt_stream(const char* begin, const char* end, const cryptography::key& key);
+
         ~aes_cbc_decrypt_stream();
       };
     }
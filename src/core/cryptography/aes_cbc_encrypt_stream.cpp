@@ -17,13 +17,16 @@
 #include "aes_cbc_encrypt_stream.h"
 #include "../errors.h"
 
+#include <algorithm>
+#include <cstring>
+
 using namespace deadlock::core::cryptography;
 using namespace deadlock::core::cryptography::detail;
 using namespace deadlock::core;
 using deadlock::core::crypt_error;
 
 aes_cbc_encrypt_streambuffer::aes_cbc_encrypt_streambuffer(std::basic_ostream<char>& ostr, const cryptography::key& dkey)
-  : key(dkey), output_stream(ostr)
+  : output_stream(ostr), key(dkey)
 {
   // Generate an initialisation vector
   iv_written = false;
@@ -40,19 +43,22 @@ aes_cbc_encrypt_streambuffer::aes_cbc_encrypt_streambuffer(std::basic_ostream<ch
 
   // Set buffer pointers
   setg(0, 0, 0);  
-  setp(plaintext, plaintext + block_size);
+  setp(plaintext, plaintext + buffer_size);
 
   // Set up the crypt key
   int err;
   if ((err = aes_setup(key.get_key(), key.key_size, 0, &skey)) != CRYPT_OK)
     throw crypt_error("Could not initialise AES algorithm: " + std::string(error_to_string(err)));
+
+  if (has_aes_instructions()) block_encryptor.reset(new aes_cbc_block_encryptor(key.get_key()));
 }
 
 aes_cbc_encrypt_streambuffer::~aes_cbc_encrypt_streambuffer()
 {
   // Zero the buffers, so no data remains in memory
-  data::detail::secure_memzero(plaintext, block_size);
-  data::detail::secure_memzero(iv,        block_size);
+  data::detail::secure_memzero(plaintext,  buffer_size + block_size);
+  data::detail::secure_memzero(ciphertext, buffer_size);
+  data::detail::secure_memzero(iv,         block_size);
 
   // Finalise the crypt key and zero it
   aes_done(&skey); // Do not check return value because throwing from a destructor would make things worse anyway
@@ -65,7 +71,7 @@ void aes_cbc_encrypt_streambuffer::finalise()
   overflow();
 }
 
-aes_cbc_encrypt_streambuffer::int_type aes_cbc_encrypt_streambuffer::overflow(int_type new_char)
+void aes_cbc_encrypt_streambuffer::encrypt_blocks(const char* source, size_t blocks)
 {
   // First of all, store the IV if this is the first block
   if (!iv_written)
@@ -74,99 +80,114 @@ aes_cbc_encrypt_streambuffer::int_type aes_cbc_encrypt_streambuffer::overflow(in
     iv_written = true;
   }
 
-  enum
+  while (blocks > 0)
   {
-    encrypt_run, // Encrypt a full block
-    encrypt_finish_pad, // Pad the current buffer to fill the block, and encrypt
-    encrypt_finish_pad_block // Encrypt the current block, append a full block of padding, and encrypt
-  } action = encrypt_run;
-
-  // Retrieve the number of characters in the buffer
-  auto in_length = pptr() - pbase();
-
-  // Determine what to do based on the number of bytes in the buffer and the given character
-  if (in_length != block_size)
-  {
-    if (new_char != traits_type::eof()) throw std::logic_error("A non-block length should only be encountered in the last block.");
-    action = encrypt_finish_pad;
-  }
-  else if (new_char == traits_type::eof())
-  {
-    action = encrypt_finish_pad_block;
-  }
+    const size_t count = std::min(blocks, buffer_size / block_size);
 
-  // Apply PKCS7 padding (if applicable)
-  if (action == encrypt_finish_pad)
-  {
-    size_t missing_bytes = block_size - in_length;
-    for (size_t i = 0; i < missing_bytes; i++)
+    if (block_encryptor)
+    {
+      block_encryptor->encrypt(source, ciphertext, count, iv);
+    }
+    else
     {
-      plaintext[in_length + i] = static_cast<char>(missing_bytes);
+      for (size_t b = 0; b < count; b++)
+      {
+        // Apply CBC, eight bytes at a time; the ciphertext of the previous block is in the IV
+        char block[block_size];
+        for (size_t i = 0; i < block_size; i += sizeof(std::uint64_t))
+        {
+          std::uint64_t x, y;
+          std::memcpy(&x, source + b * block_size + i, sizeof(x));
+          std::memcpy(&y, iv + i, sizeof(y));
+          x ^= y;
+          std::memcpy(block + i, &x, sizeof(x));
+        }
+
+        // Encrypt to IV (cyphertext of this block is the IV of the next block
+        int err;
+        if ((err = aes_ecb_encrypt(reinterpret_cast<std::uint8_t*>(block),
+                      reinterpret_cast<std::uint8_t*>(iv), &skey)) != CRYPT_OK)
+          throw crypt_error("Could not encrypt block: " + std::string(error_to_string(err)));
+
+        data::detail::secure_memzero(block, block_size);
+        std::memcpy(ciphertext + b * block_size, iv, block_size);
+      }
     }
 
-    in_length = block_size;
+    // Write to stream
+    output_stream.write(ciphertext, count * block_size);
+
+    source += count * block_size;
+    blocks -= count;
   }
+}
+
+aes_cbc_encrypt_streambuffer::int_type aes_cbc_encrypt_streambuffer::overflow(int_type new_char)
+{
+  const size_t in_length = pptr() - pbase();
 
-  // Apply CBC
-  for (size_t i = 0; i < block_size; i++) // TODO: can iterate over 32 or 64 bits at once instead of 8
+  if (new_char == traits_type::eof())
   {
-    plaintext[i] ^= iv[i];
-  }
+    // Apply PKCS7 padding: the last block is filled up with the number of bytes added.
+    // If the data fills the last block already, a full block of padding is appended.
+    const size_t missing_bytes = block_size - in_length % block_size;
+    std::memset(pptr(), static_cast<char>(missing_bytes), missing_bytes);
 
-  // Encrypt to IV (cyphertext of this block is the IV of the next block
-  int err;
-  if ((err = aes_ecb_encrypt(reinterpret_cast<std::uint8_t*>(plaintext),
-                reinterpret_cast<std::uint8_t*>(iv), &skey)) != CRYPT_OK)
-    throw crypt_error("Could not encrypt block: " + std::string(error_to_string(err)));
+    encrypt_blocks(plaintext, (in_length + missing_bytes) / block_size);
+    setp(plaintext, plaintext + buffer_size);
 
-  // Write to stream
-  output_stream.write(iv, block_size);
+    // Return 0 to indicate success
+    return 0;
+  }
 
-  // If appending one more block, do so now
-  if (action == encrypt_finish_pad_block)
-  {
-    // Create the PKCS7 padding block
-    size_t missing_bytes = block_size;
-    for (size_t i = 0; i < missing_bytes; i++)
-    {
-      plaintext[i] = static_cast<char>(missing_bytes);
-    }
-    in_length = block_size;
+  // Encrypt the whole blocks, and keep the rest
+  const size_t whole_length = in_length - in_length % block_size;
+  encrypt_blocks(plaintext, whole_length / block_size);
+  std::memmove(plaintext, plaintext + whole_length, in_length - whole_length);
+  setp(plaintext, plaintext + buffer_size);
+  pbump(static_cast<int>(in_length - whole_length));
 
-    // Apply CBC
-    for (size_t i = 0; i < block_size; i++) // TODO: can iterate over 32 or 64 bits at once instead of 8
-    {
-      plaintext[i] ^= iv[i];
-    }
+  // Put the character in the buffer
+  *pptr() = traits_type::to_char_type(new_char);
+  pbump(1);
 
-    // Encrypt to IV (cyphertext of this block is the IV of the next block
-    int err;
-    if ((err = aes_ecb_encrypt(reinterpret_cast<std::uint8_t*>(plaintext),
-                  reinterpret_cast<std::uint8_t*>(iv), &skey)) != CRYPT_OK)
-      throw crypt_error("Could not encrypt block: " + std::string(error_to_string(err)));
+  return new_char;
+}
 
-    // Write to stream
-    output_stream.write(iv, block_size);
-  }
+std::streamsize aes_cbc_encrypt_streambuffer::xsputn(const char* s, std::streamsize n)
+{
+  const size_t length = static_cast<size_t>(n);
+  const size_t available = epptr() - pptr();
 
-  // If not done, store the next character in the buffer
-  if (action == encrypt_run)
+  // Small writes only go to the buffer
+  if (length < available)
   {
-    // Put the character in the buffer
-    plaintext[0] = new_char;
-    // Reset the pointer (note that the next pointer is plaintext + 1 because there already is a character now)
-    setp(plaintext, plaintext + block_size);
-    pbump(1);
+    std::memcpy(pptr(), s, length);
+    pbump(static_cast<int>(length));
+    return n;
   }
-  
-  // Return 0 to indicate success
-  return 0;
+
+  // Fill up the buffer and encrypt it, which leaves no partial block
+  std::memcpy(pptr(), s, available);
+  encrypt_blocks(plaintext, buffer_size / block_size);
+  setp(plaintext, plaintext + buffer_size);
+
+  // The whole blocks of the rest are encrypted where they are, and only the last partial block is buffered
+  const size_t remaining = length - available;
+  const size_t whole_length = remaining - remaining % block_size;
+  encrypt_blocks(s + available, whole_length / block_size);
+
+  std::memcpy(plaintext, s + available + whole_length, remaining - whole_length);
+  pbump(static_cast<int>(remaining - whole_length));
+
+  return n;
 }
 
 aes_cbc_encrypt_stream::aes_cbc_encrypt_stream(std::basic_ostream<char>& ostr, const cryptography::key& dkey)
-  : streambuffer(ostr, dkey), basic_ostream<char>(&streambuffer)
+  : basic_ostream<char>(nullptr), streambuffer(ostr, dkey)
 {
-    
+  // The base is constructed before the streambuffer, so it can only be given the streambuffer now
+  rdbuf(&streambuffer);
 }
 
 aes_cbc_encrypt_stream::~aes_cbc_encrypt_stream()
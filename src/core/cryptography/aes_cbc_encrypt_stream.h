@@ -18,6 +18,7 @@
 #define _DEADLOCK_CORE_CRYPTOGRAPHY_AES_CBC_ENCRYPT_STREAM_H_
 
 #include <cstdint>
+#include <memory>
 #include <stdexcept>
 #include <streambuf>
 #include <ostream>
@@ -28,6 +29,7 @@ extern "C"
 }
 
 #include "key.h"
+#include "aes_instructions.h"
 
 namespace deadlock
 {
@@ -48,12 +50,18 @@ namespace deadlock
           /// AES has a block size of 16 bytes
           static const size_t block_size = 16;
 
+          /// The number of bytes encrypted and written to the output stream at a time
+          static const size_t buffer_size = 16384;
+
           /// Buffer for the initialisation vector, or previous block when initialisation is done
           /// Should be of block size (16 bytes)
           char iv[block_size];
 
-          /// Buffer for non-encrypted data
-          char plaintext[block_size];
+          /// Buffer for non-encrypted data, with room for a block of padding
+          char plaintext[buffer_size + block_size];
+
+          /// Buffer for encrypted data
+          char ciphertext[buffer_size];
 
           /// The key used for encryption
           const cryptography::key& key;
@@ -64,6 +72,9 @@ namespace deadlock
           /// The LibTomCrypt scheduled key
           symmetric_key skey;
 
+          /// Encrypts with the AES instructions if the processor has them, or nullptr to use LibTomCrypt
+          std::unique_ptr<aes_cbc_block_encryptor> block_encryptor;
+
         public:
 
           /// Creates a streambuffer that streams its output to the given stream,
@@ -78,8 +89,14 @@ namespace deadlock
 
         protected:
 
-          /// Once the buffer (one block) is full, encrypts the data and writes it to the underlying buffer
+          /// Encrypts whole blocks and writes them to the underlying stream, preceded by the IV if it has not been written yet
+          void encrypt_blocks(const char* source, size_t blocks);
+
+          /// Once the buffer is full, encrypts the data and writes it to the underlying stream
           virtual int_type overflow(int_type new_char = traits_type::eof());
+
+          /// Encrypts the whole blocks of large writes without copying them to the buffer first
+          virtual std::streamsize xsputn(const char* s, std::streamsize n);
         };
       }
 
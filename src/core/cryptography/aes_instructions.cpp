@@ -0,0 +1,503 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "aes_instructions.h"
+
+#include "../data/secure_allocator.h"
+
+// The AES instructions are only available on x86 processors, and the compiler must be told to use them per function,
+// because the rest of the library must also run on processors without them
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#define DEADLOCK_AES_INSTRUCTIONS
+#define DEADLOCK_AES_TARGET
+#define DEADLOCK_GCM_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#define DEADLOCK_AES_INSTRUCTIONS
+#define DEADLOCK_AES_TARGET __attribute__((target("aes,sse2")))
+#define DEADLOCK_GCM_TARGET __attribute__((target("aes,pclmul,ssse3,sse2")))
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace deadlock::core;
+using namespace deadlock::core::cryptography::detail;
+
+#ifdef DEADLOCK_AES_INSTRUCTIONS
+
+/// Asks the processor which instructions it has, which leaf 1 of cpuid puts in ecx and edx
+static void read_features(unsigned int& ecx, unsigned int& edx)
+{
+  unsigned int registers[4] = { 0, 0, 0, 0 };
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  for (int i = 0; i < 4; i++) registers[i] = static_cast<unsigned int>(info[i]);
+#else
+  __get_cpuid(1, &registers[0], &registers[1], &registers[2], &registers[3]);
+#endif
+  ecx = registers[2];
+  edx = registers[3];
+}
+
+/// Asks the processor whether it has the AES instructions
+static bool detect_aes_instructions()
+{
+  // AES is bit 25 of ecx, and SSE2 bit 26 of edx
+  unsigned int ecx, edx;
+  read_features(ecx, edx);
+  return (ecx & (1u << 25)) != 0 && (edx & (1u << 26)) != 0;
+}
+
+/// Asks the processor whether it has the instructions that GCM needs besides AES
+static bool detect_gcm_instructions()
+{
+  // PCLMULQDQ is bit 1 of ecx, and SSSE3 bit 9
+  unsigned int ecx, edx;
+  read_features(ecx, edx);
+  return detect_aes_instructions() && (ecx & (1u << 1)) != 0 && (ecx & (1u << 9)) != 0;
+}
+
+bool deadlock::core::cryptography::detail::has_aes_instructions()
+{
+  static const bool available = detect_aes_instructions();
+  return available;
+}
+
+bool deadlock::core::cryptography::detail::has_gcm_instructions()
+{
+  static const bool available = detect_gcm_instructions();
+  return available;
+}
+
+/// Mixes a round key of the AES-256 key expansion with the (shuffled) output of aeskeygenassist
+DEADLOCK_AES_TARGET static inline __m128i expand_round_key(__m128i key, __m128i assist)
+{
+  __m128i shifted = _mm_slli_si128(key, 4);
+  key = _mm_xor_si128(key, shifted);
+  shifted = _mm_slli_si128(shifted, 4);
+  key = _mm_xor_si128(key, shifted);
+  shifted = _mm_slli_si128(shifted, 4);
+  key = _mm_xor_si128(key, shifted);
+  return _mm_xor_si128(key, assist);
+}
+
+// The round constant of aeskeygenassist must be known at compile time
+#define DEADLOCK_AES_EXPAND_EVEN(i, rcon) \
+  keys[i] = expand_round_key(keys[i - 2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(keys[i - 1], rcon), 0xff))
+#define DEADLOCK_AES_EXPAND_ODD(i) \
+  keys[i] = expand_round_key(keys[i - 2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(keys[i - 1], 0x00), 0xaa))
+
+/// Expands the 32-byte key into the round keys of the cipher
+DEADLOCK_AES_TARGET static void expand_key(const std::uint8_t* key, __m128i* keys)
+{
+  keys[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+  keys[1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 16));
+  DEADLOCK_AES_EXPAND_EVEN(2, 0x01);
+  DEADLOCK_AES_EXPAND_ODD(3);
+  DEADLOCK_AES_EXPAND_EVEN(4, 0x02);
+  DEADLOCK_AES_EXPAND_ODD(5);
+  DEADLOCK_AES_EXPAND_EVEN(6, 0x04);
+  DEADLOCK_AES_EXPAND_ODD(7);
+  DEADLOCK_AES_EXPAND_EVEN(8, 0x08);
+  DEADLOCK_AES_EXPAND_ODD(9);
+  DEADLOCK_AES_EXPAND_EVEN(10, 0x10);
+  DEADLOCK_AES_EXPAND_ODD(11);
+  DEADLOCK_AES_EXPAND_EVEN(12, 0x20);
+  DEADLOCK_AES_EXPAND_ODD(13);
+  DEADLOCK_AES_EXPAND_EVEN(14, 0x40);
+}
+
+#undef DEADLOCK_AES_EXPAND_EVEN
+#undef DEADLOCK_AES_EXPAND_ODD
+
+DEADLOCK_AES_TARGET static void expand_encryption_keys(const std::uint8_t* key, std::uint8_t* round_keys)
+{
+  __m128i keys[15];
+  expand_key(key, keys);
+
+  __m128i* output = reinterpret_cast<__m128i*>(round_keys);
+  for (int i = 0; i < 15; i++) _mm_storeu_si128(output + i, keys[i]);
+
+  data::detail::secure_memzero(keys, sizeof(keys));
+}
+
+DEADLOCK_AES_TARGET static void expand_decryption_keys(const std::uint8_t* key, std::uint8_t* round_keys)
+{
+  __m128i keys[15];
+  expand_key(key, keys);
+
+  // The equivalent inverse cipher applies the keys in reverse, with InvMixColumns applied to all but the outer ones
+  __m128i* output = reinterpret_cast<__m128i*>(round_keys);
+  _mm_storeu_si128(output, keys[14]);
+  for (int i = 1; i < 14; i++) _mm_storeu_si128(output + i, _mm_aesimc_si128(keys[14 - i]));
+  _mm_storeu_si128(output + 14, keys[0]);
+
+  data::detail::secure_memzero(keys, sizeof(keys));
+}
+
+/// Decrypts one block with the inverse cipher, without the CBC xor
+DEADLOCK_AES_TARGET static inline __m128i decrypt_block(__m128i block, const __m128i* keys)
+{
+  block = _mm_xor_si128(block, keys[0]);
+  for (int r = 1; r < 14; r++) block = _mm_aesdec_si128(block, keys[r]);
+  return _mm_aesdeclast_si128(block, keys[14]);
+}
+
+DEADLOCK_AES_TARGET static void decrypt_cbc(const std::uint8_t* round_keys, const char* ciphertext, char* plaintext, size_t blocks, char* iv)
+{
+  __m128i keys[15];
+  for (int r = 0; r < 15; r++) keys[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(round_keys) + r);
+
+  const __m128i* in = reinterpret_cast<const __m128i*>(ciphertext);
+  __m128i* out = reinterpret_cast<__m128i*>(plaintext);
+  __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+
+  // Eight independent blocks keep the pipeline of the AES unit full
+  for (; blocks >= 8; blocks -= 8, in += 8, out += 8)
+  {
+    __m128i c[8], p[8];
+    for (int i = 0; i < 8; i++) c[i] = _mm_loadu_si128(in + i);
+    for (int i = 0; i < 8; i++) p[i] = _mm_xor_si128(c[i], keys[0]);
+    for (int r = 1; r < 14; r++)
+    {
+      for (int i = 0; i < 8; i++) p[i] = _mm_aesdec_si128(p[i], keys[r]);
+    }
+    for (int i = 0; i < 8; i++) p[i] = _mm_aesdeclast_si128(p[i], keys[14]);
+
+    _mm_storeu_si128(out, _mm_xor_si128(p[0], previous));
+    for (int i = 1; i < 8; i++) _mm_storeu_si128(out + i, _mm_xor_si128(p[i], c[i - 1]));
+    previous = c[7];
+  }
+
+  for (; blocks > 0; blocks--, in++, out++)
+  {
+    const __m128i c = _mm_loadu_si128(in);
+    _mm_storeu_si128(out, _mm_xor_si128(decrypt_block(c, keys), previous));
+    previous = c;
+  }
+
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(iv), previous);
+  data::detail::secure_memzero(keys, sizeof(keys));
+}
+
+DEADLOCK_AES_TARGET static void encrypt_cbc(const std::uint8_t* round_keys, const char* plaintext, char* ciphertext, size_t blocks, char* iv)
+{
+  __m128i keys[15];
+  for (int r = 0; r < 15; r++) keys[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(round_keys) + r);
+
+  const __m128i* in = reinterpret_cast<const __m128i*>(plaintext);
+  __m128i* out = reinterpret_cast<__m128i*>(ciphertext);
+  __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+
+  // Every block depends on the one before, so they are encrypted one at a time
+  for (; blocks > 0; blocks--, in++, out++)
+  {
+    __m128i block = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128(in), previous), keys[0]);
+    for (int r = 1; r < 14; r++) block = _mm_aesenc_si128(block, keys[r]);
+    previous = _mm_aesenclast_si128(block, keys[14]);
+    _mm_storeu_si128(out, previous);
+  }
+
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(iv), previous);
+  data::detail::secure_memzero(keys, sizeof(keys));
+}
+
+aes_cbc_block_encryptor::aes_cbc_block_encryptor(const std::uint8_t* key)
+{
+  expand_encryption_keys(key, round_keys);
+}
+
+/// Encrypts one block with the cipher
+DEADLOCK_GCM_TARGET static inline __m128i encrypt_block(__m128i block, const __m128i* keys)
+{
+  block = _mm_xor_si128(block, keys[0]);
+  for (int r = 1; r < 14; r++) block = _mm_aesenc_si128(block, keys[r]);
+  return _mm_aesenclast_si128(block, keys[14]);
+}
+
+/// Reverses the bytes of a block, because pclmulqdq works on the bits of GHASH in the opposite order
+DEADLOCK_GCM_TARGET static inline __m128i reverse_bytes(__m128i block)
+{
+  return _mm_shuffle_epi8(block, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+/// Adds the carry-less 256-bit product of two elements of the field of GHASH, both with their bytes reversed, to low and high.
+/// Products can be added up before they are reduced, because reducing is linear.
+DEADLOCK_GCM_TARGET static inline void add_product(__m128i a, __m128i b, __m128i& low, __m128i& high)
+{
+  const __m128i middle = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+  low = _mm_xor_si128(low, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00), _mm_slli_si128(middle, 8)));
+  high = _mm_xor_si128(high, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(middle, 8)));
+}
+
+/// Reduces a 256-bit product to an element of the field of GHASH.
+/// This is the algorithm of Intel's white paper on carry-less multiplication and GCM.
+DEADLOCK_GCM_TARGET static inline __m128i reduce_gf128(__m128i low, __m128i high)
+{
+  // Shift the product left by one bit, because the bits are reflected
+  __m128i low_carry = _mm_srli_epi32(low, 31);
+  __m128i high_carry = _mm_srli_epi32(high, 31);
+  low = _mm_slli_epi32(low, 1);
+  high = _mm_slli_epi32(high, 1);
+  const __m128i across = _mm_srli_si128(low_carry, 12);
+  high_carry = _mm_slli_si128(high_carry, 4);
+  low_carry = _mm_slli_si128(low_carry, 4);
+  low = _mm_or_si128(low, low_carry);
+  high = _mm_or_si128(_mm_or_si128(high, high_carry), across);
+
+  // Reduce modulo x^128 + x^7 + x^2 + x + 1
+  __m128i first = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)), _mm_slli_epi32(low, 25));
+  const __m128i first_high = _mm_srli_si128(first, 4);
+  first = _mm_slli_si128(first, 12);
+  low = _mm_xor_si128(low, first);
+
+  __m128i second = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)), _mm_srli_epi32(low, 7));
+  second = _mm_xor_si128(second, first_high);
+  low = _mm_xor_si128(low, second);
+
+  return _mm_xor_si128(high, low);
+}
+
+/// Multiplies two elements of the field of GHASH, both with their bytes reversed
+DEADLOCK_GCM_TARGET static inline __m128i multiply_gf128(__m128i a, __m128i b)
+{
+  __m128i low = _mm_setzero_si128(), high = _mm_setzero_si128();
+  add_product(a, b, low, high);
+  return reduce_gf128(low, high);
+}
+
+/// Returns the counter block for the 12-byte nonce, which is split into three words, and the counter
+DEADLOCK_GCM_TARGET static inline __m128i counter_block(const std::uint32_t* nonce, std::uint32_t counter)
+{
+  // The counter is big-endian
+  const std::uint32_t swapped = (counter >> 24) | ((counter >> 8) & 0xff00) | ((counter << 8) & 0xff0000) | (counter << 24);
+  return _mm_set_epi32(static_cast<int>(swapped), static_cast<int>(nonce[2]), static_cast<int>(nonce[1]), static_cast<int>(nonce[0]));
+}
+
+DEADLOCK_GCM_TARGET static void expand_gcm_keys(const std::uint8_t* key, std::uint8_t* round_keys, std::uint8_t* hash_powers)
+{
+  __m128i keys[15];
+  expand_key(key, keys);
+
+  __m128i* output = reinterpret_cast<__m128i*>(round_keys);
+  for (int i = 0; i < 15; i++) _mm_storeu_si128(output + i, keys[i]);
+
+  // The key of GHASH is the encryption of the zero block
+  __m128i* powers = reinterpret_cast<__m128i*>(hash_powers);
+  const __m128i h = reverse_bytes(encrypt_block(_mm_setzero_si128(), keys));
+  __m128i power = h;
+  for (int i = 0; i < 8; i++)
+  {
+    _mm_storeu_si128(powers + i, power);
+    power = multiply_gf128(power, h);
+  }
+
+  data::detail::secure_memzero(keys, sizeof(keys));
+}
+
+/// Encrypts or decrypts in counter mode, and computes the tag of the additional data and the ciphertext
+DEADLOCK_GCM_TARGET static void crypt_gcm(const std::uint8_t* round_keys, const std::uint8_t* hash_powers, const std::uint8_t* nonce_bytes,
+  const char* associated_data, size_t associated_length, const char* input, char* output, size_t length, bool encrypting, std::uint8_t* tag)
+{
+  __m128i keys[15], powers[8];
+  for (int r = 0; r < 15; r++) keys[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(round_keys) + r);
+  for (int i = 0; i < 8; i++) powers[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hash_powers) + i);
+  const __m128i h = powers[0];
+
+  std::uint32_t nonce[3];
+  std::memcpy(nonce, nonce_bytes, sizeof(nonce));
+
+  const __m128i* in = reinterpret_cast<const __m128i*>(input);
+  __m128i* out = reinterpret_cast<__m128i*>(output);
+  __m128i hash = _mm_setzero_si128();
+
+  // The additional data is hashed first, as if it were padded with zeroes to whole blocks
+  for (size_t offset = 0; offset < associated_length; offset += 16)
+  {
+    char block[16] = { 0 };
+    std::memcpy(block, associated_data + offset, std::min<size_t>(16, associated_length - offset));
+    hash = multiply_gf128(_mm_xor_si128(hash, reverse_bytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block)))), h);
+  }
+
+  // The first counter is used for the tag
+  std::uint32_t counter = 2;
+  size_t blocks = length / 16;
+
+  // Eight independent blocks keep the pipeline of the AES unit full
+  for (; blocks >= 8; blocks -= 8, in += 8, out += 8, counter += 8)
+  {
+    __m128i stream[8];
+    for (int i = 0; i < 8; i++) stream[i] = _mm_xor_si128(counter_block(nonce, counter + i), keys[0]);
+    for (int r = 1; r < 14; r++)
+    {
+      for (int i = 0; i < 8; i++) stream[i] = _mm_aesenc_si128(stream[i], keys[r]);
+    }
+    for (int i = 0; i < 8; i++) stream[i] = _mm_aesenclast_si128(stream[i], keys[14]);
+
+    // Hashing block by block multiplies by the key after every block, which is the same as multiplying
+    // the first of the eight blocks by the eighth power of the key, the second by the seventh, and so on,
+    // so the eight products are independent, and need to be reduced only once
+    __m128i low = _mm_setzero_si128(), high = _mm_setzero_si128();
+    for (int i = 0; i < 8; i++)
+    {
+      const __m128i source = _mm_loadu_si128(in + i);
+      const __m128i result = _mm_xor_si128(source, stream[i]);
+      _mm_storeu_si128(out + i, result);
+
+      __m128i block = reverse_bytes(encrypting ? result : source);
+      if (i == 0) block = _mm_xor_si128(block, hash);
+      add_product(block, powers[7 - i], low, high);
+    }
+    hash = reduce_gf128(low, high);
+  }
+
+  for (; blocks > 0; blocks--, in++, out++, counter++)
+  {
+    const __m128i source = _mm_loadu_si128(in);
+    const __m128i result = _mm_xor_si128(source, encrypt_block(counter_block(nonce, counter), keys));
+    _mm_storeu_si128(out, result);
+    hash = multiply_gf128(_mm_xor_si128(hash, reverse_bytes(encrypting ? result : source)), h);
+  }
+
+  // The last partial block is hashed as if the ciphertext were padded with zeroes
+  const size_t remaining = length % 16;
+  if (remaining > 0)
+  {
+    char source[16] = { 0 }, result[16];
+    std::memcpy(source, in, remaining);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(result),
+      _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source)), encrypt_block(counter_block(nonce, counter), keys)));
+    std::memcpy(out, result, remaining);
+
+    std::memset(result + remaining, 0, 16 - remaining);
+    const char* ciphertext = encrypting ? result : source;
+    hash = multiply_gf128(_mm_xor_si128(hash, reverse_bytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ciphertext)))), h);
+
+    data::detail::secure_memzero(source, sizeof(source));
+    data::detail::secure_memzero(result, sizeof(result));
+  }
+
+  // Finally the lengths in bits of the additional data and of the ciphertext
+  hash = multiply_gf128(_mm_xor_si128(hash,
+    _mm_set_epi64x(static_cast<long long>(associated_length) * 8, static_cast<long long>(length) * 8)), h);
+
+  const __m128i mask = encrypt_block(counter_block(nonce, 1), keys);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(tag), _mm_xor_si128(reverse_bytes(hash), mask));
+
+  data::detail::secure_memzero(keys, sizeof(keys));
+  data::detail::secure_memzero(powers, sizeof(powers));
+}
+
+aes_gcm_block_cipher::aes_gcm_block_cipher(const std::uint8_t* key)
+{
+  expand_gcm_keys(key, round_keys, hash_powers);
+}
+
+void aes_gcm_block_cipher::encrypt(const std::uint8_t* nonce, const char* associated_data, size_t associated_length,
+  const char* plaintext, char* ciphertext, size_t length, std::uint8_t* tag) const
+{
+  crypt_gcm(round_keys, hash_powers, nonce, associated_data, associated_length, plaintext, ciphertext, length, true, tag);
+}
+
+void aes_gcm_block_cipher::decrypt(const std::uint8_t* nonce, const char* associated_data, size_t associated_length,
+  const char* ciphertext, char* plaintext, size_t length, std::uint8_t* tag) const
+{
+  crypt_gcm(round_keys, hash_powers, nonce, associated_data, associated_length, ciphertext, plaintext, length, false, tag);
+}
+
+void aes_cbc_block_encryptor::encrypt(const char* plaintext, char* ciphertext, size_t blocks, char* iv) const
+{
+  encrypt_cbc(round_keys, plaintext, ciphertext, blocks, iv);
+}
+
+aes_cbc_block_decryptor::aes_cbc_block_decryptor(const std::uint8_t* key)
+{
+  expand_decryption_keys(key, round_keys);
+}
+
+void aes_cbc_block_decryptor::decrypt(const char* ciphertext, char* plaintext, size_t blocks, char* iv) const
+{
+  decrypt_cbc(round_keys, ciphertext, plaintext, blocks, iv);
+}
+
+#else
+
+bool deadlock::core::cryptography::detail::has_aes_instructions()
+{
+  return false;
+}
+
+bool deadlock::core::cryptography::detail::has_gcm_instructions()
+{
+  return false;
+}
+
+aes_gcm_block_cipher::aes_gcm_block_cipher(const std::uint8_t*)
+{
+  throw std::logic_error("The AES instructions are not available.");
+}
+
+void aes_gcm_block_cipher::encrypt(const std::uint8_t*, const char*, size_t, const char*, char*, size_t, std::uint8_t*) const
+{
+}
+
+void aes_gcm_block_cipher::decrypt(const std::uint8_t*, const char*, size_t, const char*, char*, size_t, std::uint8_t*) const
+{
+}
+
+aes_cbc_block_encryptor::aes_cbc_block_encryptor(const std::uint8_t*)
+{
+  throw std::logic_error("The AES instructions are not available.");
+}
+
+void aes_cbc_block_encryptor::encrypt(const char*, char*, size_t, char*) const
+{
+}
+
+aes_cbc_block_decryptor::aes_cbc_block_decryptor(const std::uint8_t*)
+{
+  throw std::logic_error("The AES instructions are not available.");
+}
+
+void aes_cbc_block_decryptor::decrypt(const char*, char*, size_t, char*) const
+{
+}
+
+#endif
+
+aes_cbc_block_encryptor::~aes_cbc_block_encryptor()
+{
+  data::detail::secure_memzero(round_keys, sizeof(round_keys));
+}
+
+aes_gcm_block_cipher::~aes_gcm_block_cipher()
+{
+  data::detail::secure_memzero(round_keys, sizeof(round_keys));
+  data::detail::secure_memzero(hash_powers, sizeof(hash_powers));
+}
+
+aes_cbc_block_decryptor::~aes_cbc_block_decryptor()
+{
+  data::detail::secure_memzero(round_keys, sizeof(round_keys));
+}
@@ -0,0 +1,125 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _DEADLOCK_CORE_CRYPTOGRAPHY_AES_INSTRUCTIONS_H_
+#define _DEADLOCK_CORE_CRYPTOGRAPHY_AES_INSTRUCTIONS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace deadlock
+{
+  namespace core
+  {
+    namespace cryptography
+    {
+      namespace detail
+      {
+        /// Returns whether the processor has the AES instructions (AES-NI).
+        /// The answer is false if the library was built for a processor without them.
+        bool has_aes_instructions();
+
+        /// Returns whether the processor has the AES instructions and the carry-less multiplication that GCM needs
+        bool has_gcm_instructions();
+
+        /// Encrypts 256-bit key AES in CBC mode with the AES instructions.
+        /// Only construct it if has_aes_instructions returns true.
+        class aes_cbc_block_encryptor
+        {
+        protected:
+
+          /// AES-256 has 14 rounds, and one round key more than that
+          static const size_t number_of_round_keys = 15;
+
+          /// The round keys of the cipher
+          std::uint8_t round_keys[number_of_round_keys * 16];
+
+        public:
+
+          /// Expands the 32-byte key
+          aes_cbc_block_encryptor(const std::uint8_t* key);
+
+          /// Zeroes the round keys
+          ~aes_cbc_block_encryptor();
+
+          /// Encrypts the given number of 16-byte blocks from plaintext to ciphertext, which must not overlap.
+          /// The iv holds the block of ciphertext before the first one; afterwards it holds the last one.
+          void encrypt(const char* plaintext, char* ciphertext, size_t blocks, char* iv) const;
+        };
+
+        /// Decrypts 256-bit key AES in CBC mode with the AES instructions,
+        /// working on eight blocks at a time, because the decryption of a CBC block does not depend on the one before.
+        /// Only construct it if has_aes_instructions returns true.
+        class aes_cbc_block_decryptor
+        {
+        protected:
+
+          /// AES-256 has 14 rounds, and one round key more than that
+          static const size_t number_of_round_keys = 15;
+
+          /// The round keys of the equivalent inverse cipher, in the order they are applied
+          std::uint8_t round_keys[number_of_round_keys * 16];
+
+        public:
+
+          /// Expands the 32-byte key
+          aes_cbc_block_decryptor(const std::uint8_t* key);
+
+          /// Zeroes the round keys
+          ~aes_cbc_block_decryptor();
+
+          /// Decrypts the given number of 16-byte blocks from ciphertext to plaintext, which must not overlap.
+          /// The iv holds the block of ciphertext before the first one; afterwards it holds the last one.
+          void decrypt(const char* ciphertext, char* plaintext, size_t blocks, char* iv) const;
+        };
+
+        /// Encrypts and authenticates 256-bit key AES in GCM mode with the AES and carry-less multiplication instructions.
+        /// Only construct it if has_gcm_instructions returns true.
+        class aes_gcm_block_cipher
+        {
+        protected:
+
+          /// AES-256 has 14 rounds, and one round key more than that
+          static const size_t number_of_round_keys = 15;
+
+          /// The round keys of the cipher
+          std::uint8_t round_keys[number_of_round_keys * 16];
+
+          /// The first eight powers of the key of GHASH, with their bytes reversed, so eight blocks can be hashed at once
+          std::uint8_t hash_powers[8 * 16];
+
+        public:
+
+          /// Expands the 32-byte key
+          aes_gcm_block_cipher(const std::uint8_t* key);
+
+          /// Zeroes the keys
+          ~aes_gcm_block_cipher();
+
+          /// Encrypts the plaintext with the 12-byte nonce, and puts the 16-byte tag of the additional data and the ciphertext in tag
+          void encrypt(const std::uint8_t* nonce, const char* associated_data, size_t associated_length,
+            const char* plaintext, char* ciphertext, size_t length, std::uint8_t* tag) const;
+
+          /// Decrypts the ciphertext with the 12-byte nonce, and puts the 16-byte tag that it should have in tag
+          void decrypt(const std::uint8_t* nonce, const char* associated_data, size_t associated_length,
+            const char* ciphertext, char* plaintext, size_t length, std::uint8_t* tag) const;
+        };
+      }
+    }
+  }
+}
+
+#endif
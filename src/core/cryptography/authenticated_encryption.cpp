@@ -0,0 +1,253 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "authenticated_encryption.h"
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+extern "C"
+{
+  #include <tomcrypt.h>
+}
+
+#include "../errors.h"
+#include "aes_instructions.h"
+#include "cryptography_initialisation.h"
+#include "random.h"
+
+using namespace deadlock::core;
+using namespace deadlock::core::cryptography;
+using deadlock::core::cryptography::detail::_initialisation;
+
+/// The number of bytes of the nonce of a segment: the prefix, the index, and the byte that marks the last segment
+static const size_t nonce_size = nonce_prefix_size + 4 + 1;
+
+/// The number of bytes that a segment takes in a section, unless it is the last one
+static const size_t segment_stride = segment_size + tag_size;
+
+/// Starting a thread costs about as much as encrypting a few segments with the AES instructions,
+/// so a thread should have at least this many segments to do
+static const size_t segments_per_thread = 4;
+
+/// Encrypts and decrypts segments with the AES instructions if the processor has them, and with LibTomCrypt otherwise.
+/// LibTomCrypt keeps the state of a message in the cipher, so every thread needs its own.
+class segment_cipher
+{
+protected:
+
+  /// The cipher that uses the AES instructions, if they are available
+  std::unique_ptr<detail::aes_gcm_block_cipher> block_cipher;
+
+  /// The LibTomCrypt state, if they are not
+  std::unique_ptr<gcm_state> state;
+
+  /// Encrypts or decrypts one segment, and computes the tag of the associated data and its ciphertext
+  void crypt(const std::uint8_t* nonce, const std::string& associated_data, const char* input, char* output, size_t length,
+    std::uint8_t* tag, bool encrypting)
+  {
+    if (block_cipher)
+    {
+      if (encrypting) block_cipher->encrypt(nonce, associated_data.data(), associated_data.size(), input, output, length, tag);
+      else block_cipher->decrypt(nonce, associated_data.data(), associated_data.size(), input, output, length, tag);
+      return;
+    }
+
+    // LibTomCrypt reads the plaintext and writes the ciphertext when encrypting, and the other way around when decrypting
+    unsigned char* plaintext = reinterpret_cast<unsigned char*>(encrypting ? const_cast<char*>(input) : output);
+    unsigned char* ciphertext = reinterpret_cast<unsigned char*>(encrypting ? output : const_cast<char*>(input));
+    unsigned long the_tag_size = tag_size;
+    int err;
+    if ((err = gcm_reset(state.get())) != CRYPT_OK
+      || (err = gcm_add_iv(state.get(), nonce, nonce_size)) != CRYPT_OK
+      || (err = gcm_add_aad(state.get(), reinterpret_cast<const unsigned char*>(associated_data.data()),
+        static_cast<unsigned long>(associated_data.size()))) != CRYPT_OK
+      || (err = gcm_process(state.get(), plaintext, static_cast<unsigned long>(length), ciphertext,
+        encrypting ? GCM_ENCRYPT : GCM_DECRYPT)) != CRYPT_OK
+      || (err = gcm_done(state.get(), tag, &the_tag_size)) != CRYPT_OK)
+    {
+      throw crypt_error("GCM failed: " + std::string(error_to_string(err)));
+    }
+  }
+
+public:
+
+  /// Prepares the cipher for the key
+  segment_cipher(const key& section_key)
+  {
+    if (detail::has_gcm_instructions())
+    {
+      block_cipher.reset(new detail::aes_gcm_block_cipher(section_key.get_key()));
+      return;
+    }
+
+    state.reset(new gcm_state);
+    int err;
+    if ((err = gcm_init(state.get(), _initialisation::aes_index, section_key.get_key(), key::key_size)) != CRYPT_OK)
+    {
+      throw crypt_error("Failed to initialise GCM: " + std::string(error_to_string(err)));
+    }
+  }
+
+  /// Clears the key schedule
+  ~segment_cipher()
+  {
+    if (state) data::detail::secure_memzero(state.get(), sizeof(gcm_state));
+  }
+
+  /// Encrypts one segment, and computes the tag of the associated data and its ciphertext
+  void encrypt(const std::uint8_t* nonce, const std::string& associated_data, const char* plaintext, char* ciphertext, size_t length,
+    std::uint8_t* tag)
+  {
+    crypt(nonce, associated_data, plaintext, ciphertext, length, tag, true);
+  }
+
+  /// Decrypts one segment, and computes the tag that the associated data and its ciphertext should have
+  void decrypt(const std::uint8_t* nonce, const std::string& associated_data, const char* ciphertext, char* plaintext, size_t length,
+    std::uint8_t* tag)
+  {
+    crypt(nonce, associated_data, ciphertext, plaintext, length, tag, false);
+  }
+};
+
+/// Builds the nonce of a segment from the prefix of the section
+static void make_nonce(const char* prefix, size_t index, bool last, std::uint8_t* nonce)
+{
+  std::copy(prefix, prefix + nonce_prefix_size, nonce);
+  nonce[nonce_prefix_size + 0] = static_cast<std::uint8_t>(index >> 24);
+  nonce[nonce_prefix_size + 1] = static_cast<std::uint8_t>(index >> 16);
+  nonce[nonce_prefix_size + 2] = static_cast<std::uint8_t>(index >> 8);
+  nonce[nonce_prefix_size + 3] = static_cast<std::uint8_t>(index);
+  nonce[nonce_prefix_size + 4] = last ? 1 : 0;
+}
+
+/// Compares two tags in constant time, so the time it takes does not tell how much of a forged tag is right
+static bool tags_equal(const std::uint8_t* computed, const char* stored)
+{
+  std::uint8_t difference = 0;
+  for (size_t i = 0; i < tag_size; i++)
+  {
+    difference |= computed[i] ^ static_cast<std::uint8_t>(stored[i]);
+  }
+  return difference == 0;
+}
+
+/// Calls work(cipher, index) for every segment, splitting the segments over up to the given number of threads
+template <typename Work>
+static void for_each_segment(const key& section_key, size_t segments, size_t threads, Work work)
+{
+  const size_t number_of_workers = std::max<size_t>(1, std::min(threads, segments / segments_per_thread));
+  const size_t part_size = (segments + number_of_workers - 1) / number_of_workers;
+
+  std::vector<std::exception_ptr> errors(number_of_workers);
+  std::vector<std::thread> workers;
+  workers.reserve(number_of_workers - 1);
+
+  auto run = [&](size_t part)
+  {
+    try
+    {
+      segment_cipher cipher(section_key);
+      const size_t first = std::min(segments, part * part_size);
+      const size_t last = std::min(segments, first + part_size);
+      for (size_t s = first; s < last; s++) work(cipher, s);
+    }
+    catch (...)
+    {
+      errors[part] = std::current_exception();
+    }
+  };
+
+  // The calling thread takes the first part itself
+  for (size_t part = 1; part < number_of_workers; part++) workers.push_back(std::thread(run, part));
+  run(0);
+  for (auto w = workers.begin(); w != workers.end(); w++) w->join();
+
+  for (auto e = errors.begin(); e != errors.end(); e++)
+  {
+    if (*e) std::rethrow_exception(*e);
+  }
+}
+
+std::string cryptography::encrypt_authenticated(const key& section_key, const char* plaintext, size_t length,
+  const std::string& associated_data, size_t threads)
+{
+  // Even empty plaintext has a segment, so there is a tag to verify
+  const size_t segments = std::max<size_t>(1, (length + segment_size - 1) / segment_size);
+  if (static_cast<std::uint64_t>(segments - 1) > 0xffffffffu) throw crypt_error("The data is too large to encrypt as one section.");
+
+  std::string section(nonce_prefix_size + length + segments * tag_size, '\0');
+  char* output = &section[0];
+
+  get_random_bytes(reinterpret_cast<std::uint8_t*>(output), nonce_prefix_size);
+
+  for_each_segment(section_key, segments, threads, [&](segment_cipher& cipher, size_t s)
+  {
+    const size_t offset = s * segment_size;
+    const size_t segment_length = std::min(segment_size, length - offset);
+    char* ciphertext = output + nonce_prefix_size + s * segment_stride;
+
+    std::uint8_t nonce[nonce_size];
+    make_nonce(output, s, s + 1 == segments, nonce);
+    cipher.encrypt(nonce, associated_data, plaintext + offset, ciphertext, segment_length,
+      reinterpret_cast<std::uint8_t*>(ciphertext + segment_length));
+  });
+
+  return section;
+}
+
+void cryptography::decrypt_authenticated(const key& section_key, const char* section, size_t length,
+  const std::string& associated_data, size_t threads, data::secure_string& plaintext)
+{
+  if (length < nonce_prefix_size + tag_size) throw authentication_error("The encrypted data is too short to be authentic.");
+
+  // Every segment but the last is full, and the last one holds at least its tag
+  const size_t body = length - nonce_prefix_size;
+  const size_t segments = std::max<size_t>(1, (body + segment_stride - 1) / segment_stride);
+  const size_t last_length = body - (segments - 1) * segment_stride;
+  if (last_length < tag_size) throw authentication_error("The encrypted data was truncated.");
+
+  plaintext.resize(body - segments * tag_size);
+  char* output = &plaintext[0];
+
+  try
+  {
+    for_each_segment(section_key, segments, threads, [&](segment_cipher& cipher, size_t s)
+    {
+      const size_t segment_length = (s + 1 == segments ? last_length : segment_stride) - tag_size;
+      const char* ciphertext = section + nonce_prefix_size + s * segment_stride;
+
+      std::uint8_t nonce[nonce_size], tag[tag_size];
+      make_nonce(section, s, s + 1 == segments, nonce);
+      cipher.decrypt(nonce, associated_data, ciphertext, output + s * segment_size, segment_length, tag);
+
+      if (!tags_equal(tag, ciphertext + segment_length))
+      {
+        throw authentication_error("The encrypted data was changed after it was encrypted.");
+      }
+    });
+  }
+  catch (...)
+  {
+    // Plaintext that failed to verify must not be used
+    data::detail::secure_memzero(output, plaintext.size());
+    plaintext.clear();
+    throw;
+  }
+}
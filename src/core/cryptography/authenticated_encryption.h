@@ -0,0 +1,64 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef _DEADLOCK_CORE_CRYPTOGRAPHY_AUTHENTICATED_ENCRYPTION_H_
+#define _DEADLOCK_CORE_CRYPTOGRAPHY_AUTHENTICATED_ENCRYPTION_H_
+
+#include <cstddef>
+#include <string>
+
+#include "key.h"
+#include "../data/secure_string.h"
+
+namespace deadlock
+{
+  namespace core
+  {
+    namespace cryptography
+    {
+      /// The number of bytes of plaintext in every segment of a section but the last
+      const size_t segment_size = 64 * 1024;
+
+      /// The number of bytes of the tag that authenticates every segment
+      const size_t tag_size = 16;
+
+      /// The number of random bytes at the start of a section, which make the nonces of its segments unique.
+      /// The other five bytes of a nonce number the segments, so the prefix must not repeat for the same key.
+      /// A key should therefore encrypt far fewer sections than the 2^28 after which a repeat becomes likely;
+      /// a vault derives a new key for every save.
+      const size_t nonce_prefix_size = 7;
+
+      /// Encrypts and authenticates the plaintext with AES-256 in GCM mode, and returns the section.
+      /// The plaintext is split into segments, which are encrypted independently, on up to the given number of threads.
+      /// The section is the random nonce prefix, followed by the ciphertext and the tag of every segment.
+      /// The nonce of a segment is the prefix, its index as a big-endian 32-bit integer, and a byte that marks the last segment,
+      /// so segments cannot be reordered, dropped or moved to another section without it being detected.
+      /// Every segment also authenticates the associated data, which is not stored in the section;
+      /// it should say where the section belongs, so that a section moved elsewhere fails to decrypt.
+      std::string encrypt_authenticated(const key& section_key, const char* plaintext, size_t length,
+        const std::string& associated_data, size_t threads);
+
+      /// Verifies and decrypts a section that encrypt_authenticated returned with the same associated data,
+      /// on up to the given number of threads.
+      /// Throws authentication_error if the section or the associated data was changed, in which case the plaintext must not be used.
+      void decrypt_authenticated(const key& section_key, const char* section, size_t length,
+        const std::string& associated_data, size_t threads, data::secure_string& plaintext);
+    }
+  }
+}
+
+#endif
@@ -16,14 +16,25 @@
 
 #include "key.h"
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
 #include <boost/chrono.hpp>
 extern "C"
 {
   #include <tomcrypt.h>
 }
 
+#ifdef __linux__
+  #include <linux/keyctl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+#include "../endianness.h"
 #include "../errors.h"
 #include "cryptography_initialisation.h"
+#include "random.h"
 
 using namespace deadlock::core::cryptography;
 using namespace deadlock::core;
@@ -37,22 +48,13 @@ key::key()
 key::~key()
 {
   // Clear the key memory upon destruction
-  data::detail::secure_memzero(salt_data, key_size);
+  data::detail::secure_memzero(key_data, key_size);
   data::detail::secure_memzero(salt_data, salt_size);
 }
 
 void key::set_salt_random()
 {
-  // Create a random engine and distribution for generating random bytes
-  // TODO: use a cryptographically strong random number generator
-  std::random_device random_engine;
-  std::uniform_int_distribution<std::uint8_t> random_byte(0x00, 0xff);
-
-  // Simply copy the buffer
-  for (size_t i = 0; i < salt_size; i++)
-  {
-    salt_data[i] = random_byte(random_engine);
-  }
+  get_random_bytes(salt_data, salt_size);
 }
 
 void key::generate_key(const data::secure_string& passphrase, std::uint32_t iterations)
@@ -85,6 +87,201 @@ void key::generate_key(const data::secure_string& passphrase, std::uint32_t iter
   number_of_iterations = iterations;
 }
 
+void key::restore_key(const std::uint8_t* salt, std::uint32_t iterations, const std::uint8_t* derived_key)
+{
+  std::copy(salt, salt + salt_size, salt_data);
+  std::copy(derived_key, derived_key + key_size, key_data);
+  number_of_iterations = iterations;
+}
+
+bool key::is_derived_from(const std::uint8_t* salt, std::uint32_t iterations) const
+{
+  // A key that was never derived has no iterations
+  return number_of_iterations != 0 && number_of_iterations == iterations && std::equal(salt_data, salt_data + salt_size, salt);
+}
+
+void key::derive_subkey(const char* label, const std::uint8_t* context, size_t context_size, key& subkey) const
+{
+  // Like the check value, one iteration suffices for a key that is already hard to guess
+  std::vector<std::uint8_t> salt(label, label + std::strlen(label));
+  salt.insert(salt.end(), context, context + context_size);
+
+  unsigned long the_key_size = key_size;
+  int err;
+  if ((err = pkcs_5_alg2(key_data, key_size, salt.data(), static_cast<unsigned long>(salt.size()), 1,
+    _initialisation::sha256_index, subkey.key_data, &the_key_size)) != CRYPT_OK)
+  {
+    throw key_error("Failed to derive a subkey: " + std::string(error_to_string(err)));
+  }
+
+  // The subkey was not derived from a passphrase
+  std::fill(subkey.salt_data, subkey.salt_data + salt_size, 0);
+  subkey.number_of_iterations = 0;
+}
+
+void key::get_check_value(std::uint8_t* check_value) const
+{
+  // The key is already hard to guess, so one iteration suffices; the label keeps the value apart from other uses of the key
+  const char label[] = "Deadlock key check";
+  unsigned long the_check_value_size = check_value_size;
+  int err;
+  if ((err = pkcs_5_alg2(key_data, key_size, reinterpret_cast<const unsigned char*>(label), sizeof(label) - 1, 1,
+    _initialisation::sha256_index, check_value, &the_check_value_size)) != CRYPT_OK)
+  {
+    throw key_error("Failed to derive the key check value: " + std::string(error_to_string(err)));
+  }
+}
+
+#ifdef __linux__
+
+/// Every key in the keyring is described by this prefix, followed by the hash of its salt and iterations
+static const char keyring_prefix[] = "deadlock:";
+
+/// The possessor may do everything with a key in the keyring, and nobody else may see it
+static const std::uint32_t keyring_permissions = 0x3f000000;
+
+/// Returns the description of the key that was derived from the salt with the given number of iterations in the keyring.
+/// The description is visible to the user, so it holds a hash rather than the salt.
+static std::string keyring_description(const std::uint8_t* salt, std::uint32_t iterations)
+{
+  std::uint8_t parameters[key::salt_size + 4];
+  std::copy(salt, salt + key::salt_size, parameters);
+  const std::uint32_t portable_iterations = internal_to_portable(iterations);
+  std::copy(reinterpret_cast<const std::uint8_t*>(&portable_iterations), reinterpret_cast<const std::uint8_t*>(&portable_iterations) + 4,
+    parameters + key::salt_size);
+
+  const char label[] = "Deadlock keyring";
+  std::uint8_t hash[16];
+  unsigned long hash_size = sizeof(hash);
+  int err;
+  if ((err = pkcs_5_alg2(parameters, sizeof(parameters), reinterpret_cast<const unsigned char*>(label), sizeof(label) - 1, 1,
+    _initialisation::sha256_index, hash, &hash_size)) != CRYPT_OK)
+  {
+    throw key_error("Failed to hash the key parameters: " + std::string(error_to_string(err)));
+  }
+
+  const char digits[] = "0123456789abcdef";
+  std::string description(keyring_prefix);
+  for (size_t i = 0; i < sizeof(hash); i++)
+  {
+    description.push_back(digits[hash[i] >> 4]);
+    description.push_back(digits[hash[i] & 0xf]);
+  }
+  return description;
+}
+
+/// Returns the session keyring, without creating one. Without a session keyring, the kernel gives the user session keyring,
+/// which outlives the process, whereas a new session keyring would be gone when the process exits.
+static long get_session_keyring()
+{
+  return syscall(SYS_keyctl, KEYCTL_GET_KEYRING_ID, KEY_SPEC_SESSION_KEYRING, 0);
+}
+
+bool key::keep_in_keyring(std::uint32_t seconds_to_live) const
+{
+  if (seconds_to_live == 0) return false;
+
+  const long keyring = get_session_keyring();
+  if (keyring < 0) return false;
+
+  // The key is added to the keyring of this thread, which no other process can reach, and only linked into
+  // the session keyring once its permissions are restricted, so it is never there with the default permissions
+  const std::string description = keyring_description(salt_data, number_of_iterations);
+  const long id = syscall(SYS_add_key, "user", description.c_str(), key_data, key_size, KEY_SPEC_THREAD_KEYRING);
+  if (id < 0) return false;
+
+  // The kernel never swaps the payload to disk, and removes the key when its time is up.
+  // Linking replaces a key with the same description, so keeping a key again renews it.
+  const bool kept = syscall(SYS_keyctl, KEYCTL_SETPERM, id, keyring_permissions) == 0
+    && syscall(SYS_keyctl, KEYCTL_SET_TIMEOUT, id, seconds_to_live) == 0
+    && syscall(SYS_keyctl, KEYCTL_LINK, id, keyring) == 0;
+  syscall(SYS_keyctl, KEYCTL_UNLINK, id, KEY_SPEC_THREAD_KEYRING);
+
+  if (!kept)
+  {
+    syscall(SYS_keyctl, KEYCTL_REVOKE, id);
+    return false;
+  }
+  return true;
+}
+
+bool key::find_in_keyring(const std::uint8_t* salt, std::uint32_t iterations)
+{
+  const long keyring = get_session_keyring();
+  if (keyring < 0) return false;
+
+  const std::string description = keyring_description(salt, iterations);
+  const long id = syscall(SYS_keyctl, KEYCTL_SEARCH, keyring, "user", description.c_str(), 0);
+  if (id < 0) return false;
+
+  std::uint8_t payload[key_size];
+  const long length = syscall(SYS_keyctl, KEYCTL_READ, id, payload, sizeof(payload));
+  const bool found = length == static_cast<long>(key_size);
+  if (found) restore_key(salt, iterations, payload);
+
+  data::detail::secure_memzero(payload, sizeof(payload));
+  return found;
+}
+
+size_t key::forget_keyring()
+{
+  const long keyring = get_session_keyring();
+  if (keyring < 0) return 0;
+
+  // Reading a keyring gives the serial numbers of the keys in it
+  std::vector<std::int32_t> ids(64);
+  for (;;)
+  {
+    const long length = syscall(SYS_keyctl, KEYCTL_READ, keyring, ids.data(), ids.size() * sizeof(std::int32_t));
+    if (length < 0) return 0;
+
+    const size_t number_of_ids = static_cast<size_t>(length) / sizeof(std::int32_t);
+    if (number_of_ids <= ids.size())
+    {
+      ids.resize(number_of_ids);
+      break;
+    }
+    ids.resize(number_of_ids);
+  }
+
+  // A description reads "type;uid;gid;perm;description"
+  size_t forgotten = 0;
+  for (auto id = ids.begin(); id != ids.end(); id++)
+  {
+    char buffer[256];
+    const long length = syscall(SYS_keyctl, KEYCTL_DESCRIBE, *id, buffer, sizeof(buffer));
+    if (length <= 0 || length > static_cast<long>(sizeof(buffer))) continue;
+
+    const std::string description(buffer);
+    const size_t name = description.rfind(';');
+    if (description.compare(0, 5, "user;") != 0 || name == std::string::npos
+      || description.compare(name + 1, sizeof(keyring_prefix) - 1, keyring_prefix) != 0) continue;
+
+    // Revoking, rather than unlinking, makes the key unusable through any other keyring that links it too
+    if (syscall(SYS_keyctl, KEYCTL_REVOKE, *id) == 0) forgotten++;
+  }
+  return forgotten;
+}
+
+#else
+
+bool key::keep_in_keyring(std::uint32_t) const
+{
+  return false;
+}
+
+bool key::find_in_keyring(const std::uint8_t*, std::uint32_t)
+{
+  return false;
+}
+
+size_t key::forget_keyring()
+{
+  return 0;
+}
+
+#endif
+
 std::uint32_t key::get_required_iterations(size_t passphrase_length, double seconds)
 {
   // Create a dummy passphrase
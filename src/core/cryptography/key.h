@@ -43,6 +43,9 @@ namespace deadlock
         /// The number of bytes of salt
         const static size_t salt_size = key_size;
 
+        /// The number of bytes of the value that tells whether a key is correct
+        const static size_t check_value_size = 16;
+
       protected:
 
         /// The actual key generated
@@ -76,11 +79,38 @@ namespace deadlock
         /// Generates the key using the specified number of iterations
         void generate_key(const data::secure_string& passphrase, std::uint32_t iterations);
 
+        /// Takes a key that was derived from the salt with the given number of iterations before,
+        /// such as one that a key agent kept, instead of deriving it again
+        void restore_key(const std::uint8_t* salt, std::uint32_t iterations, const std::uint8_t* derived_key);
+
+        /// Returns whether the key was derived from the salt with the given number of iterations
+        bool is_derived_from(const std::uint8_t* salt, std::uint32_t iterations) const;
+
         /// Returns the number of iterations required, such that deriving the key takes the specified amount of time (roughly)
         std::uint32_t get_required_iterations(size_t passphrase_length, double seconds);
 
         /// Returns the generated key
         inline const std::uint8_t* get_key() const { return key_data; }
+
+        /// Derives another key from this one for a single use, such as the sections of one save of a vault.
+        /// The label names the use, and the context, such as a random value, sets it apart from other uses with the same label.
+        void derive_subkey(const char* label, const std::uint8_t* context, size_t context_size, key& subkey) const;
+
+        /// Derives a value from the key that tells whether a key is correct, without revealing the key
+        void get_check_value(std::uint8_t* check_value) const;
+
+        /// Keeps the key in the session keyring of the kernel for the given number of seconds,
+        /// so later processes of the session can restore it instead of deriving it again.
+        /// Returns whether the key was kept; there is a keyring only on Linux.
+        /// The kernel would keep a key for zero seconds forever, so such a key is not kept.
+        bool keep_in_keyring(std::uint32_t seconds_to_live) const;
+
+        /// Restores the key that was derived from the salt with the given number of iterations
+        /// from the session keyring, and returns whether it was there
+        bool find_in_keyring(const std::uint8_t* salt, std::uint32_t iterations);
+
+        /// Removes all keys that were kept from the session keyring, and returns how many there were
+        static size_t forget_keyring();
       };
     }
   }
@@ -0,0 +1,33 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "random.h"
+
+extern "C"
+{
+  #include <tomcrypt.h>
+}
+
+#include "../errors.h"
+
+void deadlock::core::cryptography::get_random_bytes(std::uint8_t* buffer, size_t length)
+{
+  if (rng_get_bytes(buffer, static_cast<unsigned long>(length), nullptr) != length)
+  {
+    throw crypt_error("Could not read enough random bytes from the operating system.");
+  }
+}
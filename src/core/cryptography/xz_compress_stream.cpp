@@ -22,7 +22,8 @@ using namespace deadlock::core::cryptography;
 using namespace deadlock::core::cryptography::detail;
 using deadlock::core::xz_error;
 
-xz_compress_streambuffer::xz_compress_streambuffer(std::basic_ostream<char>& ostr, int compression_level)
+xz_compress_streambuffer::xz_compress_streambuffer(std::basic_ostream<char>& ostr, std::uint32_t compression_level,
+  std::uint32_t threads, std::uint64_t block_size)
   : output_stream(ostr)
 {
   // Initialise the stream
@@ -33,7 +34,22 @@ xz_compress_streambuffer::xz_compress_streambuffer(std::basic_ostream<char>& ost
   lzma_check check = LZMA_CHECK_CRC32;
 
   // Create the compressor
-  xz_result = lzma_easy_encoder(&xz_stream, compression_level, check);
+#if LZMA_VERSION >= 50020002
+  if (threads > 1)
+  {
+    // The multi-threaded encoder of XZ 5.2 and later
+    lzma_mt options = lzma_mt();
+    options.threads = threads;
+    options.block_size = block_size;
+    options.preset = compression_level;
+    options.check = check;
+    xz_result = lzma_stream_encoder_mt(&xz_stream, &options);
+  }
+  else
+#endif
+  {
+    xz_result = lzma_easy_encoder(&xz_stream, compression_level, check);
+  }
   if (xz_result != LZMA_OK)
   {
     throw xz_error("Could not initialise compressor.", xz_result);
@@ -120,10 +136,12 @@ xz_compress_streambuffer::int_type xz_compress_streambuffer::overflow(int_type n
   return 0;
 }
 
-xz_compress_stream::xz_compress_stream(std::basic_ostream<char>& ostr, int compression_level)
-  : streambuffer(ostr, compression_level), basic_ostream<char>(&streambuffer)
+xz_compress_stream::xz_compress_stream(std::basic_ostream<char>& ostr, std::uint32_t compression_level,
+  std::uint32_t threads, std::uint64_t block_size)
+  : basic_ostream<char>(nullptr), streambuffer(ostr, compression_level, threads, block_size)
 {
-    
+  // The base is constructed before the streambuffer, so it can only be given the streambuffer now
+  rdbuf(&streambuffer);
 }
 
 xz_compress_stream::~xz_compress_stream()
@@ -76,8 +76,11 @@ namespace deadlock
         public:
 
           /// Creates a streambuffer that streams its output to the given stream,
-          /// and compresses with the given compression level (ranging from 0 to 9, see XZ documentation)
-          xz_compress_streambuffer(std::basic_ostream<char>& ostr, int compression_level);
+          /// and compresses with the given compression level (ranging from 0 to 9, optionally combined with LZMA_PRESET_EXTREME, see XZ documentation).
+          /// With more than one thread, the data is split into blocks of the given size (0 lets XZ choose),
+          /// which are compressed in parallel. The output is an ordinary XZ stream with several blocks.
+          xz_compress_streambuffer(std::basic_ostream<char>& ostr, std::uint32_t compression_level,
+            std::uint32_t threads = 1, std::uint64_t block_size = 0);
 
           /// Cleans the lzma compressor and zeroes the buffers
           virtual ~xz_compress_streambuffer();
@@ -103,8 +106,10 @@ namespace deadlock
       public:
 
         /// Creates a compression stream that streams its output to the given stream,
-        /// and compresses with the given compression level (ranging from 0 to 9, see xz documentation)
-        xz_compress_stream(std::basic_ostream<char>& ostr, int compression_level);
+        /// and compresses with the given compression level (ranging from 0 to 9, optionally combined with LZMA_PRESET_EXTREME, see xz documentation).
+        /// With more than one thread, blocks of the given size are compressed in parallel.
+        xz_compress_stream(std::basic_ostream<char>& ostr, std::uint32_t compression_level,
+          std::uint32_t threads = 1, std::uint64_t block_size = 0);
 
         ~xz_compress_stream();
 
@@ -25,7 +25,7 @@ using namespace deadlock::core::cryptography;
 using namespace deadlock::core::cryptography::detail;
 using deadlock::core::xz_error;
 
-xz_decompress_streambuffer::xz_decompress_streambuffer(std::basic_istream<char>& istr)
+xz_decompress_streambuffer::xz_decompress_streambuffer(std::basic_istream<char>& istr, std::uint32_t threads)
   : input_stream(istr)
 {
   // Initialise the stream
@@ -37,8 +37,23 @@ xz_decompress_streambuffer::xz_decompress_streambuffer(std::basic_istream<char>&
   // No memory limit
   const std::uint64_t memory_limit = std::numeric_limits<std::uint64_t>::max();
 
-  // Create the compressor
-  xz_result = lzma_stream_decoder(&xz_stream, memory_limit, flags);
+  // Create the decompressor
+#if LZMA_VERSION >= 50040002
+  if (threads > 1)
+  {
+    // The multi-threaded decoder of XZ 5.4 and later
+    lzma_mt options = lzma_mt();
+    options.flags = flags;
+    options.threads = threads;
+    options.memlimit_threading = memory_limit;
+    options.memlimit_stop = memory_limit;
+    xz_result = lzma_stream_decoder_mt(&xz_stream, &options);
+  }
+  else
+#endif
+  {
+    xz_result = lzma_stream_decoder(&xz_stream, memory_limit, flags);
+  }
   if (xz_result != LZMA_OK)
   {
     throw xz_error("Could not initialise decompressor.", xz_result);
@@ -124,10 +139,11 @@ xz_decompress_streambuffer::int_type xz_decompress_streambuffer::underflow()
   return traits_type::eof();
 }
 
-xz_decompress_stream::xz_decompress_stream(std::basic_istream<char>& istr)
-  : streambuffer(istr), basic_istream<char>(&streambuffer)
+xz_decompress_stream::xz_decompress_stream(std::basic_istream<char>& istr, std::uint32_t threads)
+  : basic_istream<char>(nullptr), streambuffer(istr, threads)
 {
-  
+  // The base is constructed before the streambuffer, so it can only be given the streambuffer now
+  rdbuf(&streambuffer);
 }
 
 xz_decompress_stream::~xz_decompress_stream()
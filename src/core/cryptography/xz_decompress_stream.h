@@ -72,8 +72,9 @@ namespace deadlock
 
         public:
 
-          /// Creates a streambuffer that reads compressed data from the given stream
-          xz_decompress_streambuffer(std::basic_istream<char>& istr);
+          /// Creates a streambuffer that reads compressed data from the given stream.
+          /// With more than one thread, the blocks of a stream written by a multi-threaded compressor are decompressed in parallel.
+          xz_decompress_streambuffer(std::basic_istream<char>& istr, std::uint32_t threads = 1);
 
           /// Cleans the lzma compressor and zeroes the buffers
           virtual ~xz_decompress_streambuffer();
@@ -96,7 +97,8 @@ namespace deadlock
       public:
 
         /// Creates a decompression reads compressed dat afrom the given stream, and provides decompressed data
-        xz_decompress_stream(std::basic_istream<char>& istr);
+        /// With more than one thread, independent blocks are decompressed in parallel.
+        xz_decompress_stream(std::basic_istream<char>& istr, std::uint32_t threads = 1);
 
         ~xz_decompress_stream();
       };
@@ -0,0 +1,59 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "edit_distance.h"
+
+#include <algorithm>
+
+size_t deadlock::core::data::edit_distance(const char* a, size_t a_length, const char* b, size_t b_length, std::vector<size_t>& row)
+{
+  // The classic dynamic programming algorithm, keeping only one row of the matrix.
+  // Initially, the row holds the distances from the empty prefix of a to every prefix of b.
+  row.resize(b_length + 1);
+  for (size_t j = 0; j <= b_length; j++) row[j] = j;
+
+  for (size_t i = 1; i <= a_length; i++)
+  {
+    size_t diagonal = row[0];
+    row[0] = i;
+
+    for (size_t j = 1; j <= b_length; j++)
+    {
+      const size_t above = row[j];
+      const size_t replace = diagonal + (a[i - 1] == b[j - 1] ? 0 : 1);
+      row[j] = std::min(std::min(above, row[j - 1]) + 1, replace);
+      diagonal = above;
+    }
+  }
+
+  return row[b_length];
+}
+
+size_t deadlock::core::data::next_edit_distance_row(const size_t* previous, size_t* next, char character, const char* query, size_t query_length)
+{
+  next[0] = previous[0] + 1;
+  size_t smallest = next[0];
+
+  for (size_t j = 1; j <= query_length; j++)
+  {
+    const size_t replace = previous[j - 1] + (character == query[j - 1] ? 0 : 1);
+    next[j] = std::min(std::min(previous[j], next[j - 1]) + 1, replace);
+    smallest = std::min(smallest, next[j]);
+  }
+
+  return smallest;
+}
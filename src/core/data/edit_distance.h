@@ -0,0 +1,44 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef _DEADLOCK_CORE_DATA_EDIT_DISTANCE_H_
+#define _DEADLOCK_CORE_DATA_EDIT_DISTANCE_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace deadlock
+{
+  namespace core
+  {
+    namespace data
+    {
+      /// Returns the Levenshtein distance between two strings: the number of characters
+      /// that must be inserted, removed or replaced to turn one into the other.
+      /// The row is used as scratch memory, to avoid allocating on every call.
+      size_t edit_distance(const char* a, size_t a_length, const char* b, size_t b_length, std::vector<size_t>& row);
+
+      /// Computes the next row of the edit distance matrix between a word and a query, for one more character of the word.
+      /// The previous row holds the distances from the word without that character to every prefix of the query,
+      /// and the returned value is the smallest distance in the next row; once it exceeds the maximum distance,
+      /// no word that starts with these characters can be close enough to the query.
+      size_t next_edit_distance_row(const size_t* previous, size_t* next, char character, const char* query, size_t query_length);
+    }
+  }
+}
+
+#endif
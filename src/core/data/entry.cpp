@@ -16,6 +16,7 @@
 
 #include "entry.h"
 
+#include "entry_collection.h"
 #include "../errors.h"
 #include "hexadecimal_convert.h"
 
@@ -24,6 +25,9 @@ using namespace deadlock::core::data;
 
 entry::entry()
 {
+  collection = nullptr;
+  position = 0;
+
   id = make_secure_string();
   username = make_secure_string();
   additional_data = make_secure_string();
@@ -34,14 +38,41 @@ entry::entry(const entry& other)
   // Copy the values; shared pointers are only used to manage per-instance storage,
   // not to share ownership between instances.
   id(make_secure_string(other.get_id())),
+  passwords(other.passwords_begin(), other.passwords_end()),
   username(make_secure_string(other.get_username())),
   additional_data(make_secure_string(other.get_additional_data())),
-  passwords(other.passwords_begin(), other.passwords_end())
+  // A copy is not part of the collection of the original
+  collection(nullptr),
+  position(0)
+{
+}
+
+void entry::set_id(const secure_string& new_id)
 {
+  id = make_secure_string(new_id);
+
+  // Let the collection update its index for the new identifier
+  if (collection != nullptr) collection->update_index(position);
+}
+
+void entry::set_username(const secure_string& new_username)
+{
+  username = make_secure_string(new_username);
+
+  if (collection != nullptr) collection->update_username_index(position);
+}
+
+void entry::set_additional_data(const secure_string& new_data)
+{
+  additional_data = make_secure_string(new_data);
+
+  if (collection != nullptr) collection->update_additional_data_index(position);
 }
 
 const password& entry::get_password() const
 {
+  require_passwords();
+
   // If the collection is empty, return a new, empty password
   if (passwords.empty()) return password::empty();
 
@@ -51,6 +82,8 @@ const password& entry::get_password() const
 
 void entry::set_password(const secure_string& new_password)
 {
+  require_passwords();
+
   // Add the new password to be the first password in the list, because it will have the latest timestamp (now)
   passwords.insert(passwords.begin(), password(new_password));
 }
@@ -128,8 +161,96 @@ void entry::deserialise(const serialisation::json_value::object_t& json_data)
   }
 }
 
+void entry::decode_passwords() const
+{
+  serialisation::binary_deserialiser deserialiser(encoded_passwords.data(), encoded_passwords.data() + encoded_passwords.size());
+
+  const std::uint64_t number_of_passwords = deserialiser.read_integer();
+  secure_string password_str;
+  for (std::uint64_t i = 0; i < number_of_passwords; i++)
+  {
+    const std::int64_t store_time = deserialiser.read_timestamp();
+    deserialiser.read_string(password_str);
+    passwords.push_back(password(password_str, store_time));
+  }
+
+  // Swapping with an empty string releases, and thereby zeroes, the memory
+  secure_string().swap(encoded_passwords);
+}
+
+size_t entry::approximate_passwords_size() const
+{
+  if (!encoded_passwords.empty()) return encoded_passwords.size();
+
+  size_t size = 0;
+  for (auto p = passwords.begin(); p != passwords.end(); p++)
+  {
+    // Every password also has a timestamp
+    size += p->get_password().size() + 16;
+  }
+  return size;
+}
+
+void entry::deserialise_lazily(serialisation::binary_deserialiser& deserialiser)
+{
+  deserialiser.read_string(*id);
+  deserialiser.read_string(*username);
+  deserialiser.read_string(*additional_data);
+
+  // Skip the passwords, which validates that the record is complete
+  const char* begin = deserialiser.get_current();
+  const std::uint64_t number_of_passwords = deserialiser.read_integer();
+  for (std::uint64_t i = 0; i < number_of_passwords; i++)
+  {
+    deserialiser.skip_timestamp();
+    deserialiser.skip_string();
+  }
+
+  passwords.clear();
+  encoded_passwords.assign(begin, deserialiser.get_current());
+}
+
+void entry::deserialise(serialisation::binary_deserialiser& deserialiser)
+{
+  deserialiser.read_string(*id);
+  deserialiser.read_string(*username);
+  deserialiser.read_string(*additional_data);
+
+  const std::uint64_t number_of_passwords = deserialiser.read_integer();
+  secure_string password_str;
+  for (std::uint64_t i = 0; i < number_of_passwords; i++)
+  {
+    const std::int64_t store_time = deserialiser.read_timestamp();
+    deserialiser.read_string(password_str);
+    passwords.push_back(password(password_str, store_time));
+  }
+}
+
+void entry::serialise(serialisation::binary_serialiser& serialiser) const
+{
+  serialiser.write_string(*id);
+  serialiser.write_string(*username);
+  serialiser.write_string(*additional_data);
+
+  // Passwords that were never decoded are written as they were read
+  if (!encoded_passwords.empty())
+  {
+    serialiser.write_encoded(encoded_passwords.data(), encoded_passwords.data() + encoded_passwords.size());
+    return;
+  }
+
+  serialiser.write_integer(passwords.size());
+  for (auto p = passwords.begin(); p != passwords.end(); p++)
+  {
+    serialiser.write_timestamp(p->get_stored_time());
+    serialiser.write_string(p->get_password());
+  }
+}
+
 void entry::serialise(serialisation::serialiser& serialiser, bool obfuscation)
 {
+  require_passwords();
+
   serialiser.write_begin_object();
   {
     if (obfuscation)
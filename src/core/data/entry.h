@@ -25,6 +25,8 @@
 #include "../circular_buffer.h"
 #include "../serialisation/value.h"
 #include "../serialisation/serialiser.h"
+#include "../serialisation/binary_serialiser.h"
+#include "../serialisation/binary_deserialiser.h"
 #include "secure_allocator.h"
 
 namespace deadlock
@@ -34,6 +36,7 @@ namespace deadlock
     namespace data
     {
       class entry;
+      class entry_collection;
 
       typedef std::shared_ptr<entry> entry_ptr;
 
@@ -43,6 +46,7 @@ namespace deadlock
       /// a username and additional data
       class entry
       {
+        friend class entry_collection;
 
       public:
 
@@ -58,7 +62,13 @@ namespace deadlock
 
         /// A list of passwords associated with the key
         /// The most recent one is the "best" passwords, but older passwords are stored by means of a backup.
-        password_collection passwords;
+        /// While the passwords are still encoded, this is empty.
+        mutable password_collection passwords;
+
+        /// The number of passwords and the passwords as they were read from the binary record, as long as they have not been decoded.
+        /// Most entries of a vault are only searched, so their passwords need never be decoded.
+        /// The entry holds a copy of just these bytes, so the chunk that the record was read from need not be kept.
+        mutable secure_string encoded_passwords;
 
         /// The username associated with the password.
         secure_string_ptr username;
@@ -66,6 +76,19 @@ namespace deadlock
         /// Can be used to store additional information with the key.
         secure_string_ptr additional_data;
 
+        /// The collection that this entry was added to, or nullptr if it is not part of a collection.
+        /// The collection is notified when a searchable field changes, so it can update its search index.
+        entry_collection* collection;
+
+        /// The position of this entry within the collection
+        size_t position;
+
+        /// Decodes the passwords, and lets go of their encoded bytes
+        void decode_passwords() const;
+
+        /// Decodes the passwords if they are still encoded. Encoded passwords always hold at least their number.
+        inline void require_passwords() const { if (!encoded_passwords.empty()) decode_passwords(); }
+
       public:
 
         /// Constructs an entry with empty password and other values.
@@ -78,13 +101,16 @@ namespace deadlock
         inline const secure_string& get_id() const { return *id; }
 
         /// Modifies the identifier associated with this entry
-        inline void set_id(const secure_string& new_id) { id = make_secure_string(new_id); }
+        void set_id(const secure_string& new_id);
 
         /// Returns an iterator to the first password
-        inline password_iterator passwords_begin() const { return passwords.begin(); }
+        inline password_iterator passwords_begin() const { require_passwords(); return passwords.begin(); }
 
         /// Returns an iterator past the last password
-        inline password_iterator passwords_end() const { return passwords.end(); }
+        inline password_iterator passwords_end() const { require_passwords(); return passwords.end(); }
+
+        /// Returns roughly how many bytes the passwords take when serialised, without decoding them
+        size_t approximate_passwords_size() const;
 
         /// Returns the current (most recent) password
         const password& get_password() const;
@@ -96,13 +122,13 @@ namespace deadlock
         inline const secure_string& get_username() const { return *username; }
 
         /// Mofifies the username associated with the key
-        inline void set_username(const secure_string& new_username) { username = make_secure_string(new_username); }
+        void set_username(const secure_string& new_username);
 
         /// Returns additional data associated with the key
         inline const secure_string& get_additional_data() const { return *additional_data; }
 
         /// Modifies additional data associated with the key
-        inline void set_additional_data(const secure_string& new_data) { additional_data = make_secure_string(new_data); }
+        void set_additional_data(const secure_string& new_data);
 
         /// Reconstructs the entries given the JSON data
         void deserialise(const serialisation::json_value::object_t& json_data);
@@ -111,6 +137,17 @@ namespace deadlock
         /// If obfuscation is true, this will write the data as hexadecimal strings.
         /// If it is false, it will write the data "as-is".
         void serialise(serialisation::serialiser& serialiser, bool obfuscation);
+
+        /// Reconstructs the entry from a binary record
+        void deserialise(serialisation::binary_deserialiser& deserialiser);
+
+        /// Reconstructs the entry from a binary record, but copies the passwords encoded, and decodes them
+        /// when they are first needed. Decoding is not safe to do from several threads at once, so neither is reading the passwords.
+        void deserialise_lazily(serialisation::binary_deserialiser& deserialiser);
+
+        /// Writes the entry as a binary record: the identifier, username and additional data,
+        /// followed by the number of passwords and every password with its timestamp.
+        void serialise(serialisation::binary_serialiser& serialiser) const;
       };
 
       /// Constructs an empty entry with the secure allocator
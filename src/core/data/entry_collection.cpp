@@ -21,25 +21,83 @@
 using namespace deadlock::core;
 using namespace deadlock::core::data;
 
+entry_collection::entry_collection()
+{
+  revision = 0;
+}
+
+entry_collection::~entry_collection()
+{
+  // The entries are shared, so they might outlive the collection
+  for (size_t i = 0; i < entries.size(); i++)
+  {
+    entries[i]->collection = nullptr;
+  }
+}
+
 void entry_collection::push_back(entry_ptr new_entry)
 {
+  // Let the entry know where it is, so it can notify the collection of changes
+  new_entry->collection = this;
+  new_entry->position = entries.size();
+
   entries.push_back(new_entry);
 
-  // TODO: update acceleration structure
+  // Update the acceleration structures
+  ids.push_back(new_entry->get_id());
+  usernames.push_back(new_entry->get_username());
+  additional_data.push_back(new_entry->get_additional_data());
+  revision++;
+}
+
+void entry_collection::replace(size_t position, entry_ptr new_entry)
+{
+  entries[position]->collection = nullptr;
+
+  new_entry->collection = this;
+  new_entry->position = position;
+  entries[position] = new_entry;
+
+  // Update the acceleration structures
+  const field_index::position_type index_position = static_cast<field_index::position_type>(position);
+  ids.update(index_position, new_entry->get_id());
+  usernames.update(index_position, new_entry->get_username());
+  additional_data.update(index_position, new_entry->get_additional_data());
+  revision++;
+}
+
+void entry_collection::update_index(size_t position)
+{
+  ids.update(static_cast<field_index::position_type>(position), entries[position]->get_id());
+  revision++;
+}
+
+void entry_collection::update_username_index(size_t position)
+{
+  usernames.update(static_cast<field_index::position_type>(position), entries[position]->get_username());
+  revision++;
+}
+
+void entry_collection::update_additional_data_index(size_t position)
+{
+  additional_data.update(static_cast<field_index::position_type>(position), entries[position]->get_additional_data());
+  revision++;
 }
 
 void entry_collection::deserialise(const serialisation::json_value::array_t& json_data)
 {
+  entries.reserve(entries.size() + json_data.size());
+
   // Loop through the data and read entries
   for (size_t i = 0; i < json_data.size(); i++)
   {
-    // Add a new, blank entry to the collection
-    entries.push_back(make_entry());
+    // Create a new, blank entry
+    entry_ptr new_entry = make_entry();
     // Load the correct data into it
-    entries.back()->deserialise(json_data[i]);
+    new_entry->deserialise(json_data[i]);
+    // And add it to the collection, which indexes it
+    push_back(new_entry);
   }
-
-  // TODO: generate acceleration structure
 }
 
 void entry_collection::serialise(serialisation::serialiser& serialiser, bool obfuscation)
@@ -21,6 +21,7 @@
 #include <memory>
 
 #include "entry.h"
+#include "field_index.h"
 #include "../serialisation/value.h"
 #include "../serialisation/serialiser.h"
 #include "secure_allocator.h"
@@ -36,17 +37,52 @@ namespace deadlock
       /// and it handles finding possible matches for a given search string.
       class entry_collection
       {
+        friend class entry;
+
       protected:
 
         /// The list of entries
         std::vector<std::shared_ptr<entry>> entries;
 
+        /// Acceleration structure that finds the entries whose identifier can match a search query
+        field_index ids;
+
+        /// Acceleration structure that finds entries by username
+        field_index usernames;
+
+        /// Acceleration structure that finds entries by the words in their additional data
+        field_index additional_data;
+
+        /// Incremented whenever an entry is added or an indexed field changes
+        size_t revision;
+
+        /// Called by an entry in the collection when its identifier changed
+        void update_index(size_t position);
+
+        /// Called by an entry in the collection when its username changed
+        void update_username_index(size_t position);
+
+        /// Called by an entry in the collection when its additional data changed
+        void update_additional_data_index(size_t position);
+
       public:
 
         typedef std::shared_ptr<entry> entry_ptr;
         typedef std::vector<entry_ptr>::iterator entry_iterator;
         typedef std::vector<entry_ptr>::const_iterator const_entry_iterator;
 
+        /// Creates an empty collection
+        entry_collection();
+
+        /// Detaches the entries from the collection, as they might outlive it
+        ~entry_collection();
+
+        /// Entries refer back to the collection they are in, so a collection cannot be copied
+        entry_collection(const entry_collection&) = delete;
+
+        /// Entries refer back to the collection they are in, so a collection cannot be copied
+        entry_collection& operator=(const entry_collection&) = delete;
+
         /// Reconstructs the entries given the JSON data
         void deserialise(const serialisation::json_value::array_t& json_data);
 
@@ -55,9 +91,36 @@ namespace deadlock
         /// Otherwise, it will write the passwords as-is.
         void serialise(serialisation::serialiser& serialiser, bool obfuscation);
 
-        /// Adds a new entry to the collection
+        /// Adds a new entry to the collection.
+        /// An entry can be part of one collection at a time.
         void push_back(entry_ptr entry);
 
+        /// Replaces the entry at the given position with a new entry.
+        /// The old entry is no longer part of the collection.
+        void replace(size_t position, entry_ptr new_entry);
+
+        /// Returns a number that changes whenever an entry is added or an indexed field changes,
+        /// so results derived from the collection can tell whether they are still valid
+        inline size_t get_revision() const { return revision; }
+
+        /// Returns the number of entries
+        inline size_t size() const { return entries.size(); }
+
+        /// Returns the entry at the given position
+        inline const entry_ptr& at(size_t position) const { return entries[position]; }
+
+        /// Returns the normalised identifiers of the entries, used for searching
+        inline const id_column& get_ids() const { return ids.get_column(); }
+
+        /// Returns the acceleration structure used for searching
+        inline const word_index& get_index() const { return ids.get_index(); }
+
+        /// Returns the normalised usernames of the entries, with their index
+        inline const field_index& get_usernames() const { return usernames; }
+
+        /// Returns the normalised additional data of the entries, with its index
+        inline const field_index& get_additional_data() const { return additional_data; }
+
         /// Returns an iterator to the first entry
         inline entry_iterator begin() { return entries.begin(); }
 
@@ -0,0 +1,34 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "field_index.h"
+
+using namespace deadlock::core::data;
+
+void field_index::push_back(const secure_string& text)
+{
+  const position_type position = static_cast<position_type>(column.size());
+  column.push_back(text);
+  index.insert(position, column[position]);
+}
+
+void field_index::update(position_type position, const secure_string& text)
+{
+  // The index must be updated with the old words before the column forgets them
+  index.remove(position, column[position]);
+  column.update(position, text);
+  index.insert(position, column[position]);
+}
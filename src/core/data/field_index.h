@@ -0,0 +1,64 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _DEADLOCK_CORE_DATA_FIELD_INDEX_H_
+#define _DEADLOCK_CORE_DATA_FIELD_INDEX_H_
+
+#include "id_column.h"
+#include "word_index.h"
+
+namespace deadlock
+{
+  namespace core
+  {
+    namespace data
+    {
+      /// The normalised text of one field of every entry, such as the identifier or the username,
+      /// together with the index that finds the entries that can match a search query in that field.
+      class field_index
+      {
+      public:
+
+        /// The position of an entry in the collection
+        typedef id_column::position_type position_type;
+
+      protected:
+
+        /// The normalised text of every entry
+        id_column column;
+
+        /// Finds entries by the words in the column
+        word_index index;
+
+      public:
+
+        /// Adds the text of a new entry
+        void push_back(const secure_string& text);
+
+        /// Replaces the text of the entry at the given position
+        void update(position_type position, const secure_string& text);
+
+        /// Returns the normalised text of every entry
+        inline const id_column& get_column() const { return column; }
+
+        /// Returns the index of the words in the column
+        inline const word_index& get_index() const { return index; }
+      };
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,171 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "id_column.h"
+
+#include <cctype>
+#include <locale>
+
+using namespace deadlock::core::data;
+
+id_column::id_column()
+{
+  unused_characters = 0;
+}
+
+void id_column::normalise(const secure_string& str, secure_char_vector& characters, std::vector<word_span>& word_spans)
+{
+  const size_t first = characters.size();
+
+  // Transform every character to lowercase
+  // TODO: UTF-8 tolower, and what about the locale?
+  characters.insert(characters.end(), str.begin(), str.end());
+  char* lower = characters.data() + first;
+  std::use_facet<std::ctype<char>>(std::locale()).tolower(lower, lower + str.size());
+
+  // Split into words on whitespace or periods
+  std::uint32_t from = 0;
+  std::uint32_t to = 0;
+  const std::uint32_t length = static_cast<std::uint32_t>(str.size());
+
+  for (; to < length; to++)
+  {
+    const unsigned char ch = static_cast<unsigned char>(lower[to]);
+    if (std::isspace(ch) || ch == '.')
+    {
+      if (from < to)
+      {
+        word_span w = { from, to - from };
+        word_spans.push_back(w);
+      }
+      from = to + 1;
+    }
+  }
+
+  if (from < to)
+  {
+    word_span w = { from, to - from };
+    word_spans.push_back(w);
+  }
+}
+
+void id_column::make_acronym(const char* id, size_t id_length, secure_char_vector& characters)
+{
+  const size_t first = characters.size();
+  bool inside_word = false;
+  bool after_lowercase = false;
+
+  // Loop through the characters
+  for (size_t i = 0; i < id_length; i++)
+  {
+    // TODO: what about UTF-8 etc?
+    // The classification functions are only defined for the values of unsigned char, and UTF-8 bytes are negative chars
+    const unsigned char ch = static_cast<unsigned char>(id[i]);
+    bool alnum = std::isalnum(ch) != 0;
+
+    // At the start of a word, append the character to the acronym.
+    // An uppercase letter after a lowercase one starts a word too, as in 'GitHub'.
+    bool upper = std::isupper(ch) != 0;
+    if (alnum && (!inside_word || (upper && after_lowercase)))
+    {
+      characters.push_back(id[i]);
+    }
+
+    inside_word = alnum;
+    after_lowercase = std::islower(ch) != 0;
+  }
+
+  char* acronym = characters.data() + first;
+  std::use_facet<std::ctype<char>>(std::locale()).tolower(acronym, acronym + (characters.size() - first));
+}
+
+id_column::row id_column::append(const secure_string& id)
+{
+  row r;
+  r.id_begin = static_cast<std::uint32_t>(characters.size());
+  r.id_length = static_cast<std::uint32_t>(id.size());
+  r.words_begin = static_cast<std::uint32_t>(words.size());
+
+  normalise(id, characters, words);
+  r.number_of_words = static_cast<std::uint32_t>(words.size()) - r.words_begin;
+
+  // The acronym is stored directly after the identifier.
+  // It is made from the original identifier, because uppercase letters can start a word.
+  make_acronym(id.data(), id.size(), characters);
+  r.acronym_length = static_cast<std::uint32_t>(characters.size()) - r.id_begin - r.id_length;
+
+  return r;
+}
+
+void id_column::push_back(const secure_string& id)
+{
+  rows.push_back(append(id));
+}
+
+void id_column::update(position_type position, const secure_string& id)
+{
+  row& old_row = rows[position];
+
+  // Zero the old identifier, it is not used any more
+  const size_t old_length = old_row.id_length + old_row.acronym_length;
+  detail::secure_memzero(characters.data() + old_row.id_begin, old_length);
+  unused_characters += old_length;
+
+  // Append the new identifier at the end
+  rows[position] = append(id);
+
+  // Reclaim the space of replaced identifiers once it makes up more than half of the column
+  if (unused_characters > characters.size() / 2) compact();
+}
+
+void id_column::compact()
+{
+  secure_char_vector new_characters;
+  std::vector<word_span> new_words;
+  new_characters.reserve(characters.size() - unused_characters);
+  new_words.reserve(words.size());
+
+  // Copy the data of every row, in order
+  for (auto r = rows.begin(); r != rows.end(); r++)
+  {
+    const std::uint32_t id_begin = static_cast<std::uint32_t>(new_characters.size());
+    const std::uint32_t words_begin = static_cast<std::uint32_t>(new_words.size());
+
+    auto c = characters.begin() + r->id_begin;
+    new_characters.insert(new_characters.end(), c, c + r->id_length + r->acronym_length);
+
+    auto w = words.begin() + r->words_begin;
+    new_words.insert(new_words.end(), w, w + r->number_of_words);
+
+    r->id_begin = id_begin;
+    r->words_begin = words_begin;
+  }
+
+  // The secure allocator zeroes the old arrays
+  characters.swap(new_characters);
+  words.swap(new_words);
+  unused_characters = 0;
+}
+
+void id_column::clear()
+{
+  // Clearing does not release the memory, so zero it here
+  detail::secure_memzero(characters.data(), characters.size());
+  characters.clear();
+  words.clear();
+  rows.clear();
+  unused_characters = 0;
+}
@@ -0,0 +1,211 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _DEADLOCK_CORE_DATA_ID_COLUMN_H_
+#define _DEADLOCK_CORE_DATA_ID_COLUMN_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "secure_string.h"
+#include "secure_allocator.h"
+
+namespace deadlock
+{
+  namespace core
+  {
+    namespace data
+    {
+      /// A vector of characters that zeroes its memory upon deallocation
+      typedef std::vector<char, detail::secure_allocator<char>> secure_char_vector;
+
+      /// The location of a word within a normalised identifier
+      struct word_span
+      {
+        /// Offset of the first character, relative to the start of the identifier
+        std::uint32_t begin;
+
+        /// The number of characters in the word
+        std::uint32_t length;
+      };
+
+      /// A view of one normalised identifier, as used by the search algorithm.
+      /// The view points into storage owned by someone else.
+      struct normalised_id
+      {
+        /// The lowercase identifier
+        const char* id;
+
+        /// The number of characters in the identifier
+        size_t id_length;
+
+        /// The words of the identifier
+        const word_span* words;
+
+        /// The number of words
+        size_t number_of_words;
+
+        /// The lowercase acronym of the identifier
+        const char* acronym;
+
+        /// The number of characters in the acronym
+        size_t acronym_length;
+
+        /// Returns a pointer to the first character of the given word
+        inline const char* word(size_t i) const { return id + words[i].begin; }
+      };
+
+      /// Stores the lowercase identifier, the word boundaries and the acronym of every entry
+      /// in a few contiguous arrays, so the search algorithm can scan them without allocating memory.
+      class id_column
+      {
+      public:
+
+        /// The position of an entry in the column
+        typedef std::uint32_t position_type;
+
+      protected:
+
+        /// The location of the data of one entry in the arrays
+        struct row
+        {
+          /// Offset of the identifier in the character array; the acronym follows the identifier
+          std::uint32_t id_begin;
+
+          /// Number of characters in the identifier
+          std::uint32_t id_length;
+
+          /// Number of characters in the acronym
+          std::uint32_t acronym_length;
+
+          /// Index of the first word in the word array
+          std::uint32_t words_begin;
+
+          /// Number of words
+          std::uint32_t number_of_words;
+        };
+
+        /// The lowercase identifiers and acronyms of all entries
+        secure_char_vector characters;
+
+        /// The words of all entries
+        std::vector<word_span> words;
+
+        /// One row per entry
+        std::vector<row> rows;
+
+        /// The number of characters that are no longer used because an identifier was replaced
+        size_t unused_characters;
+
+        /// Appends the normalised identifier to the arrays, and returns its row
+        row append(const secure_string& id);
+
+        /// Rebuilds the arrays without the unused parts
+        void compact();
+
+      public:
+
+        /// Creates an empty column
+        id_column();
+
+        /// Converts str to lowercase and appends it to characters, and appends its words to word_spans.
+        /// Word offsets are relative to the first appended character.
+        /// This is the normalisation that the search algorithm applies to queries and identifiers.
+        static void normalise(const secure_string& str, secure_char_vector& characters, std::vector<word_span>& word_spans);
+
+        /// Appends the lowercase acronym of the identifier: the first character of every alphanumeric run,
+        /// and every uppercase letter that follows a lowercase letter. The acronym of 'GitHub Enterprise' is 'ghe'.
+        static void make_acronym(const char* id, size_t id_length, secure_char_vector& characters);
+
+        /// Adds the identifier of a new entry to the column
+        void push_back(const secure_string& id);
+
+        /// Replaces the identifier of the entry at the given position.
+        /// This invalidates views obtained earlier.
+        void update(position_type position, const secure_string& id);
+
+        /// Removes all entries
+        void clear();
+
+        /// Returns the number of entries
+        inline size_t size() const { return rows.size(); }
+
+        /// Returns the normalised identifier of the entry at the given position
+        inline normalised_id operator[](position_type position) const
+        {
+          const row& r = rows[position];
+          normalised_id view;
+          view.id = characters.data() + r.id_begin;
+          view.id_length = r.id_length;
+          view.words = words.data() + r.words_begin;
+          view.number_of_words = r.number_of_words;
+          view.acronym = view.id + r.id_length;
+          view.acronym_length = r.acronym_length;
+          return view;
+        }
+      };
+
+      /// Owns the storage of one normalised string, such as a search query
+      class normalised_string
+      {
+      protected:
+
+        /// The lowercase string, followed by its acronym
+        secure_char_vector characters;
+
+        /// The words of the string
+        std::vector<word_span> word_spans;
+
+        /// The number of characters in the string, without acronym
+        size_t length;
+
+      public:
+
+        /// Creates an empty normalised string
+        inline normalised_string() : length(0) {}
+
+        /// Normalises the string
+        inline explicit normalised_string(const secure_string& str) { assign(str); }
+
+        /// Normalises the string, reusing the storage of the previous string
+        inline void assign(const secure_string& str)
+        {
+          detail::secure_memzero(characters.data(), characters.size());
+          characters.clear();
+          word_spans.clear();
+          id_column::normalise(str, characters, word_spans);
+          length = str.size();
+          id_column::make_acronym(str.data(), str.size(), characters);
+        }
+
+        /// Returns a view of the normalised string
+        inline normalised_id view() const
+        {
+          normalised_id v;
+          v.id = characters.data();
+          v.id_length = length;
+          v.words = word_spans.data();
+          v.number_of_words = word_spans.size();
+          v.acronym = v.id + length;
+          v.acronym_length = characters.size() - length;
+          return v;
+        }
+      };
+    }
+  }
+}
+
+#endif
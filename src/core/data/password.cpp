@@ -24,7 +24,7 @@ using namespace deadlock::core::data;
 password password::empty_password = password("", 0x0);
 
 password::password(const secure_string& password_str, std::int64_t stored_time) :
-  password_string(make_secure_string(password_str)), store_time(stored_time)
+  store_time(stored_time), password_string(make_secure_string(password_str))
 {
 
 }
@@ -40,8 +40,8 @@ password::password(const secure_string& password_str) :
 password::password(const password& other)
   :
   // Copy the data, because the shared_ptr is only used for secure memory erasing.
-  password_string(make_secure_string(other.get_password())),
-  store_time(other.get_stored_time())
+  store_time(other.get_stored_time()),
+  password_string(make_secure_string(other.get_password()))
 {
 
 }
@@ -58,7 +58,7 @@ namespace deadlock
 
             template<typename U> struct rebind { typedef secure_allocator<U> other; };
             secure_allocator() throw() {}
-            secure_allocator(const secure_allocator&) throw() {}
+            secure_allocator(const secure_allocator& other) throw() : std::allocator<T>(other) {}
             template <typename U> secure_allocator(const secure_allocator<U>&) throw() {}
 
             void deallocate(pointer p, size_type num)
@@ -0,0 +1,221 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "word_index.h"
+#include "edit_distance.h"
+
+#include <algorithm>
+#include <iterator>
+
+using namespace deadlock::core::data;
+
+void word_index::insert(dictionary& dict, const secure_string& word, position_type position)
+{
+  posting_list& list = dict[word];
+
+  // New entries are appended in increasing order, so usually the position goes at the end
+  if (list.empty() || list.back() < position)
+  {
+    list.push_back(position);
+  }
+  else
+  {
+    // An identifier can contain a word more than once, but it is listed only once
+    auto p = std::lower_bound(list.begin(), list.end(), position);
+    if (p == list.end() || *p != position) list.insert(p, position);
+  }
+}
+
+void word_index::remove(dictionary& dict, const secure_string& word, position_type position)
+{
+  auto w = dict.find(word);
+  if (w == dict.end()) return;
+
+  posting_list& list = w->second;
+  auto p = std::lower_bound(list.begin(), list.end(), position);
+  if (p != list.end() && *p == position) list.erase(p);
+
+  // Do not keep words that no entry contains any more
+  if (list.empty()) dict.erase(w);
+}
+
+void word_index::append_with_prefix(const dictionary& dict, const secure_string& prefix, posting_list& candidates)
+{
+  // The words that start with the prefix are consecutive in the dictionary
+  for (auto w = dict.lower_bound(prefix); w != dict.end() && w->first.compare(0, prefix.size(), prefix) == 0; w++)
+  {
+    candidates.insert(candidates.end(), w->second.begin(), w->second.end());
+  }
+}
+
+void word_index::insert(position_type position, const normalised_id& id)
+{
+  for (size_t i = 0; i < id.number_of_words; i++)
+  {
+    const char* word = id.word(i);
+    const size_t length = id.words[i].length;
+
+    insert(words, secure_string(word, length), position);
+    insert(reversed_words, secure_string(std::reverse_iterator<const char*>(word + length), std::reverse_iterator<const char*>(word)), position);
+  }
+
+  if (id.acronym_length > 0) insert(acronyms, secure_string(id.acronym, id.acronym_length), position);
+}
+
+void word_index::remove(position_type position, const normalised_id& id)
+{
+  for (size_t i = 0; i < id.number_of_words; i++)
+  {
+    const char* word = id.word(i);
+    const size_t length = id.words[i].length;
+
+    remove(words, secure_string(word, length), position);
+    remove(reversed_words, secure_string(std::reverse_iterator<const char*>(word + length), std::reverse_iterator<const char*>(word)), position);
+  }
+
+  if (id.acronym_length > 0) remove(acronyms, secure_string(id.acronym, id.acronym_length), position);
+}
+
+void word_index::clear()
+{
+  words.clear();
+  reversed_words.clear();
+  acronyms.clear();
+}
+
+void word_index::find_candidates(const normalised_id& query, posting_list& candidates) const
+{
+  find_word_candidates(query, candidates);
+
+  if (can_match_acronym(query))
+  {
+    append_with_prefix(acronyms, secure_string(query.word(0), query.words[0].length), candidates);
+
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+  }
+}
+
+void word_index::append_similar(const char* query, size_t length, size_t max_distance, posting_list& candidates) const
+{
+  // The sorted words are walked as if they were a trie. Consecutive words share a prefix, so the rows of the
+  // edit distance matrix for that prefix are kept. Once every distance in a row exceeds max_distance,
+  // no word with that prefix is close enough, and all of them are skipped with one lookup.
+  std::vector<size_t> rows(length + 1);
+  for (size_t j = 0; j <= length; j++) rows[j] = j;
+
+  // The rows of the matrix are valid for the first valid_length characters of this word
+  secure_string prefix, next_prefix;
+  size_t valid_length = 0;
+
+  auto w = words.begin();
+  while (w != words.end())
+  {
+    const secure_string& word = w->first;
+
+    // Keep the rows for the prefix that this word shares with the previous one
+    const size_t limit = std::min(valid_length, word.size());
+    valid_length = 0;
+    while (valid_length < limit && prefix[valid_length] == word[valid_length]) valid_length++;
+    prefix.resize(valid_length);
+    if (rows.size() < (word.size() + 1) * (length + 1)) rows.resize((word.size() + 1) * (length + 1));
+
+    bool skipped = false;
+    while (valid_length < word.size())
+    {
+      const size_t* previous = &rows[valid_length * (length + 1)];
+      size_t* next = &rows[(valid_length + 1) * (length + 1)];
+      const size_t smallest = next_edit_distance_row(previous, next, word[valid_length], query, length);
+      prefix.push_back(word[valid_length]);
+      valid_length++;
+
+      if (smallest > max_distance)
+      {
+        // Continue after the last word with this prefix, at the first word that is greater than the prefix
+        // in the character where they differ; a prefix of only the highest character has no such word
+        next_prefix = prefix;
+        while (!next_prefix.empty() && static_cast<unsigned char>(next_prefix.back()) == 0xff) next_prefix.pop_back();
+        if (next_prefix.empty())
+        {
+          w = words.end();
+        }
+        else
+        {
+          next_prefix.back() = static_cast<char>(static_cast<unsigned char>(next_prefix.back()) + 1);
+          w = words.lower_bound(next_prefix);
+        }
+        skipped = true;
+        break;
+      }
+    }
+    if (skipped) continue;
+
+    if (rows[word.size() * (length + 1) + length] <= max_distance)
+    {
+      candidates.insert(candidates.end(), w->second.begin(), w->second.end());
+    }
+    w++;
+  }
+}
+
+void word_index::find_similar_candidates(const normalised_id& query, size_t max_distance, posting_list& candidates) const
+{
+  find_candidates(query, candidates);
+
+  for (size_t i = 0; i < query.number_of_words; i++)
+  {
+    append_similar(query.word(i), query.words[i].length, max_distance, candidates);
+  }
+
+  std::sort(candidates.begin(), candidates.end());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+}
+
+void word_index::find_acronym_candidates(const normalised_id& query, posting_list& candidates) const
+{
+  candidates.clear();
+  append_with_prefix(acronyms, secure_string(query.word(0), query.words[0].length), candidates);
+
+  // An acronym can be the prefix of several acronyms in the index, but every entry has one acronym
+  std::sort(candidates.begin(), candidates.end());
+}
+
+void word_index::find_word_candidates(const normalised_id& query, posting_list& candidates) const
+{
+  candidates.clear();
+
+  for (size_t i = 0; i < query.number_of_words; i++)
+  {
+    const secure_string word(query.word(i), query.words[i].length);
+
+    // Words that start with the query word (including the query word itself)
+    append_with_prefix(words, word, candidates);
+
+    // Words that the query word starts with
+    for (size_t length = 1; length < word.size(); length++)
+    {
+      auto w = words.find(word.substr(0, length));
+      if (w != words.end()) candidates.insert(candidates.end(), w->second.begin(), w->second.end());
+    }
+
+    // Words that end with the query word
+    append_with_prefix(reversed_words, secure_string(word.rbegin(), word.rend()), candidates);
+  }
+
+  // Entries are usually found through more than one word
+  std::sort(candidates.begin(), candidates.end());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+}
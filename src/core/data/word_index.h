@@ -0,0 +1,117 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _DEADLOCK_CORE_DATA_WORD_INDEX_H_
+#define _DEADLOCK_CORE_DATA_WORD_INDEX_H_
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "id_column.h"
+
+namespace deadlock
+{
+  namespace core
+  {
+    namespace data
+    {
+      /// An inverted index that maps every word of a normalised identifier
+      /// to the positions of the entries that contain the word.
+      /// The search algorithm only awards points to a pair of words when one is a prefix of the other,
+      /// or when the query word is a suffix of the identifier word. The words are kept sorted,
+      /// and also sorted by their reverse, so all such words can be found with a few range lookups.
+      /// The acronyms of the identifiers are kept sorted as well, to find them by their beginning.
+      class word_index
+      {
+      public:
+
+        /// The position of an entry in the collection
+        typedef std::uint32_t position_type;
+
+        /// A sorted list of entry positions
+        typedef std::vector<position_type> posting_list;
+
+      protected:
+
+        /// Maps a word to the positions of the entries that contain it
+        typedef std::map<secure_string, posting_list, std::less<secure_string>,
+          detail::secure_allocator<std::pair<const secure_string, posting_list>>> dictionary;
+
+        /// The words of all identifiers
+        dictionary words;
+
+        /// The words of all identifiers, reversed, to find words by their ending
+        dictionary reversed_words;
+
+        /// The acronyms of all identifiers
+        dictionary acronyms;
+
+        /// Adds the position to the posting list of the word
+        static void insert(dictionary& dict, const secure_string& word, position_type position);
+
+        /// Removes the position from the posting list of the word
+        static void remove(dictionary& dict, const secure_string& word, position_type position);
+
+        /// Appends the posting lists of all words in the dictionary that start with prefix
+        static void append_with_prefix(const dictionary& dict, const secure_string& prefix, posting_list& candidates);
+
+        /// Appends the posting lists of all words within max_distance edits of the query word
+        void append_similar(const char* query, size_t length, size_t max_distance, posting_list& candidates) const;
+
+      public:
+
+        /// Adds the words of the entry at the given position
+        void insert(position_type position, const normalised_id& id);
+
+        /// Removes the words of the entry at the given position.
+        /// The identifier must be the one the entry was inserted with.
+        void remove(position_type position, const normalised_id& id);
+
+        /// Removes all entries from the index
+        void clear();
+
+        /// Returns whether the query can match acronyms. Only a query of one word of at least two characters can.
+        static inline bool can_match_acronym(const normalised_id& query)
+        {
+          return query.number_of_words == 1 && query.words[0].length >= 2;
+        }
+
+        /// Returns whether the query contains any words, and thus whether the index can be used.
+        /// Without words, only an exact match of the full identifier could match,
+        /// which the index cannot answer.
+        static inline bool can_answer(const normalised_id& query) { return query.number_of_words > 0; }
+
+        /// Stores the positions of all entries that can match the query in candidates, in ascending order.
+        void find_candidates(const normalised_id& query, posting_list& candidates) const;
+
+        /// Stores the positions of all entries with a word that can match a word of the query in candidates,
+        /// in ascending order. Unlike find_candidates, this does not include entries that match by acronym only.
+        void find_word_candidates(const normalised_id& query, posting_list& candidates) const;
+
+        /// Stores the positions of all entries that can match the query when every word of the query
+        /// may contain up to max_distance typos, in ascending order. This includes the result of find_candidates.
+        void find_similar_candidates(const normalised_id& query, size_t max_distance, posting_list& candidates) const;
+
+        /// Stores the positions of all entries with an acronym that starts with the word of the query
+        /// in candidates, in ascending order. The query must be able to match acronyms.
+        void find_acronym_candidates(const normalised_id& query, posting_list& candidates) const;
+      };
+    }
+  }
+}
+
+#endif
@@ -63,6 +63,13 @@ namespace deadlock
       incorrect_key_error(std::string const& msg) : key_error(msg) {}
     };
 
+    /// Indicates that encrypted data was changed after it was encrypted
+    class authentication_error : public crypt_error
+    {
+    public:
+      authentication_error(std::string const& msg) : crypt_error(msg) {}
+    };
+
     /// A problem related to compression or decompression
     class xz_error : public std::runtime_error
     {
@@ -0,0 +1,452 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "key_agent.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifndef _WIN32
+  #include <cerrno>
+  #include <cstdlib>
+  #include <cstring>
+  #include <poll.h>
+  #include <sys/mman.h>
+  #include <sys/socket.h>
+  #include <sys/stat.h>
+  #include <sys/types.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+  #ifdef __linux__
+    #include <sys/prctl.h>
+  #endif
+#endif
+
+#include "endianness.h"
+#include "data/secure_string.h"
+
+using namespace deadlock::core;
+
+#ifdef _WIN32
+
+key_agent::key_agent(const std::string&, std::uint32_t)
+{
+  throw std::runtime_error("The key agent is not available on Windows.");
+}
+
+key_agent::~key_agent()
+{
+}
+
+void key_agent::run(const std::atomic<bool>&)
+{
+}
+
+std::string key_agent::get_socket_path()
+{
+  return std::string();
+}
+
+bool key_agent::find_key(const std::string&, const std::string&, const std::uint8_t*, std::uint32_t, cryptography::key&)
+{
+  return false;
+}
+
+bool key_agent::store_key(const std::string&, const std::string&, const cryptography::key&)
+{
+  return false;
+}
+
+bool key_agent::forget_keys(const std::string&)
+{
+  return false;
+}
+
+#else
+
+/// Asks for the key of a vault; the agent answers with a status byte, followed by the key if it has it
+static const char request_find = 'F';
+
+/// Gives the key of a vault to the agent; the agent answers with a status byte
+static const char request_store = 'S';
+
+/// Makes the agent forget all keys; the agent answers with a status byte
+static const char request_forget = 'D';
+
+/// The longest path of a vault that the agent accepts
+static const std::uint32_t max_path_length = 4096;
+
+/// Fills in the address of the socket, and returns false if the path is too long for it
+static bool make_address(const std::string& socket_path, sockaddr_un& address)
+{
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) return false;
+  std::copy(socket_path.begin(), socket_path.end(), address.sun_path);
+  return true;
+}
+
+/// Returns whether the process at the other end of the connection runs as the same user as this one
+static bool is_same_user(int connection)
+{
+#ifdef SO_PEERCRED
+  ucred credentials;
+  socklen_t length = sizeof(credentials);
+  if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0) return false;
+  return credentials.uid == getuid();
+#else
+  uid_t user;
+  gid_t group;
+  if (getpeereid(connection, &user, &group) != 0) return false;
+  return user == getuid();
+#endif
+}
+
+/// Makes reading from and writing to the connection give up after the given number of seconds,
+/// so neither side waits forever for the other
+static void set_timeouts(int connection, long seconds)
+{
+  timeval timeout;
+  timeout.tv_sec = seconds;
+  timeout.tv_usec = 0;
+  setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/// Writes all bytes to the connection, and returns whether that succeeded
+static bool write_all(int connection, const void* data, size_t length)
+{
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL; // A client that went away must not kill the agent
+#else
+  const int flags = 0;
+#endif
+  const char* bytes = static_cast<const char*>(data);
+  while (length > 0)
+  {
+    const ssize_t written = send(connection, bytes, length, flags);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return false;
+    bytes += written;
+    length -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+/// Reads exactly the given number of bytes from the connection, and returns whether that succeeded
+static bool read_all(int connection, void* data, size_t length)
+{
+  char* bytes = static_cast<char*>(data);
+  while (length > 0)
+  {
+    const ssize_t received = recv(connection, bytes, length, 0);
+    if (received < 0 && errno == EINTR) continue;
+    if (received <= 0) return false;
+    bytes += received;
+    length -= static_cast<size_t>(received);
+  }
+  return true;
+}
+
+/// Connects to the agent, and returns the connection, or -1 if no agent of this user is listening on the socket
+static int connect_to_agent(const std::string& socket_path)
+{
+  sockaddr_un address;
+  if (!make_address(socket_path, address)) return -1;
+
+  const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection < 0) return -1;
+
+  // Anyone can put a socket in /tmp, but keys are only given to an agent of the same user
+  if (connect(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || !is_same_user(connection))
+  {
+    close(connection);
+    return -1;
+  }
+
+  set_timeouts(connection, 2);
+  return connection;
+}
+
+/// Returns the absolute path of the vault without symbolic links, so every way to name it finds the same key
+static std::string canonical_path(const std::string& filename)
+{
+  char* resolved = realpath(filename.c_str(), nullptr);
+  if (resolved == nullptr) return filename;
+
+  const std::string path(resolved);
+  std::free(resolved);
+  return path;
+}
+
+/// Builds a request for the key that was derived from the salt with the given number of iterations for the vault
+static data::secure_string make_request(char request, const std::string& vault_filename, const std::uint8_t* salt, std::uint32_t iterations)
+{
+  const std::string path = canonical_path(vault_filename);
+  const std::uint32_t path_length = internal_to_portable(static_cast<std::uint32_t>(path.size()));
+  const std::uint32_t portable_iterations = internal_to_portable(iterations);
+
+  data::secure_string message(1, request);
+  message.append(reinterpret_cast<const char*>(&path_length), 4);
+  message.append(path.data(), path.size());
+  message.append(reinterpret_cast<const char*>(salt), cryptography::key::salt_size);
+  message.append(reinterpret_cast<const char*>(&portable_iterations), 4);
+  return message;
+}
+
+key_agent::key_agent(const std::string& socket_path, std::uint32_t seconds_to_live)
+  : socket_path(socket_path), time_to_live(seconds_to_live)
+{
+  for (size_t i = 0; i < capacity; i++) slots[i].used = false;
+
+#ifdef __linux__
+  // Other processes of the user must not read the keys by debugging the agent, and a crash must not dump them
+  prctl(PR_SET_DUMPABLE, 0);
+#endif
+
+  if (mlock(slots, sizeof(slots)) != 0)
+  {
+    throw std::runtime_error("Could not lock the memory for the keys; the limit on locked memory may be too low.");
+  }
+
+  sockaddr_un address;
+  if (!make_address(socket_path, address))
+  {
+    munlock(slots, sizeof(slots));
+    throw std::runtime_error("The path of the socket is too long.");
+  }
+
+  // A socket that an agent left behind when it was killed is replaced, but a running agent is not
+  const int running = connect_to_agent(socket_path);
+  if (running >= 0)
+  {
+    close(running);
+    munlock(slots, sizeof(slots));
+    throw std::runtime_error("An agent is running already.");
+  }
+  struct stat status;
+  if (lstat(socket_path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) unlink(socket_path.c_str());
+
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0)
+  {
+    munlock(slots, sizeof(slots));
+    throw std::runtime_error("Could not create the socket.");
+  }
+
+  // Only the user may connect to the socket
+  const mode_t previous_mask = umask(0077);
+  const bool listening = bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0 && listen(listener, 16) == 0;
+  umask(previous_mask);
+  if (!listening)
+  {
+    close(listener);
+    munlock(slots, sizeof(slots));
+    throw std::runtime_error("Could not listen on " + socket_path + ": " + std::strerror(errno));
+  }
+}
+
+key_agent::~key_agent()
+{
+  close(listener);
+  unlink(socket_path.c_str());
+
+  for (size_t i = 0; i < capacity; i++) forget(i);
+  munlock(slots, sizeof(slots));
+}
+
+void key_agent::forget(size_t i)
+{
+  data::detail::secure_memzero(&slots[i], sizeof(slot));
+  slots[i].used = false;
+  vaults[i].clear();
+}
+
+boost::chrono::milliseconds key_agent::expire()
+{
+  // Wake up at least once a second, so the agent notices that it should stop even without a signal
+  const boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+  boost::chrono::steady_clock::time_point next = now + boost::chrono::seconds(1);
+
+  for (size_t i = 0; i < capacity; i++)
+  {
+    if (!slots[i].used) continue;
+    if (slots[i].expiry <= now) forget(i);
+    else next = std::min(next, slots[i].expiry);
+  }
+
+  return boost::chrono::duration_cast<boost::chrono::milliseconds>(next - now) + boost::chrono::milliseconds(1);
+}
+
+void key_agent::run(const std::atomic<bool>& stopped)
+{
+  while (!stopped)
+  {
+    pollfd request;
+    request.fd = listener;
+    request.events = POLLIN;
+    request.revents = 0;
+
+    const int ready = poll(&request, 1, static_cast<int>(expire().count()));
+    if (ready < 0 && errno == EINTR) continue;
+    if (ready < 0) throw std::runtime_error("Could not wait for requests.");
+    if (ready == 0) continue;
+
+    const int connection = accept(listener, nullptr, nullptr);
+    if (connection < 0) continue;
+
+    set_timeouts(connection, 1);
+    if (is_same_user(connection)) handle(connection);
+    close(connection);
+  }
+}
+
+void key_agent::handle(int connection)
+{
+  char request;
+  if (!read_all(connection, &request, 1)) return;
+
+  const char ok = 1, not_found = 0;
+  if (request == request_forget)
+  {
+    for (size_t i = 0; i < capacity; i++) forget(i);
+    write_all(connection, &ok, 1);
+    return;
+  }
+  if (request != request_find && request != request_store) return;
+
+  // The key is identified by the vault, the salt and the number of iterations
+  std::uint32_t path_length;
+  if (!read_all(connection, &path_length, 4)) return;
+  path_length = portable_to_internal(path_length);
+  if (path_length > max_path_length) return;
+
+  std::string vault(path_length, '\0');
+  std::uint8_t salt[cryptography::key::salt_size];
+  std::uint32_t iterations;
+  if (!read_all(connection, &vault[0], path_length) || !read_all(connection, salt, sizeof(salt)) || !read_all(connection, &iterations, 4)) return;
+  iterations = portable_to_internal(iterations);
+
+  expire();
+  size_t found = capacity;
+  for (size_t i = 0; i < capacity && found == capacity; i++)
+  {
+    if (slots[i].used && slots[i].iterations == iterations && vaults[i] == vault && std::equal(salt, salt + sizeof(salt), slots[i].salt)) found = i;
+  }
+
+  if (request == request_find)
+  {
+    if (found == capacity)
+    {
+      write_all(connection, &not_found, 1);
+      return;
+    }
+
+    std::uint8_t response[1 + cryptography::key::key_size];
+    response[0] = ok;
+    std::copy(slots[found].key_data, slots[found].key_data + cryptography::key::key_size, response + 1);
+    write_all(connection, response, sizeof(response));
+    data::detail::secure_memzero(response, sizeof(response));
+    return;
+  }
+
+  // The key is read before a slot is chosen, so a client that disconnects halfway leaves the stored keys as they are
+  std::uint8_t key_data[cryptography::key::key_size];
+  if (!read_all(connection, key_data, sizeof(key_data)))
+  {
+    data::detail::secure_memzero(key_data, sizeof(key_data));
+    return;
+  }
+
+  // A new key takes a free slot, or else the one that would be forgotten first
+  if (found == capacity)
+  {
+    found = 0;
+    for (size_t i = 0; i < capacity; i++)
+    {
+      if (!slots[i].used) { found = i; break; }
+      if (slots[i].expiry < slots[found].expiry) found = i;
+    }
+  }
+
+  slot& s = slots[found];
+  std::copy(key_data, key_data + sizeof(key_data), s.key_data);
+  data::detail::secure_memzero(key_data, sizeof(key_data));
+  s.used = true;
+  std::copy(salt, salt + sizeof(salt), s.salt);
+  s.iterations = iterations;
+  s.expiry = boost::chrono::steady_clock::now() + time_to_live;
+  vaults[found] = vault;
+
+  write_all(connection, &ok, 1);
+}
+
+std::string key_agent::get_socket_path()
+{
+  const char* configured = std::getenv("DEADLOCK_AGENT_SOCKET");
+  if (configured != nullptr && *configured != '\0') return configured;
+
+  // The runtime directory belongs to the user, and is removed when the user logs out
+  const char* runtime_directory = std::getenv("XDG_RUNTIME_DIR");
+  if (runtime_directory != nullptr && *runtime_directory != '\0') return std::string(runtime_directory) + "/deadlock-agent.sock";
+
+  return "/tmp/deadlock-agent-" + std::to_string(getuid()) + ".sock";
+}
+
+bool key_agent::find_key(const std::string& socket_path, const std::string& vault_filename,
+  const std::uint8_t* salt, std::uint32_t iterations, cryptography::key& key)
+{
+  const int connection = connect_to_agent(socket_path);
+  if (connection < 0) return false;
+
+  const data::secure_string request = make_request(request_find, vault_filename, salt, iterations);
+  std::uint8_t response[1 + cryptography::key::key_size];
+  const bool found = write_all(connection, request.data(), request.size()) && read_all(connection, response, 1)
+    && response[0] == 1 && read_all(connection, response + 1, cryptography::key::key_size);
+  close(connection);
+
+  if (found) key.restore_key(salt, iterations, response + 1);
+  data::detail::secure_memzero(response, sizeof(response));
+  return found;
+}
+
+bool key_agent::store_key(const std::string& socket_path, const std::string& vault_filename, const cryptography::key& key)
+{
+  const int connection = connect_to_agent(socket_path);
+  if (connection < 0) return false;
+
+  data::secure_string request = make_request(request_store, vault_filename, key.get_salt(), key.get_iterations());
+  request.append(reinterpret_cast<const char*>(key.get_key()), cryptography::key::key_size);
+
+  char response = 0;
+  const bool stored = write_all(connection, request.data(), request.size()) && read_all(connection, &response, 1) && response == 1;
+  close(connection);
+  return stored;
+}
+
+bool key_agent::forget_keys(const std::string& socket_path)
+{
+  const int connection = connect_to_agent(socket_path);
+  if (connection < 0) return false;
+
+  char response = 0;
+  const bool forgotten = write_all(connection, &request_forget, 1) && read_all(connection, &response, 1) && response == 1;
+  close(connection);
+  return forgotten;
+}
+
+#endif
@@ -0,0 +1,125 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef _DEADLOCK_CORE_KEY_AGENT_H_
+#define _DEADLOCK_CORE_KEY_AGENT_H_
+
+#include <atomic>
+#include <boost/chrono.hpp>
+#include <cstdint>
+#include <string>
+
+#include "cryptography/key.h"
+
+namespace deadlock
+{
+  namespace core
+  {
+    /// A process that keeps derived keys in locked memory for a while, like ssh-agent keeps private keys,
+    /// so that commands that open the same vault one after another derive its key only once.
+    /// The agent listens on a Unix socket that only its own user may use, and forgets a key when its time is up.
+    /// The static functions talk to an agent, and do nothing if none is running. There is no agent on Windows.
+    class key_agent
+    {
+    public:
+
+      /// The number of keys that the agent holds at most
+      static const size_t capacity = 64;
+
+    protected:
+
+      /// A key that the agent holds
+      struct slot
+      {
+        /// Whether the slot holds a key
+        bool used;
+
+        /// The salt that the key was derived from
+        std::uint8_t salt[cryptography::key::salt_size];
+
+        /// The number of iterations that the key was derived with
+        std::uint32_t iterations;
+
+        /// The key itself
+        std::uint8_t key_data[cryptography::key::key_size];
+
+        /// When the agent forgets the key
+        boost::chrono::steady_clock::time_point expiry;
+      };
+
+      /// The keys, in memory that is locked so it is never swapped to disk
+      slot slots[capacity];
+
+      /// The vault that every key belongs to; paths are not secret, so they need not be locked
+      std::string vaults[capacity];
+
+      /// The path of the socket
+      std::string socket_path;
+
+      /// The socket that clients connect to
+      int listener;
+
+      /// How long a key is kept after it was stored
+      boost::chrono::seconds time_to_live;
+
+      /// Answers the request of a client
+      void handle(int connection);
+
+      /// Forgets the keys whose time is up, and returns how long the agent may wait until the next one is
+      boost::chrono::milliseconds expire();
+
+      /// Zeroes a slot
+      void forget(size_t i);
+
+    public:
+
+      /// Locks the memory of the keys, and starts listening on the socket.
+      /// Throws if the memory cannot be locked, or if the socket cannot be created.
+      key_agent(const std::string& socket_path, std::uint32_t seconds_to_live);
+
+      /// Forgets all keys and removes the socket
+      ~key_agent();
+
+      /// The keys belong to one agent, so it cannot be copied
+      key_agent(const key_agent&) = delete;
+
+      /// The keys belong to one agent, so it cannot be copied
+      key_agent& operator=(const key_agent&) = delete;
+
+      /// Answers requests until stopped is set.
+      /// A signal interrupts waiting for the next request, so a signal handler can set stopped.
+      void run(const std::atomic<bool>& stopped);
+
+      /// Returns the path of the socket of the agent of this user: $DEADLOCK_AGENT_SOCKET if it is set,
+      /// otherwise deadlock-agent.sock in $XDG_RUNTIME_DIR, or deadlock-agent-<user id>.sock in /tmp
+      static std::string get_socket_path();
+
+      /// Asks the agent for the key that was derived from the salt with the given number of iterations for the vault.
+      /// If the agent has it, the key is restored from it, and true is returned.
+      static bool find_key(const std::string& socket_path, const std::string& vault_filename,
+        const std::uint8_t* salt, std::uint32_t iterations, cryptography::key& key);
+
+      /// Gives the key of the vault to the agent, and returns whether an agent took it
+      static bool store_key(const std::string& socket_path, const std::string& vault_filename, const cryptography::key& key);
+
+      /// Makes the agent forget all keys, and returns whether an agent was running
+      static bool forget_keys(const std::string& socket_path);
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,141 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mapped_file.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+  #include <fstream>
+#else
+  #include <cerrno>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+using namespace deadlock::core;
+
+#ifdef _WIN32
+
+mapped_file::mapped_file(const std::string& filename)
+{
+  mapping = nullptr;
+
+  // Read the whole file into the buffer
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.good())
+  {
+    throw std::runtime_error("Could not open file.");
+  }
+
+  file.seekg(0, std::ios::end);
+  buffer.resize(static_cast<size_t>(file.tellg()));
+  file.seekg(0, std::ios::beg);
+  file.read(buffer.data(), buffer.size());
+  if (!file.good() && !buffer.empty())
+  {
+    throw std::runtime_error("Could not read file.");
+  }
+
+  contents = buffer.data();
+  length = buffer.size();
+}
+
+mapped_file::~mapped_file()
+{
+
+}
+
+#else
+
+/// Reads the remainder of the open file into the buffer
+static void read_file(int file_descriptor, std::vector<char>& buffer)
+{
+  const size_t block_size = 64 * 1024;
+  size_t used = 0;
+
+  for (;;)
+  {
+    buffer.resize(used + block_size);
+    const ssize_t bytes_read = read(file_descriptor, buffer.data() + used, block_size);
+    if (bytes_read < 0 && errno == EINTR) continue;
+    if (bytes_read < 0)
+    {
+      throw std::runtime_error("Could not read file.");
+    }
+    if (bytes_read == 0) break;
+    used += static_cast<size_t>(bytes_read);
+  }
+
+  buffer.resize(used);
+}
+
+mapped_file::mapped_file(const std::string& filename)
+{
+  mapping = nullptr;
+  contents = nullptr;
+  length = 0;
+
+  const int file_descriptor = open(filename.c_str(), O_RDONLY);
+  if (file_descriptor < 0)
+  {
+    throw std::runtime_error("Could not open file.");
+  }
+
+  struct stat file_status;
+  if (fstat(file_descriptor, &file_status) == 0 && S_ISREG(file_status.st_mode) && file_status.st_size > 0)
+  {
+    void* file_mapping = mmap(nullptr, static_cast<size_t>(file_status.st_size), PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+    if (file_mapping != MAP_FAILED)
+    {
+      mapping = file_mapping;
+      contents = static_cast<const char*>(file_mapping);
+      length = static_cast<size_t>(file_status.st_size);
+
+      // The file is mostly read from front to back, so let the kernel read ahead aggressively
+      madvise(file_mapping, length, MADV_SEQUENTIAL);
+    }
+  }
+
+  // Files that cannot be mapped are read instead
+  if (mapping == nullptr)
+  {
+    try
+    {
+      read_file(file_descriptor, buffer);
+    }
+    catch (...)
+    {
+      close(file_descriptor);
+      throw;
+    }
+
+    contents = buffer.data();
+    length = buffer.size();
+  }
+
+  // The mapping stays valid after the file is closed
+  close(file_descriptor);
+}
+
+mapped_file::~mapped_file()
+{
+  if (mapping != nullptr) munmap(mapping, length);
+}
+
+#endif
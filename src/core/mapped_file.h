@@ -0,0 +1,69 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _DEADLOCK_CORE_MAPPED_FILE_H_
+#define _DEADLOCK_CORE_MAPPED_FILE_H_
+
+#include <string>
+#include <vector>
+
+namespace deadlock
+{
+  namespace core
+  {
+    /// The contents of a file as one contiguous span of memory, for reading.
+    /// Where possible, the file is mapped into memory, so reading it involves no copies.
+    /// Otherwise (for example for pipes, or on Windows), the file is read into a buffer.
+    class mapped_file
+    {
+    protected:
+
+      /// The first byte of the file
+      const char* contents;
+
+      /// The number of bytes in the file
+      size_t length;
+
+      /// The mapping of the file, or nullptr if the file was read into the buffer
+      void* mapping;
+
+      /// Holds the contents if the file could not be mapped
+      std::vector<char> buffer;
+
+    public:
+
+      /// Maps the file into memory, or reads it if it cannot be mapped
+      explicit mapped_file(const std::string& filename);
+
+      /// Unmaps the file
+      ~mapped_file();
+
+      /// The mapping belongs to one object, so a mapped file cannot be copied
+      mapped_file(const mapped_file&) = delete;
+
+      /// The mapping belongs to one object, so a mapped file cannot be copied
+      mapped_file& operator=(const mapped_file&) = delete;
+
+      /// Returns the first byte of the file
+      inline const char* data() const { return contents; }
+
+      /// Returns the number of bytes in the file
+      inline size_t size() const { return length; }
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,58 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "memory_stream.h"
+
+using namespace deadlock::core;
+using namespace deadlock::core::detail;
+
+memory_streambuffer::memory_streambuffer(const char* begin, const char* end)
+{
+  // The get area is never written to, but the streambuffer interface does not know about const
+  setg(const_cast<char*>(begin), const_cast<char*>(begin), const_cast<char*>(end));
+}
+
+memory_streambuffer::pos_type memory_streambuffer::seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which)
+{
+  if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+
+  off_type base = 0;
+  if (direction == std::ios_base::cur) base = gptr() - eback();
+  else if (direction == std::ios_base::end) base = egptr() - eback();
+
+  return seekpos(pos_type(base + offset), which);
+}
+
+memory_streambuffer::pos_type memory_streambuffer::seekpos(pos_type position, std::ios_base::openmode which)
+{
+  const off_type offset = position;
+  if (!(which & std::ios_base::in) || offset < 0 || offset > egptr() - eback()) return pos_type(off_type(-1));
+
+  setg(eback(), eback() + offset, egptr());
+  return position;
+}
+
+memory_stream::memory_stream(const char* begin, const char* end)
+  : basic_istream<char>(nullptr), streambuffer(begin, end)
+{
+  // The base is constructed before the streambuffer, so it can only be given the streambuffer now
+  rdbuf(&streambuffer);
+}
+
+memory_stream::~memory_stream()
+{
+
+}
@@ -0,0 +1,77 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _DEADLOCK_CORE_MEMORY_STREAM_H_
+#define _DEADLOCK_CORE_MEMORY_STREAM_H_
+
+#include <istream>
+#include <streambuf>
+
+namespace deadlock
+{
+  namespace core
+  {
+    namespace detail
+    {
+      /// A streambuffer that reads directly from a span of memory, without copying it into a buffer first
+      class memory_streambuffer : public std::basic_streambuf<char>
+      {
+      public:
+
+        /// Creates a streambuffer that reads the bytes from begin up to end.
+        /// The memory must outlive the streambuffer.
+        memory_streambuffer(const char* begin, const char* end);
+
+        /// Returns the next byte that will be read
+        inline const char* current() const { return gptr(); }
+
+        /// Returns the number of bytes that have not been read yet
+        inline size_t remaining() const { return static_cast<size_t>(egptr() - gptr()); }
+
+        /// Skips the given number of bytes, which must not be more than remain
+        inline void skip(size_t count) { setg(eback(), gptr() + count, egptr()); }
+
+      protected:
+
+        /// Moves the read position relative to the start, the current position, or the end
+        virtual pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which = std::ios_base::in);
+
+        /// Moves the read position to an absolute position
+        virtual pos_type seekpos(pos_type position, std::ios_base::openmode which = std::ios_base::in);
+      };
+    }
+
+    /// A stream that reads from a span of memory.
+    /// Code that knows about the memory can access it directly through the streambuffer.
+    class memory_stream : public std::basic_istream<char>
+    {
+    protected:
+
+      /// The streambuffer that reads the memory
+      detail::memory_streambuffer streambuffer;
+
+    public:
+
+      /// Creates a stream that reads the bytes from begin up to end.
+      /// The memory must outlive the stream.
+      memory_stream(const char* begin, const char* end);
+
+      ~memory_stream();
+    };
+  }
+}
+
+#endif
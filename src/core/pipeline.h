@@ -0,0 +1,152 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef _DEADLOCK_CORE_PIPELINE_H_
+#define _DEADLOCK_CORE_PIPELINE_H_
+
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bounded_queue.h"
+
+namespace deadlock
+{
+  namespace core
+  {
+    namespace detail
+    {
+      /// Owns the threads of the stages of a pipeline. Destroying a thread that was not joined terminates the program,
+      /// so when the pipeline is left early, for instance because starting a later thread threw,
+      /// the queues are closed, which makes the running stages stop, and the threads are joined.
+      template <typename T> class pipeline_threads
+      {
+      protected:
+
+        /// The queues between the stages
+        bounded_queue<T>& inputs;
+        bounded_queue<T>& outputs;
+
+        /// The threads that were started
+        std::vector<std::thread> threads;
+
+      public:
+
+        /// Creates an owner that closes the given queues when it goes out of scope
+        pipeline_threads(bounded_queue<T>& inputs, bounded_queue<T>& outputs) : inputs(inputs), outputs(outputs)
+        {
+          threads.reserve(2);
+        }
+
+        /// Runs the function on a new thread
+        template <typename Function> void start(Function function)
+        {
+          threads.push_back(std::thread(function));
+        }
+
+        /// Waits for all started threads to finish
+        void join()
+        {
+          for (auto t = threads.begin(); t != threads.end(); t++)
+          {
+            if (t->joinable()) t->join();
+          }
+        }
+
+        /// Stops and joins the threads that are still running
+        ~pipeline_threads()
+        {
+          inputs.close();
+          outputs.close();
+          join();
+        }
+      };
+    }
+
+    /// Runs a source, a transform and a sink side by side, and hands the items between them through bounded queues,
+    /// so an item is transformed while the next one is produced and the previous one is consumed.
+    /// The source runs on a new thread, and is called with a function that pushes an item and returns false once
+    /// the pipeline stops, after which the source should return. The transform runs on another new thread,
+    /// and turns every item into an output item. The sink runs on the calling thread, and consumes the outputs in order.
+    /// The first exception of any stage, in the order of the stages, is rethrown once all threads have finished.
+    template <typename T, typename Source, typename Transform, typename Sink>
+    void run_pipeline(size_t queue_capacity, Source source, Transform transform, Sink sink)
+    {
+      bounded_queue<T> inputs(queue_capacity);
+      bounded_queue<T> outputs(queue_capacity);
+      std::exception_ptr errors[3];
+      detail::pipeline_threads<T> threads(inputs, outputs);
+
+      // When a stage stops, for whatever reason, it closes the queues next to it,
+      // so the other stages stop waiting for it, and finish or fail in turn.
+      threads.start([&]
+      {
+        try
+        {
+          source([&](T&& item) { return inputs.push(std::move(item)); });
+        }
+        catch (...)
+        {
+          errors[0] = std::current_exception();
+        }
+        inputs.close();
+      });
+
+      threads.start([&]
+      {
+        try
+        {
+          T input;
+          while (inputs.pop(input))
+          {
+            T output;
+            transform(input, output);
+            if (!outputs.push(std::move(output))) break;
+          }
+        }
+        catch (...)
+        {
+          errors[1] = std::current_exception();
+        }
+        inputs.close();
+        outputs.close();
+      });
+
+      try
+      {
+        T output;
+        while (outputs.pop(output)) sink(output);
+      }
+      catch (...)
+      {
+        errors[2] = std::current_exception();
+      }
+      outputs.close();
+
+      threads.join();
+
+      for (size_t i = 0; i < 3; i++)
+      {
+        if (errors[i]) std::rethrow_exception(errors[i]);
+      }
+    }
+  }
+}
+
+#endif
@@ -15,109 +15,349 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "search.h"
+#include "data/edit_distance.h"
 
 #include <cctype>
 
+// The word comparison uses the widest vector instructions the compiler targets
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DEADLOCK_SEARCH_AVX2
+#define DEADLOCK_SEARCH_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DEADLOCK_SEARCH_SSE2
+#endif
+
 using namespace deadlock::core;
 
 search::search()
 {
-  
+  // The number of threads is not always known
+  number_of_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  parallel_threshold = 4096;
+}
+
+/// Calls f with the position of every entry in the collection that can match the query, in ascending order
+template <typename Function>
+static void for_each_candidate(const data::normalised_id& query, const data::entry_collection& entries, Function f)
+{
+  // Without words in the query the index is of no use, so consider every entry
+  if (!data::word_index::can_answer(query))
+  {
+    const data::id_column::position_type size = static_cast<data::id_column::position_type>(entries.size());
+    for (data::id_column::position_type i = 0; i < size; i++) f(i);
+    return;
+  }
+
+  // Only entries with a word that is a prefix or suffix of a query word (or the other way around),
+  // or with an acronym that starts with the query, can match.
+  // The candidates are in ascending order, so they are considered in the same order as for a full scan.
+  data::word_index::posting_list candidates;
+  entries.get_index().find_candidates(query, candidates);
+
+  for (auto i = candidates.begin(); i != candidates.end(); i++) f(*i);
 }
 
-data::secure_string_ptr search::make_acronym(const data::secure_string& words) const
+std::priority_queue<detail::entry_match> search::find_matches(const data::secure_string& query, const data::entry_collection& entries) const
 {
-  // Start with an empty string
-  data::secure_string_ptr acronym = data::make_secure_string();
+  std::priority_queue<detail::entry_match> matches;
+
+  // The identifiers in the collection are normalised already, only the query needs to be
+  const data::normalised_string query_normalised(query);
+  const data::normalised_id query_view = query_normalised.view();
+  const data::id_column& ids = entries.get_ids();
 
-  bool inside_word = false;
-  // Loop through the characters
-  for (auto i = words.begin(); i != words.end(); i++)
+  for_each_candidate(query_view, entries, [&](data::id_column::position_type position)
   {
-    // TODO: what about UTF-8 etc?
-    bool alnum = std::isalnum(*i) != 0;
+    const data::entry_ptr& entr = entries.at(position);
+    int probability = match_entry(query, query_view, *entr, ids[position]);
 
-    // At the start of a word, append the character to the acronym.
-    if (alnum && !inside_word)
+    if (probability > 0)
     {
-      data::combine_secure_string(acronym, *i);
-    }
+      detail::entry_match match;
+      match.entry = entr;
+      match.probability = probability;
+      match.sequence = position;
 
-    inside_word = alnum;
-  }
+      matches.push(match);
+    }
+  });
 
-  return acronym;
+  return matches;
 }
 
-int search::cross_match_words(const data::secure_string_vector& needles, const data::secure_string_vector& haystacks) const
+top_k<data::id_column::position_type> search::find_best_candidates(const data::secure_string& query, const data::entry_collection& entries, size_t k) const
 {
-  int sum = 0;
+  typedef data::id_column::position_type position_type;
+
+  const data::normalised_string query_normalised(query);
+  const data::normalised_id query_view = query_normalised.view();
+  const data::id_column& ids = entries.get_ids();
+  const int word_bound = get_word_bound(query_view);
 
-  for (auto i = needles.begin(); i != needles.end(); i++)
+  // Without words in the query the index is of no use, so consider every entry.
+  // Otherwise, consider only the candidates from the index, which are in ascending order.
+  const bool use_index = data::word_index::can_answer(query_view);
+  data::word_index::posting_list candidates;
+  if (use_index) entries.get_index().find_candidates(query_view, candidates);
+  const size_t size = use_index ? candidates.size() : entries.size();
+
+  auto select_range = [&](size_t first, size_t last) -> top_k<position_type>
   {
-    for (auto j = haystacks.begin(); j != haystacks.end(); j++)
+    top_k<position_type> best(std::min(k, last - first));
+
+    for (size_t i = first; i < last; i++)
     {
-      sum += match_words(*i, *j);
+      const position_type position = use_index ? candidates[i] : static_cast<position_type>(i);
+      const data::normalised_id id = ids[position];
+
+      // Once the selection is full, skip entries that cannot beat the worst match in it
+      if (!best.admits(get_upper_bound(query_view, word_bound, id))) continue;
+
+      int probability = match_entry(query, query_view, *entries.at(position), id);
+      if (probability > 0) best.push(position, probability, position);
     }
-  }
 
-  return sum;
+    return best;
+  };
+
+  return select_best<position_type>(size, k, select_range);
 }
 
-int search::match_words(const data::secure_string& needle, const data::secure_string& haystack) const
+data::entry_ptr search::find_match(const data::secure_string& query, const data::entry_collection& entries) const
 {
-  int match = 0;
+  top_k<data::id_column::position_type> best = find_best_candidates(query, entries, 1);
+
+  return best.empty() ? nullptr : entries.at(best.sort().front().reference);
+}
 
-  // Loop over the minimum subset of the string beginnings, and check whether they are equal.
-  size_t min_length = std::min(needle.length(), haystack.length());
-  size_t max_length = std::max(needle.length(), haystack.length());
-  
-  int front_bonus = 0;
+top_k<data::id_column::position_type> search::find_field_candidates(const data::secure_string& query, const data::entry_collection& entries,
+  const field_weights& weights, size_t k) const
+{
+  typedef data::id_column::position_type position_type;
 
-  // Loop through the characters
-  for (int i = 0; i < min_length; i++)
+  const data::normalised_string query_normalised(query);
+  const data::normalised_id query_view = query_normalised.view();
+
+  // Every field has its own index, so the candidates are those of every field that counts
+  data::word_index::posting_list candidates;
+  if (data::word_index::can_answer(query_view))
   {
-    // Increase the match probability for every character that is equal
-    if (needle[i] == haystack[i])
+    data::word_index::posting_list field_candidates;
+    if (weights.id != 0)
+    {
+      entries.get_index().find_candidates(query_view, field_candidates);
+      candidates.insert(candidates.end(), field_candidates.begin(), field_candidates.end());
+    }
+    if (weights.username != 0)
     {
-      front_bonus++;
+      entries.get_usernames().get_index().find_word_candidates(query_view, field_candidates);
+      candidates.insert(candidates.end(), field_candidates.begin(), field_candidates.end());
     }
-    else
+    if (weights.additional_data != 0)
     {
-      front_bonus = 0;
-      break;
+      entries.get_additional_data().get_index().find_word_candidates(query_view, field_candidates);
+      candidates.insert(candidates.end(), field_candidates.begin(), field_candidates.end());
     }
+
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+  }
+  else
+  {
+    // Without words in the query the indices are of no use, so consider every entry
+    candidates.resize(entries.size());
+    for (size_t i = 0; i < candidates.size(); i++) candidates[i] = static_cast<position_type>(i);
+  }
+
+  const data::id_column& ids = entries.get_ids();
+  const data::id_column& usernames = entries.get_usernames().get_column();
+  const data::id_column& additional_data = entries.get_additional_data().get_column();
+  top_k<position_type> best(std::min(k, candidates.size()));
+
+  for (auto c = candidates.begin(); c != candidates.end(); c++)
+  {
+    const data::entry& entr = *entries.at(*c);
+    int probability = 0;
+
+    if (weights.id != 0)
+      probability += weights.id * match_entry(query, query_view, entr, ids[*c]);
+    if (weights.username != 0)
+      probability += weights.username * match_field(query, query_view, entr.get_username(), usernames[*c]);
+    if (weights.additional_data != 0)
+      probability += weights.additional_data * match_field(query, query_view, entr.get_additional_data(), additional_data[*c]);
+
+    if (probability > 0) best.push(*c, probability, *c);
   }
 
-  match += front_bonus;
+  return best;
+}
+
+data::entry_ptr search::find_match(const data::secure_string& query, const data::entry_collection& entries, const field_weights& weights) const
+{
+  top_k<data::id_column::position_type> best = find_field_candidates(query, entries, weights, 1);
+
+  return best.empty() ? nullptr : entries.at(best.sort().front().reference);
+}
+
+top_k<data::id_column::position_type> search::find_fuzzy_candidates(const data::secure_string& query, const data::entry_collection& entries,
+  size_t max_distance, size_t k) const
+{
+  typedef data::id_column::position_type position_type;
+
+  const data::normalised_string query_normalised(query);
+  const data::normalised_id query_view = query_normalised.view();
+
+  // Without words there is nothing to misspell
+  if (!data::word_index::can_answer(query_view)) return find_best_candidates(query, entries, k);
+
+  // The index finds the entries with a word within the edit distance of a query word
+  data::word_index::posting_list candidates;
+  entries.get_index().find_similar_candidates(query_view, max_distance, candidates);
+
+  const data::id_column& ids = entries.get_ids();
+  std::vector<size_t> row;
+  top_k<position_type> best(std::min(k, candidates.size()));
+
+  for (auto c = candidates.begin(); c != candidates.end(); c++)
+  {
+    const data::normalised_id id = ids[*c];
+    int probability = match_exact(query, query_view, entries.at(*c)->get_id(), id) + match_acronym(query_view, id);
+
+    for (size_t i = 0; i < query_view.number_of_words; i++)
+    {
+      for (size_t j = 0; j < id.number_of_words; j++)
+      {
+        probability += match_words_fuzzy(query_view.word(i), query_view.words[i].length,
+                                         id.word(j), id.words[j].length, max_distance, row);
+      }
+    }
+
+    if (probability > 0) best.push(*c, probability, *c);
+  }
+
+  return best;
+}
+
+data::entry_ptr search::find_fuzzy_match(const data::secure_string& query, const data::entry_collection& entries, size_t max_distance) const
+{
+  top_k<data::id_column::position_type> best = find_fuzzy_candidates(query, entries, max_distance, 1);
+
+  return best.empty() ? nullptr : entries.at(best.sort().front().reference);
+}
+
+int search::get_word_bound(const data::normalised_id& query_normalised) const
+{
+  int bound = 0;
+
+  // Two equal words score their length plus 15. Otherwise a word scores at most its length
+  // for a common beginning, and at most its length again for a common ending.
+  for (size_t i = 0; i < query_normalised.number_of_words; i++)
+  {
+    const int length = static_cast<int>(query_normalised.words[i].length);
+    bound += length + std::max(length, 15);
+  }
+
+  // An identifier with an acronym has at least one word, so the acronym bonus can be included here
+  if (data::word_index::can_match_acronym(query_normalised))
+  {
+    bound += 5 * static_cast<int>(query_normalised.words[0].length) + 10;
+  }
+
+  return bound;
+}
+
+int search::cross_match_words(const data::normalised_id& needles, const data::normalised_id& haystacks) const
+{
+  int sum = 0;
+
+  for (size_t i = 0; i < needles.number_of_words; i++)
+  {
+    sum += match_word(needles.word(i), needles.words[i].length, haystacks);
+  }
+
+  return sum;
+}
+
+/// Returns whether the first length bytes of a and b are equal.
+/// Where available, compares a block of bytes at a time with SIMD instructions.
+/// It never reads beyond the given length, so it is safe at the end of a buffer.
+static inline bool equal_bytes(const char* a, const char* b, size_t length)
+{
+  size_t i = 0;
+
+#ifdef DEADLOCK_SEARCH_AVX2
+  for (; i + 32 <= length; i += 32)
+  {
+    const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) != -1) return false;
+  }
+#endif
+
+#ifdef DEADLOCK_SEARCH_SSE2
+  for (; i + 16 <= length; i += 16)
+  {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff) return false;
+  }
+#endif
+
+  // The remaining bytes, or all bytes without SIMD support
+  for (; i < length; i++)
+  {
+    if (a[i] != b[i]) return false;
+  }
+
+  return true;
+}
+
+int search::match_words(const char* needle, size_t needle_length, const char* haystack, size_t haystack_length) const
+{
+  int match = 0;
+
+  // The beginnings only count if one word starts with the other,
+  // and then every character of the shorter word adds to the match probability.
+  const size_t min_length = std::min(needle_length, haystack_length);
+  const bool front_equal = equal_bytes(needle, haystack, min_length);
+
+  if (front_equal) match += static_cast<int>(min_length);
 
   // If the words are exactly equal, add an additional bonus
-  if (needle.length() == haystack.length() && front_bonus == min_length)
+  if (needle_length == haystack_length && front_equal)
   {
     match += 15;
   }
   else
   {
-    // Now check backwards whether one string ends with the other
-    if (needle.length() <= haystack.length())
+    // Now check backwards whether the haystack ends with the needle
+    if (needle_length <= haystack_length)
     {
-      int end_bonus = 0;
-      for (int i = 0; i < min_length; i++)
+      if (equal_bytes(needle, haystack + haystack_length - needle_length, needle_length))
       {
-        if (haystack[max_length - 1 - i] == needle[min_length - 1 - i])
-        {
-          end_bonus++;
-        }
-        else
-        {
-          end_bonus = 0;
-          break;
-        }
+        match += static_cast<int>(needle_length);
       }
-
-      match += end_bonus;
     }
   }
 
   return match;
-}
\ No newline at end of file
+}
+
+int search::match_words_fuzzy(const char* needle, size_t needle_length, const char* haystack, size_t haystack_length,
+  size_t max_distance, std::vector<size_t>& row) const
+{
+  const int match = match_words(needle, needle_length, haystack, haystack_length);
+  if (match > 0 || max_distance == 0) return match;
+
+  // Every character that one word has more than the other is a typo
+  const size_t min_length = std::min(needle_length, haystack_length);
+  const size_t max_length = std::max(needle_length, haystack_length);
+  if (max_length - min_length > max_distance) return 0;
+
+  const size_t distance = data::edit_distance(needle, needle_length, haystack, haystack_length, row);
+  if (distance > max_distance) return 0;
+
+  return std::max(1, static_cast<int>(min_length) - 2 * static_cast<int>(distance));
+}
@@ -21,9 +21,14 @@
 #include <vector>
 #include <algorithm>
 #include <iterator>
+#include <thread>
+#include <exception>
 
 #include "data/secure_string.h"
 #include "data/entry.h"
+#include "data/entry_collection.h"
+#include "data/id_column.h"
+#include "top_k.h"
 
 namespace deadlock
 {
@@ -36,73 +41,150 @@ namespace deadlock
       {
         data::entry_ptr entry;
         int probability;
+        size_t sequence;
       };
 
-      // By defining this operator, std::less works, and this allows the priority queue to work
+      // By defining this operator, std::less works, and this allows the priority queue to work.
+      // Of two equally probable matches, the one that was found first ranks higher.
       inline bool operator<(const entry_match& m1, const entry_match& m2)
       {
-        return m1.probability < m2.probability;
+        return m1.probability < m2.probability || (m1.probability == m2.probability && m1.sequence > m2.sequence);
       }
     }
 
+    /// How much every field of an entry counts when searching more fields than the identifier.
+    /// A weight of zero leaves the field out.
+    struct field_weights
+    {
+      int id;
+      int username;
+      int additional_data;
+
+      /// The identifier counts most, then the username, then the additional data
+      field_weights() : id(4), username(2), additional_data(1) {}
+
+      field_weights(int id, int username, int additional_data) : id(id), username(username), additional_data(additional_data) {}
+    };
+
     /// Contains the search logic that intelligently
     /// identifies entries based on a search string
     class search
     {
+      friend class search_session;
+
       protected:
 
-        /// Returns a one-word string that is the acronym of the words provided
-        data::secure_string_ptr make_acronym(const data::secure_string& words) const;
+        /// Returns how similar the two words are
+        int match_words(const char* needle, size_t needle_length, const char* haystack, size_t haystack_length) const;
 
-        /// Returns the lowercase version of the string
-        inline data::secure_string_ptr tolower(const data::secure_string& str) const
+        /// Returns how similar the two strings are
+        inline int match_words(const data::secure_string& needle, const data::secure_string& haystack) const
         {
-          data::secure_string_ptr lower = data::make_secure_string(str);
-          // Transform every character to lowercase
-          // TODO: UTF-8 tolower, and what about the locale?
-          // Is there a better way to do this?
-          std::for_each(lower->begin(), lower->end(), [](char& c) { c = std::tolower(c, std::locale()); });
-
-          return lower;
+          return match_words(needle.data(), needle.size(), haystack.data(), haystack.size());
         }
 
-        /// Splits a string into words on whitespace or periods.
-        inline data::secure_string_vector get_words(const data::secure_string& str) const
+        /// Checks the word against every word of the identifier, and accumulates the matches
+        inline int match_word(const char* needle, size_t needle_length, const data::normalised_id& haystacks) const
         {
-          data::secure_string_vector words;
+          int sum = 0;
 
-          const auto end = str.cend();
-          auto from = str.cbegin();
-          auto to = from;
-
-          while (to != end)
+          for (size_t j = 0; j < haystacks.number_of_words; j++)
           {
-            const char ch = *to;
-            if (std::isspace(ch) || ch == '.')
-            {
-              if (from < to)
-              {
-                words.push_back(data::secure_string(from, to));
-              }
-              from = to + 1;
-            }
-
-            to++;
+            sum += match_words(needle, needle_length, haystacks.word(j), haystacks.words[j].length);
           }
 
-          if (from < to)
+          return sum;
+        }
+
+        /// Checks every word against every other word, and accumulates the matches
+        int cross_match_words(const data::normalised_id& needles, const data::normalised_id& haystacks) const;
+
+        /// Returns how similar the two words are, allowing up to max_distance typos.
+        /// Words that match without typos score as usual; otherwise a word with typos scores
+        /// the length of the shorter word minus two points per typo, but at least one point.
+        /// The row is used as scratch memory for the edit distance.
+        int match_words_fuzzy(const char* needle, size_t needle_length, const char* haystack, size_t haystack_length,
+          size_t max_distance, std::vector<size_t>& row) const;
+
+        /// Returns the probability that the entry is the one the user meant, based on a field as a whole.
+        /// The field must be given as-is and normalised.
+        inline int match_exact(const data::secure_string& query, const data::normalised_id& query_normalised,
+          const data::secure_string& field, const data::normalised_id& id) const
+        {
+          int probability = 0;
+
+          // If the match is perfect, set a high probability
+          if (id.id_length == query_normalised.id_length &&
+              std::equal(id.id, id.id + id.id_length, query_normalised.id))
           {
-            words.push_back(data::secure_string(from, to));
+            probability += 50;
+
+            // If the match is case-sensistive, the probability is even higher
+            if (field == query) probability += 50;
           }
 
-          return words;
+          return probability;
         }
 
-        /// Returns how similar the two strings are
-        int match_words(const data::secure_string& needle, const data::secure_string& haystack) const;
+        /// Returns the probability that the entry is the one the user meant, based on its acronym.
+        /// A query of one word scores when the acronym starts with it, so 'gh' finds 'GitHub Enterprise'.
+        inline int match_acronym(const data::normalised_id& query_normalised, const data::normalised_id& id) const
+        {
+          if (!data::word_index::can_match_acronym(query_normalised)) return 0;
 
-        /// Checks every word against every other word, and accumulates the matches
-        int cross_match_words(const data::secure_string_vector& needles, const data::secure_string_vector& haystacks) const;
+          const char* word = query_normalised.word(0);
+          const size_t length = query_normalised.words[0].length;
+          if (length > id.acronym_length || !std::equal(word, word + length, id.acronym)) return 0;
+
+          // Every character counts, and matching the entire acronym counts extra
+          return 5 * static_cast<int>(length) + (length == id.acronym_length ? 10 : 0);
+        }
+
+        /// Returns the probability that the entry is the one the user meant.
+        /// The query must be given as-is and normalised, and id must be the normalised identifier of the entry.
+        int match_entry(const data::secure_string& query, const data::normalised_id& query_normalised,
+          const data::entry& entr, const data::normalised_id& id) const
+        {
+          // Start with the probability based on the identifier as a whole
+          int probability = match_exact(query, query_normalised, entr.get_id(), id);
+
+          // Cross check the words
+          probability += cross_match_words(query_normalised, id);
+
+          // And check whether the query is an abbreviation
+          probability += match_acronym(query_normalised, id);
+
+          return probability;
+        }
+
+        /// Considers the entries in the collection that can match the query with up to max_distance typos per word,
+        /// and keeps only the k best matches, referred to by position.
+        top_k<data::id_column::position_type> find_fuzzy_candidates(const data::secure_string& query, const data::entry_collection& entries,
+          size_t max_distance, size_t k) const;
+
+        /// Returns the probability that a field other than the identifier matches the query
+        inline int match_field(const data::secure_string& query, const data::normalised_id& query_normalised,
+          const data::secure_string& field, const data::normalised_id& field_normalised) const
+        {
+          return match_exact(query, query_normalised, field, field_normalised) + cross_match_words(query_normalised, field_normalised);
+        }
+
+        /// Considers the entries in the collection that can match the query in any field with a weight,
+        /// and keeps only the k best matches, referred to by position.
+        top_k<data::id_column::position_type> find_field_candidates(const data::secure_string& query, const data::entry_collection& entries,
+          const field_weights& weights, size_t k) const;
+
+        /// Returns the most that every word of an identifier can add to the probability of an entry,
+        /// given the normalised query. This is used to skip entries that cannot make it into a top-k selection.
+        int get_word_bound(const data::normalised_id& query_normalised) const;
+
+        /// Returns a number the probability of the entry cannot exceed. It is computed from lengths only,
+        /// and it is much cheaper than match_entry. The word bound must be computed by get_word_bound.
+        inline int get_upper_bound(const data::normalised_id& query_normalised, int word_bound, const data::normalised_id& id) const
+        {
+          const int exact_bonus = id.id_length == query_normalised.id_length ? 100 : 0;
+          return exact_bonus + static_cast<int>(id.number_of_words) * word_bound;
+        }
 
         /// Considers all entries and, given the search string, puts all matches in a priority queue.
         template <typename IndirectIterator> std::priority_queue<detail::entry_match>
@@ -110,35 +192,18 @@ namespace deadlock
         {
           std::priority_queue<detail::entry_match> matches;
 
-          // First of all, make the search string lowercase
-          data::secure_string_ptr query_lower = tolower(query);
+          // First of all, make the search string lowercase and split it into words
+          const data::normalised_string query_normalised(query);
 
-          // Split the query into words
-          data::secure_string_vector query_words = get_words(*query_lower);
+          // The identifiers are normalised into the same buffer every time, to avoid allocations
+          data::normalised_string id;
 
           // Now search through the entries
-          for (IndirectIterator i = begin; i != end; i++)
+          size_t sequence = 0;
+          for (IndirectIterator i = begin; i != end; i++, sequence++)
           {
-            // Start with 0 probability that this is the entry the user meant.
-            int probability = 0;
-
-            // Make the identifier lowercase as well
-            data::secure_string_ptr id_lower = tolower(i->get_id());
-
-            // And split it into words too
-            data::secure_string_vector id_words = get_words(*id_lower);
-
-            // If the match is perfect, set a high probability
-            if (*id_lower == *query_lower)
-            {
-              probability += 50;
-
-              // If the match is case-sensistive, the probability is even higher
-              if (i->get_id() == query) probability += 50;
-            }
-
-            // Cross check the words
-            probability += cross_match_words(query_words, id_words);
+            id.assign(i->get_id());
+            int probability = match_entry(query, query_normalised.view(), *i, id.view());
 
             // If a match was found, add it to the queue
             if (probability > 0)
@@ -146,6 +211,7 @@ namespace deadlock
               detail::entry_match match;
               match.entry = (*i.base());
               match.probability = probability;
+              match.sequence = sequence;
 
               matches.push(match);
             }
@@ -154,16 +220,141 @@ namespace deadlock
           return matches;
         }
 
+        /// Returns the number of threads to search a range of the given size with
+        inline size_t get_number_of_workers(size_t size) const
+        {
+          if (size < parallel_threshold) return 1;
+          return std::max<size_t>(1, std::min(number_of_threads, size));
+        }
+
+        /// Splits the range [0, size) into parts, selects the best candidates of every part on a separate thread,
+        /// and merges the selections. Function is called as select_range(first, last) and must return
+        /// the best candidates of the part, with sequence numbers that increase along the whole range,
+        /// so the merged result is the same as that of selecting from the whole range at once.
+        template <typename Reference, typename Function>
+        top_k<Reference> select_best(size_t size, size_t k, Function select_range) const
+        {
+          const size_t number_of_workers = get_number_of_workers(size);
+          if (number_of_workers == 1) return select_range(0, size);
+
+          const size_t part_size = (size + number_of_workers - 1) / number_of_workers;
+          std::vector<top_k<Reference>> parts(number_of_workers, top_k<Reference>(0));
+          std::vector<std::exception_ptr> errors(number_of_workers);
+          std::vector<std::thread> workers;
+          workers.reserve(number_of_workers - 1);
+
+          auto work = [&](size_t part)
+          {
+            try
+            {
+              const size_t first = std::min(size, part * part_size);
+              const size_t last = std::min(size, first + part_size);
+              parts[part] = select_range(first, last);
+            }
+            catch (...)
+            {
+              errors[part] = std::current_exception();
+            }
+          };
+
+          // The calling thread takes the first part itself
+          for (size_t part = 1; part < number_of_workers; part++) workers.push_back(std::thread(work, part));
+          work(0);
+          for (auto w = workers.begin(); w != workers.end(); w++) w->join();
+
+          for (auto e = errors.begin(); e != errors.end(); e++)
+          {
+            if (*e) std::rethrow_exception(*e);
+          }
+
+          top_k<Reference> best(std::min(k, size));
+          for (auto p = parts.begin(); p != parts.end(); p++) best.merge(*p);
+
+          return best;
+        }
+
+        /// Considers all entries and keeps only the k best matches.
+        /// The matches refer to the entries by iterator, so rejected entries are never copied.
+        /// Large ranges are split over several threads.
+        template <typename IndirectIterator> top_k<IndirectIterator>
+        find_best_candidates(const data::secure_string& query, IndirectIterator begin, IndirectIterator end, size_t k) const
+        {
+          const data::normalised_string query_normalised(query);
+          const data::normalised_id query_view = query_normalised.view();
+          const int word_bound = get_word_bound(query_view);
+
+          auto select_range = [&](size_t first, size_t last) -> top_k<IndirectIterator>
+          {
+            top_k<IndirectIterator> best(std::min(k, last - first));
+
+            // The identifiers are normalised into the same buffer every time, to avoid allocations
+            data::normalised_string id;
+
+            IndirectIterator i = begin;
+            std::advance(i, first);
+            for (size_t sequence = first; sequence < last; sequence++, i++)
+            {
+              id.assign(i->get_id());
+              const data::normalised_id id_view = id.view();
+
+              // Once the selection is full, skip entries that cannot beat the worst match in it
+              if (!best.admits(get_upper_bound(query_view, word_bound, id_view))) continue;
+
+              int probability = match_entry(query, query_view, *i, id_view);
+              if (probability > 0) best.push(i, probability, sequence);
+            }
+
+            return best;
+          };
+
+          return select_best<IndirectIterator>(static_cast<size_t>(std::distance(begin, end)), k, select_range);
+        }
+
+        /// Considers the entries in the collection that the index reports as possible matches,
+        /// and keeps only the k best matches, referred to by position.
+        top_k<data::id_column::position_type> find_best_candidates(const data::secure_string& query, const data::entry_collection& entries, size_t k) const;
+
+        /// Considers the entries in the collection that the index reports as possible matches,
+        /// and puts all matches in a priority queue.
+        std::priority_queue<detail::entry_match> find_matches(const data::secure_string& query, const data::entry_collection& entries) const;
+
+        /// The maximum number of threads used to search
+        size_t number_of_threads;
+
+        /// The number of entries from which on a search is split over several threads
+        size_t parallel_threshold;
+
       public:
 
-        /// Creates a new search algorithm
+        /// Creates a new search algorithm, which uses one thread per core for large searches
         search();
 
+        /// Returns the maximum number of threads used to search
+        inline size_t get_number_of_threads() const { return number_of_threads; }
+
+        /// Sets the maximum number of threads used to search. With one thread, all searches run on the calling thread.
+        inline void set_number_of_threads(size_t threads) { number_of_threads = std::max<size_t>(1, threads); }
+
+        /// Returns the number of entries from which on a search is split over several threads
+        inline size_t get_parallel_threshold() const { return parallel_threshold; }
+
+        /// Sets the number of entries from which on a search is split over several threads.
+        /// Below this number, starting threads takes longer than searching.
+        inline void set_parallel_threshold(size_t threshold) { parallel_threshold = threshold; }
+
         /// Scans through the entries defined by begin and end,
         /// and appends all matches to the output iterator in order of match probability.
         template <typename IndirectIterator, typename OutputIterator>
         void find_matches(const data::secure_string& query, IndirectIterator begin, IndirectIterator end, OutputIterator output_iterator) const
         {
+          // Large ranges are searched in parallel, which keeps the matches of every part separately
+          const size_t size = static_cast<size_t>(std::distance(begin, end));
+          if (get_number_of_workers(size) > 1)
+          {
+            find_best_matches(query, begin, end, size, output_iterator);
+            return;
+          }
+
           // First, find all matches
           // They are roughly sorted in the priority queue.
           std::priority_queue<detail::entry_match> matches = find_matches(query, begin, end);
@@ -178,16 +369,172 @@ namespace deadlock
           }
         }
 
+        /// Scans through the entries defined by begin and end, and appends at most k matches
+        /// to the output iterator in order of match probability. The result is the same as the first k matches
+        /// that find_matches would produce, but only k matches are kept while searching.
+        template <typename IndirectIterator, typename OutputIterator>
+        void find_best_matches(const data::secure_string& query, IndirectIterator begin, IndirectIterator end, size_t k, OutputIterator output_iterator) const
+        {
+          top_k<IndirectIterator> best = find_best_candidates(query, begin, end, k);
+
+          // Only the entries that made it into the selection are copied
+          const auto& sorted = best.sort();
+          for (auto i = sorted.begin(); i != sorted.end(); i++)
+          {
+            output_iterator = *(i->reference.base());
+            output_iterator++;
+          }
+        }
+
         /// Returns the best match given the query, or nullptr if none was found.
         template <typename IndirectIterator>
         data::entry_ptr find_match(const data::secure_string& query, IndirectIterator begin, IndirectIterator end) const
         {
-          // First, find all matches
-          // They are roughly sorted in the priority queue, only the top is guaranteed to be sorted correctly.
-          const std::priority_queue<detail::entry_match> matches = find_matches(query, begin, end);
+          top_k<IndirectIterator> best = find_best_candidates(query, begin, end, 1);
+          return best.empty() ? nullptr : *(best.sort().front().reference.base());
+        }
+
+        /// Finds the best match for every query in [queries_begin, queries_end), and appends them to the output
+        /// iterator in the order of the queries, with nullptr for a query without matches.
+        /// Every entry is normalised once and scored against all queries in a single pass over the entries.
+        /// The result is the same as that of calling find_match for every query.
+        template <typename QueryIterator, typename IndirectIterator, typename OutputIterator>
+        void find_match_batch(QueryIterator queries_begin, QueryIterator queries_end,
+          IndirectIterator begin, IndirectIterator end, OutputIterator output_iterator) const
+        {
+          // Normalise the queries up front
+          std::vector<const data::secure_string*> queries;
+          for (QueryIterator q = queries_begin; q != queries_end; q++) queries.push_back(&(*q));
+
+          std::vector<data::normalised_string> queries_normalised(queries.size());
+          std::vector<int> word_bounds(queries.size());
+          std::vector<top_k<IndirectIterator>> best(queries.size(), top_k<IndirectIterator>(1));
+          for (size_t q = 0; q < queries.size(); q++)
+          {
+            queries_normalised[q].assign(*queries[q]);
+            word_bounds[q] = get_word_bound(queries_normalised[q].view());
+          }
+
+          data::normalised_string id;
+
+          size_t sequence = 0;
+          for (IndirectIterator i = begin; i != end; i++, sequence++)
+          {
+            id.assign(i->get_id());
+            const data::normalised_id id_view = id.view();
+
+            for (size_t q = 0; q < queries.size(); q++)
+            {
+              const data::normalised_id query_view = queries_normalised[q].view();
+
+              // Skip the entry if it cannot beat the best match for this query so far
+              if (!best[q].admits(get_upper_bound(query_view, word_bounds[q], id_view))) continue;
+
+              int probability = match_entry(*queries[q], query_view, *i, id_view);
+              if (probability > 0) best[q].push(i, probability, sequence);
+            }
+          }
+
+          for (auto b = best.begin(); b != best.end(); b++)
+          {
+            output_iterator = b->empty() ? nullptr : *(b->sort().front().reference.base());
+            output_iterator++;
+          }
+        }
+
+        /// Searches the collection, using its acceleration structure to skip entries that cannot match,
+        /// and appends all matches to the output iterator in order of match probability.
+        /// The result is the same as that of searching the range of the collection.
+        template <typename OutputIterator>
+        void find_matches(const data::secure_string& query, const data::entry_collection& entries, OutputIterator output_iterator) const
+        {
+          if (get_number_of_workers(entries.size()) > 1)
+          {
+            find_best_matches(query, entries, entries.size(), output_iterator);
+            return;
+          }
+
+          std::priority_queue<detail::entry_match> matches = find_matches(query, entries);
+
+          while (!matches.empty())
+          {
+            output_iterator = matches.top().entry;
+            output_iterator++;
+            matches.pop();
+          }
+        }
+
+        /// Searches the collection, and appends at most k matches to the output iterator in order of match probability.
+        /// The result is the same as the first k matches that find_matches would produce.
+        template <typename OutputIterator>
+        void find_best_matches(const data::secure_string& query, const data::entry_collection& entries, size_t k, OutputIterator output_iterator) const
+        {
+          top_k<data::id_column::position_type> best = find_best_candidates(query, entries, k);
+
+          const auto& sorted = best.sort();
+          for (auto i = sorted.begin(); i != sorted.end(); i++)
+          {
+            output_iterator = entries.at(i->reference);
+            output_iterator++;
+          }
+        }
 
-          // Becayse the top is sorted correctly, the best match is at the top, and the rest need not be sorted.
-          return matches.empty() ? nullptr : matches.top().entry;
+        /// Searches the identifier, username and additional data of the entries in the collection,
+        /// and appends all matches to the output iterator in order of match probability.
+        /// The probability is the sum of the probabilities for every field, multiplied by the weight of the field.
+        template <typename OutputIterator>
+        void find_matches(const data::secure_string& query, const data::entry_collection& entries, const field_weights& weights, OutputIterator output_iterator) const
+        {
+          top_k<data::id_column::position_type> best = find_field_candidates(query, entries, weights, entries.size());
+
+          const auto& sorted = best.sort();
+          for (auto i = sorted.begin(); i != sorted.end(); i++)
+          {
+            output_iterator = entries.at(i->reference);
+            output_iterator++;
+          }
+        }
+
+        /// Returns the best match in the collection given the query, searching the fields with the given weights,
+        /// or nullptr if none was found.
+        data::entry_ptr find_match(const data::secure_string& query, const data::entry_collection& entries, const field_weights& weights) const;
+
+        /// Searches the collection like find_matches does, but also finds entries for query words with up to
+        /// max_distance typos, such as 'gtihub'. Matches with typos rank below matches without typos.
+        template <typename OutputIterator>
+        void find_fuzzy_matches(const data::secure_string& query, const data::entry_collection& entries, size_t max_distance, OutputIterator output_iterator) const
+        {
+          top_k<data::id_column::position_type> best = find_fuzzy_candidates(query, entries, max_distance, entries.size());
+
+          const auto& sorted = best.sort();
+          for (auto i = sorted.begin(); i != sorted.end(); i++)
+          {
+            output_iterator = entries.at(i->reference);
+            output_iterator++;
+          }
+        }
+
+        /// Returns the best match in the collection given the query, allowing up to max_distance typos per word,
+        /// or nullptr if none was found.
+        data::entry_ptr find_fuzzy_match(const data::secure_string& query, const data::entry_collection& entries, size_t max_distance) const;
+
+        /// Returns the best match in the collection given the query, or nullptr if none was found.
+        data::entry_ptr find_match(const data::secure_string& query, const data::entry_collection& entries) const;
+
+        /// Finds the best match in the collection for every query in [queries_begin, queries_end), and appends them
+        /// to the output iterator in the order of the queries, with nullptr for a query without matches.
+        /// The identifiers in the collection are normalised already, and every query only considers the entries
+        /// its index lookup returns, so no pass over all entries is needed.
+        /// The result is the same as that of calling find_match for every query.
+        template <typename QueryIterator, typename OutputIterator>
+        void find_match_batch(QueryIterator queries_begin, QueryIterator queries_end,
+          const data::entry_collection& entries, OutputIterator output_iterator) const
+        {
+          for (QueryIterator q = queries_begin; q != queries_end; q++)
+          {
+            output_iterator = find_match(*q, entries);
+            output_iterator++;
+          }
         }
     };
   }
@@ -0,0 +1,165 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "search_session.h"
+
+#include <algorithm>
+
+using namespace deadlock::core;
+
+search_session::search_session(const search& algorithm, const data::entry_collection& entries)
+  : algorithm(algorithm), entries(entries)
+{
+  revision = entries.get_revision();
+}
+
+void search_session::reset()
+{
+  words.clear();
+  revision = entries.get_revision();
+}
+
+/// Returns whether the scored word is the given word
+static inline bool is_word(const data::secure_string& scored, const char* word, size_t length)
+{
+  return scored.size() == length && std::equal(word, word + length, scored.begin());
+}
+
+void search_session::score_word(const data::normalised_id& query_normalised, size_t i, scored_word& result)
+{
+  const char* word = query_normalised.word(i);
+  const size_t length = query_normalised.words[i].length;
+
+  result.word.assign(word, length);
+  result.scores.clear();
+
+  // A view of the query that contains only this word
+  data::normalised_id single_word = query_normalised;
+  single_word.words = query_normalised.words + i;
+  single_word.number_of_words = 1;
+
+  // The candidates are in ascending order, so the scores are too
+  entries.get_index().find_word_candidates(single_word, candidates);
+
+  const data::id_column& ids = entries.get_ids();
+  for (auto c = candidates.begin(); c != candidates.end(); c++)
+  {
+    const int probability = algorithm.match_word(word, length, ids[*c]);
+    if (probability > 0)
+    {
+      word_score score;
+      score.position = *c;
+      score.probability = probability;
+      result.scores.push_back(score);
+    }
+  }
+}
+
+top_k<search_session::position_type> search_session::find_best_candidates(const data::secure_string& query, size_t k)
+{
+  // Scores of a different version of the collection are of no use
+  if (revision != entries.get_revision()) reset();
+
+  const data::normalised_string query_normalised(query);
+  const data::normalised_id query_view = query_normalised.view();
+
+  // Without words, only an exact match counts, which the search algorithm handles by checking every entry
+  if (!data::word_index::can_answer(query_view))
+  {
+    return algorithm.find_best_candidates(query, entries, k);
+  }
+
+  // Take the scores of the words that are still in the query, and score the new ones
+  next_words.resize(query_view.number_of_words);
+  size_t number_of_words = 0;
+  for (size_t i = 0; i < query_view.number_of_words; i++)
+  {
+    const char* word = query_view.word(i);
+    const size_t length = query_view.words[i].length;
+    auto same_word = [&](const scored_word& w) { return is_word(w.word, word, length); };
+
+    // A word that occurs more than once is scored only once
+    if (std::any_of(next_words.begin(), next_words.begin() + number_of_words, same_word)) continue;
+
+    scored_word& next = next_words[number_of_words++];
+    auto previous = std::find_if(words.begin(), words.end(), same_word);
+    if (previous != words.end())
+    {
+      next.word.swap(previous->word);
+      next.scores.swap(previous->scores);
+
+      // The previous word now holds whatever the storage held, which must not be found again
+      previous->word.clear();
+    }
+    else
+    {
+      score_word(query_view, i, next);
+    }
+  }
+  next_words.resize(number_of_words);
+  words.swap(next_words);
+
+  // Add up the scores per entry, counting a word once for every time it occurs in the query
+  merged.clear();
+  for (size_t i = 0; i < query_view.number_of_words; i++)
+  {
+    const char* word = query_view.word(i);
+    const size_t length = query_view.words[i].length;
+    auto w = std::find_if(words.begin(), words.end(), [&](const scored_word& w) { return is_word(w.word, word, length); });
+    merged.insert(merged.end(), w->scores.begin(), w->scores.end());
+  }
+
+  // A query of one word can match by acronym too, which is cheap to look up again
+  if (data::word_index::can_match_acronym(query_view))
+  {
+    const data::id_column& ids = entries.get_ids();
+    entries.get_index().find_acronym_candidates(query_view, candidates);
+
+    for (auto c = candidates.begin(); c != candidates.end(); c++)
+    {
+      word_score score;
+      score.position = *c;
+      score.probability = algorithm.match_acronym(query_view, ids[*c]);
+      merged.push_back(score);
+    }
+  }
+
+  std::sort(merged.begin(), merged.end(), [](const word_score& s1, const word_score& s2) { return s1.position < s2.position; });
+
+  top_k<position_type> best(std::min(k, entries.size()));
+  const data::id_column& ids = entries.get_ids();
+
+  for (auto s = merged.begin(); s != merged.end();)
+  {
+    const position_type position = s->position;
+    int probability = 0;
+    for (; s != merged.end() && s->position == position; s++) probability += s->probability;
+
+    // An exact match consists of the same words, so it is among the scored entries
+    probability += algorithm.match_exact(query, query_view, entries.at(position)->get_id(), ids[position]);
+
+    best.push(position, probability, position);
+  }
+
+  return best;
+}
+
+data::entry_ptr search_session::find_match(const data::secure_string& query)
+{
+  top_k<position_type> best = find_best_candidates(query, 1);
+
+  return best.empty() ? nullptr : entries.at(best.sort().front().reference);
+}
@@ -0,0 +1,122 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _DEADLOCK_CORE_SEARCH_SESSION_H_
+#define _DEADLOCK_CORE_SEARCH_SESSION_H_
+
+#include <vector>
+
+#include "search.h"
+#include "top_k.h"
+#include "data/secure_string.h"
+#include "data/entry_collection.h"
+#include "data/id_column.h"
+#include "data/word_index.h"
+
+namespace deadlock
+{
+  namespace core
+  {
+    /// Searches one collection for a query that changes a little at a time, such as while the user types.
+    /// The probability of an entry is the sum of what every query word adds to it, plus a bonus for an exact match.
+    /// The session remembers what every word of the previous query added to every entry,
+    /// so after a keystroke only the word that was edited is scored again.
+    /// The results are the same as those of the search algorithm on the collection.
+    /// A session must not be used by more than one thread at a time, and it must not outlive the collection.
+    class search_session
+    {
+    protected:
+
+      typedef data::id_column::position_type position_type;
+
+      /// What one query word adds to the probability of one entry
+      struct word_score
+      {
+        position_type position;
+        int probability;
+      };
+
+      /// What one query word adds to the entries it matches, in order of position
+      struct scored_word
+      {
+        data::secure_string word;
+        std::vector<word_score> scores;
+      };
+
+      /// The search algorithm
+      const search& algorithm;
+
+      /// The collection that is searched
+      const data::entry_collection& entries;
+
+      /// The revision of the collection that the scores were computed for
+      size_t revision;
+
+      /// The distinct words of the previous query, with their scores
+      std::vector<scored_word> words;
+
+      /// The words of the current query, kept to reuse the memory
+      std::vector<scored_word> next_words;
+
+      /// The scores of all query words together, kept to reuse the memory
+      std::vector<word_score> merged;
+
+      /// The candidates of a word, kept to reuse the memory
+      data::word_index::posting_list candidates;
+
+      /// Computes what the given word of the query adds to the entries that can match it
+      void score_word(const data::normalised_id& query_normalised, size_t i, scored_word& result);
+
+      /// Scores the entries for the query, reusing the scores of words that were in the previous query,
+      /// and keeps only the k best matches.
+      top_k<position_type> find_best_candidates(const data::secure_string& query, size_t k);
+
+    public:
+
+      /// Starts a session on the collection
+      search_session(const search& algorithm, const data::entry_collection& entries);
+
+      /// Forgets the previous query
+      void reset();
+
+      /// Appends at most k matches to the output iterator, in order of match probability
+      template <typename OutputIterator>
+      void find_best_matches(const data::secure_string& query, size_t k, OutputIterator output_iterator)
+      {
+        top_k<position_type> best = find_best_candidates(query, k);
+
+        const auto& sorted = best.sort();
+        for (auto i = sorted.begin(); i != sorted.end(); i++)
+        {
+          output_iterator = entries.at(i->reference);
+          output_iterator++;
+        }
+      }
+
+      /// Appends all matches to the output iterator, in order of match probability
+      template <typename OutputIterator>
+      void find_matches(const data::secure_string& query, OutputIterator output_iterator)
+      {
+        find_best_matches(query, entries.size(), output_iterator);
+      }
+
+      /// Returns the best match given the query, or nullptr if none was found
+      data::entry_ptr find_match(const data::secure_string& query);
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,117 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _DEADLOCK_CORE_SERIALISATION_BINARY_DESERIALISER_H_
+#define _DEADLOCK_CORE_SERIALISATION_BINARY_DESERIALISER_H_
+
+#include <cstdint>
+
+#include "deserialiser.h"
+#include "../data/secure_string.h"
+
+namespace deadlock
+{
+  namespace core
+  {
+    namespace serialisation
+    {
+      /// This class reads the binary records written by binary_serialiser from a buffer.
+      /// The buffer must outlive the deserialiser.
+      class binary_deserialiser
+      {
+      protected:
+
+        /// The next byte to read
+        const char* current;
+
+        /// The end of the buffer
+        const char* end;
+
+        /// Throws if fewer than the given number of bytes remain
+        inline void require(std::uint64_t length) const
+        {
+          if (static_cast<std::uint64_t>(end - current) < length) throw bad_stream_error("The record ended unexpectedly.");
+        }
+
+      public:
+
+        /// Creates a deserialiser that reads the bytes from begin up to end
+        inline binary_deserialiser(const char* begin, const char* buffer_end) : current(begin), end(buffer_end)
+        {
+
+        }
+
+        /// Returns whether all bytes have been read
+        inline bool at_end() const { return current == end; }
+
+        /// Returns the next byte to read
+        inline const char* get_current() const { return current; }
+
+        /// Reads a variable-length unsigned integer
+        inline std::uint64_t read_integer()
+        {
+          std::uint64_t value = 0;
+          for (int shift = 0; shift < 64; shift += 7)
+          {
+            require(1);
+            const std::uint8_t byte = static_cast<std::uint8_t>(*current++);
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) return value;
+          }
+          throw ill_formed_source_error("A variable-length integer is too long.");
+        }
+
+        /// Reads a timestamp of eight bytes
+        inline std::int64_t read_timestamp()
+        {
+          require(8);
+          std::uint64_t value = 0;
+          for (int i = 0; i < 8; i++)
+          {
+            value = (value << 8) | static_cast<std::uint8_t>(*current++);
+          }
+          return static_cast<std::int64_t>(value);
+        }
+
+        /// Reads a string that consists of its length followed by its bytes
+        inline void read_string(data::secure_string& str)
+        {
+          const std::uint64_t length = read_integer();
+          require(length);
+          str.assign(current, static_cast<size_t>(length));
+          current += length;
+        }
+
+        /// Skips a timestamp
+        inline void skip_timestamp()
+        {
+          require(8);
+          current += 8;
+        }
+
+        /// Skips a string without copying it
+        inline void skip_string()
+        {
+          const std::uint64_t length = read_integer();
+          require(length);
+          current += length;
+        }
+      };
+    }
+  }
+}
+
+#endif
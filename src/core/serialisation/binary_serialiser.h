@@ -0,0 +1,88 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _DEADLOCK_CORE_SERIALISATION_BINARY_SERIALISER_H_
+#define _DEADLOCK_CORE_SERIALISATION_BINARY_SERIALISER_H_
+
+#include <cstdint>
+
+#include "../data/secure_string.h"
+
+namespace deadlock
+{
+  namespace core
+  {
+    namespace serialisation
+    {
+      /// This class writes compact binary records to a buffer.
+      /// Unsigned integers are written as variable-length integers: seven bits per byte,
+      /// least significant first, with the high bit set on every byte except the last.
+      /// Timestamps are written as eight bytes, most significant first,
+      /// and strings as their length followed by the bytes of the string.
+      class binary_serialiser
+      {
+      protected:
+
+        /// The buffer that the records are appended to
+        data::secure_string& buffer;
+
+      public:
+
+        /// Creates a serialiser that appends to the buffer
+        inline binary_serialiser(data::secure_string& output_buffer) : buffer(output_buffer)
+        {
+
+        }
+
+        /// Writes an unsigned integer as variable-length integer
+        inline void write_integer(std::uint64_t value)
+        {
+          while (value >= 0x80)
+          {
+            buffer.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+          }
+          buffer.push_back(static_cast<char>(value));
+        }
+
+        /// Writes a timestamp as eight bytes
+        inline void write_timestamp(std::int64_t timestamp)
+        {
+          const std::uint64_t value = static_cast<std::uint64_t>(timestamp);
+          for (int shift = 56; shift >= 0; shift -= 8)
+          {
+            buffer.push_back(static_cast<char>(value >> shift));
+          }
+        }
+
+        /// Writes a string as its length followed by its bytes
+        inline void write_string(const data::secure_string& str)
+        {
+          write_integer(str.size());
+          buffer.append(str);
+        }
+
+        /// Writes bytes that were written by a binary serialiser before, as they are
+        inline void write_encoded(const char* begin, const char* end)
+        {
+          buffer.append(begin, end);
+        }
+      };
+    }
+  }
+}
+
+#endif
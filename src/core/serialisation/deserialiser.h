@@ -19,6 +19,7 @@
 
 #include <istream>
 #include <stdexcept>
+#include <string>
 
 #include "value.h"
 
@@ -71,8 +72,8 @@ namespace deadlock
         {
         protected:
       
-          /// The value on which the serialiserr acts.
-          json_value& main_value;
+          /// The value on which the serialiserr acts, if any.
+          json_value* main_value;
 
           /// The current character
           char c;
@@ -485,17 +486,112 @@ namespace deadlock
 
           /// Constructor
           /// Takes a reference to the value to use
-          deserialiser(json_value& v, std::istream& is) : main_value(v), c('\0'), istr(is) {}
+          deserialiser(json_value& v, std::istream& is) : main_value(&v), c('\0'), istr(is) {}
 
           /// Reads the valure from the stream
           void read()
           {
             read_next();
-            main_value = read_value();
+            *main_value = read_value();
+          }
+
+        protected:
+
+          /// Constructor for deserialisers that do not read into a single value
+          deserialiser(std::istream& is) : main_value(nullptr), c('\0'), istr(is) {}
+
+          /// Skips the whitespace between tokens
+          void skip_whitespace()
+          {
+            while (c == ' ' || c == '\t' || c == '\n' || c == '\r') require_next();
+          }
+
+          /// Skips whitespace, and fails unless the next character is the expected one
+          void require_token(char expected)
+          {
+            skip_whitespace();
+            if (c != expected) throw ill_formed_source_error(std::string("The data source is ill-formed: expected '") + expected + "'.");
           }
         };
       }
 
+      /// Reads JSON from a stream piece by piece, so a large document need not be in memory at once.
+      /// The members of an object and the elements of an array are passed to a handler as soon as they are reached;
+      /// the handler reads the member or element with one call to read_value, read_members or read_elements.
+      class json_reader: protected detail::deserialiser
+      {
+      public:
+
+        /// Constructs a reader that reads from the stream
+        json_reader(std::istream& is) : detail::deserialiser(is)
+        {
+          read_next();
+        }
+
+        /// Reads the next value as a whole
+        json_value read_value()
+        {
+          return detail::deserialiser::read_value();
+        }
+
+        /// Reads an object, calling handle_member with the key of every member.
+        /// Unlike reading a whole value, anything but whitespace between the tokens is an error.
+        template <typename Handler>
+        void read_members(Handler handle_member)
+        {
+          require_token('{');
+          require_next(); // skip '{'
+          skip_whitespace();
+
+          while (c != '}')
+          {
+            require_token('"');
+            data::secure_string_ptr key = read_string_raw();
+            require_token(':');
+            require_next(); // skip ':'
+            require_value();
+            handle_member(static_cast<const data::secure_string&>(*key));
+
+            skip_whitespace();
+            if (c == '}') break;
+            require_token(',');
+            require_next(); // skip ','
+          }
+          read_next(); // skip '}'
+        }
+
+        /// Reads an array, calling handle_element for every element.
+        /// Unlike reading a whole value, anything but whitespace between the tokens is an error.
+        template <typename Handler>
+        void read_elements(Handler handle_element)
+        {
+          require_token('[');
+          require_next(); // skip '['
+          skip_whitespace();
+
+          while (c != ']')
+          {
+            require_value();
+            handle_element();
+
+            skip_whitespace();
+            if (c == ']') break;
+            require_token(',');
+            require_next(); // skip ','
+          }
+          read_next(); // skip ']'
+        }
+
+      protected:
+
+        /// Skips whitespace, and fails unless a value starts at the next character
+        void require_value()
+        {
+          skip_whitespace();
+          if (!is_value()) throw ill_formed_source_error("The data source is ill-formed: expected a value.");
+        }
+      };
+
       /// Deserialises a value from a stream
       // TODO: use cpp files
       inline std::istream& operator>>(std::istream& istr, json_value& value)
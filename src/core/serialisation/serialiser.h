@@ -102,7 +102,7 @@ namespace deadlock
       public:
 
         /// Creates a serialiser that can be used to write to the stream
-        inline serialiser(std::ostream& os) : indentation(0), ostr(os), write_whitespace(false)
+        inline serialiser(std::ostream& os) : indentation(0), write_whitespace(false), ostr(os)
         {
           // The state stack must contain at least one state
           states.push(state_none);
@@ -110,7 +110,7 @@ namespace deadlock
 
         /// Creates a serialiser that can be used to write to the stream
         /// Optionally writes whitespace to make the output more readable
-        inline serialiser(std::ostream& os, bool human_readable) : indentation(0), ostr(os), write_whitespace(human_readable)
+        inline serialiser(std::ostream& os, bool human_readable) : indentation(0), write_whitespace(human_readable), ostr(os)
         {
           // The state stack must contain at least one state
           states.push(state_none);
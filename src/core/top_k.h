@@ -0,0 +1,136 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _DEADLOCK_CORE_TOP_K_H_
+#define _DEADLOCK_CORE_TOP_K_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace deadlock
+{
+  namespace core
+  {
+    /// A possible search result that refers to an entry by a cheap handle,
+    /// such as a position or an iterator, instead of holding the entry itself.
+    template <typename Reference> struct ranked_candidate
+    {
+      /// Identifies the entry
+      Reference reference;
+
+      /// The probability that the entry is the one the user meant
+      int probability;
+
+      /// The order in which the entry was considered, used to break ties
+      size_t sequence;
+    };
+
+    /// Orders candidates by probability; of two equally probable candidates, the one considered first ranks higher
+    template <typename Reference>
+    inline bool operator<(const ranked_candidate<Reference>& c1, const ranked_candidate<Reference>& c2)
+    {
+      return c1.probability < c2.probability || (c1.probability == c2.probability && c1.sequence > c2.sequence);
+    }
+
+    /// Keeps the k best candidates offered to it, in a heap that never grows beyond k elements.
+    template <typename Reference> class top_k
+    {
+    public:
+
+      typedef ranked_candidate<Reference> candidate;
+
+    protected:
+
+      /// A heap with the worst candidate kept at the front
+      std::vector<candidate> heap;
+
+      /// The maximum number of candidates kept
+      size_t capacity;
+
+      /// Returns whether c1 ranks higher than c2, which puts the worst candidate at the front of the heap
+      static inline bool better(const candidate& c1, const candidate& c2)
+      {
+        return c2 < c1;
+      }
+
+    public:
+
+      /// Creates a selection that keeps at most k candidates
+      explicit top_k(size_t k) : capacity(k)
+      {
+        heap.reserve(k);
+      }
+
+      /// Returns whether a candidate with the given probability could still be kept,
+      /// assuming it is considered after all candidates offered so far.
+      /// Use this to skip entries whose probability is known to be low enough before scoring them.
+      inline bool admits(int probability) const
+      {
+        return heap.size() < capacity || (capacity > 0 && probability > heap.front().probability);
+      }
+
+      /// Offers a candidate, which is kept if it is among the k best so far
+      inline void push(const candidate& c)
+      {
+        if (heap.size() < capacity)
+        {
+          heap.push_back(c);
+          std::push_heap(heap.begin(), heap.end(), better);
+        }
+        else if (capacity > 0 && better(c, heap.front()))
+        {
+          // Replace the worst candidate
+          std::pop_heap(heap.begin(), heap.end(), better);
+          heap.back() = c;
+          std::push_heap(heap.begin(), heap.end(), better);
+        }
+      }
+
+      /// Offers a candidate, which is kept if it is among the k best so far
+      inline void push(const Reference& reference, int probability, size_t sequence)
+      {
+        candidate c;
+        c.reference = reference;
+        c.probability = probability;
+        c.sequence = sequence;
+        push(c);
+      }
+
+      /// Offers all candidates kept by another selection, such as one made over a different part of the entries
+      inline void merge(const top_k& other)
+      {
+        for (auto c = other.heap.begin(); c != other.heap.end(); c++) push(*c);
+      }
+
+      /// Returns the number of candidates kept
+      inline size_t size() const { return heap.size(); }
+
+      /// Returns whether no candidate was kept
+      inline bool empty() const { return heap.empty(); }
+
+      /// Sorts the candidates, best first, and returns them.
+      /// No candidates can be pushed afterwards.
+      inline const std::vector<candidate>& sort()
+      {
+        std::sort_heap(heap.begin(), heap.end(), better);
+        return heap;
+      }
+    };
+  }
+}
+
+#endif
@@ -16,16 +16,27 @@
 
 #include "vault.h"
 
+#include <algorithm>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "core.h"
 #include "errors.h"
 #include "endianness.h"
+#include "mapped_file.h"
+#include "memory_stream.h"
+#include "pipeline.h"
 #include "cryptography/key.h"
 #include "cryptography/aes_cbc_decrypt_stream.h"
 #include "cryptography/aes_cbc_encrypt_stream.h"
+#include "cryptography/authenticated_encryption.h"
+#include "cryptography/random.h"
 #include "cryptography/xz_compress_stream.h"
 #include "cryptography/xz_decompress_stream.h"
 
@@ -33,7 +44,16 @@ using namespace deadlock::core;
 
 vault::vault()
 {
-
+  stored_entries = 0;
+  base_size = 0;
+  journal_size = 0;
+  journal_records = 0;
+  journal_torn = false;
+  compression = compression_default;
+  file_compression = compression_default;
+  compression_threads = 1;
+  compression_block_size = 1024 * 1024;
+  lazy_loading = false;
 }
 
 void vault::add_entry(data::entry_ptr new_entry)
@@ -41,20 +61,10 @@ void vault::add_entry(data::entry_ptr new_entry)
   entries.push_back(new_entry);
 }
 
-void vault::deserialise(const serialisation::json_value::object_t& json_data)
+/// Throws if JSON data of the given version cannot be read
+static void check_json_version(const data::secure_string& version_data)
 {
-  // At least, the data must contain version information and entries
-  if (json_data.find("version") == json_data.end())
-  {
-    throw format_error("No version information present.");
-  }
-  if (json_data.find("entries") == json_data.end())
-  {
-    throw format_error("No entries present.");
-  }
-
-  // Read the version
-  data::secure_stringstream_ptr version_string = data::make_secure_stringstream(static_cast<const data::secure_string&>(json_data.at("version")));
+  data::secure_stringstream_ptr version_string = data::make_secure_stringstream(version_data);
   version file_version;
   *version_string >> file_version;
   version application_version = assembly_information::get_version();
@@ -66,9 +76,6 @@ void vault::deserialise(const serialisation::json_value::object_t& json_data)
   {
     throw version_error("The file was created with a newer version of the application.");
   }
-
-  // Deserialise the entries
-  entries.deserialise(json_data.at("entries"));
 }
 
 void vault::serialise(serialisation::serialiser& serialiser, bool obfuscation)
@@ -91,13 +98,51 @@ void vault::serialise(serialisation::serialiser& serialiser, bool obfuscation)
 
 void vault::deserialise(std::istream& json_stream)
 {
-  serialisation::json_value vault_root;
+  // An export can be larger than memory, so the entries are read one at a time instead of as one JSON document.
+  // They are only added once the whole document has been read, so a failed import leaves the vault as it was.
+  // The version is checked when it is read; serialise writes it before the entries.
+  serialisation::json_reader reader(json_stream);
+  bool has_version = false, has_entries = false;
+  std::vector<data::entry_ptr> imported_entries;
+
+  reader.read_members([&](const data::secure_string& key)
+  {
+    if (key == "version")
+    {
+      check_json_version(reader.read_value());
+      has_version = true;
+    }
+    else if (key == "entries")
+    {
+      reader.read_elements([&]()
+      {
+        data::entry_ptr imported_entry = data::make_entry();
+        imported_entry->deserialise(reader.read_value());
+        imported_entries.push_back(imported_entry);
+      });
+      has_entries = true;
+    }
+    else
+    {
+      // Skip anything else
+      reader.read_value();
+    }
+  });
 
-  // Deserialise JSON from stream
-  json_stream >> vault_root;
+  // At least, the data must contain version information and entries
+  if (!has_version)
+  {
+    throw format_error("No version information present.");
+  }
+  if (!has_entries)
+  {
+    throw format_error("No entries present.");
+  }
 
-  // Read the JSON structure
-  deserialise(vault_root);
+  for (auto e = imported_entries.begin(); e != imported_entries.end(); e++)
+  {
+    entries.push_back(*e);
+  }
 }
 
 void vault::serialise(std::ostream& json_stream, bool obfuscation, bool human_readable)
@@ -166,181 +211,866 @@ void vault::export_json(const std::string& filename, bool obfuscation)
   file.close();
 }
 
-void vault::build_decrypt_stream(std::istream& input_stream, version& vault_version, cryptography::key& key,
-  cryptography::aes_cbc_decrypt_stream*& decrypt_stream,
-  cryptography::xz_decompress_stream*& decompress_stream,
-  const data::secure_string& passphrase)
+/// How many entries one chunk of a chunked vault holds, and how long it is
+struct chunk_information
 {
-  // Validate the header
-  char d, l, k, zero;
-  input_stream >> d; input_stream >> l; input_stream >> k; input_stream >> zero;
-  if (d != 'D' || l != 'L' || k != 'K' || zero != 0)
-  {
-    throw format_error("The file is not a valid Deadlock vault; the header is incorrect.");
-  }
+  /// The number of entries in the chunk
+  std::uint32_t number_of_entries;
 
-  // Now read the version
-  version application_version = assembly_information::get_version();
-  vault_version.major = input_stream.get(); vault_version.minor = input_stream.get();
-  vault_version.revision = input_stream.get(); vault_version.build = input_stream.get();
+  /// The number of bytes of ciphertext
+  std::uint32_t length;
+};
 
-  // Version checks could be added here to parse old versions
-  // For now, there is only one version, so it does not matter
-  // Forward compatibility is not assumed, reading a newer version is an error.
-  if (application_version < vault_version)
+/// How the plaintext of the sections of a file is compressed, which follows from the compression profile in its header
+struct section_codec
+{
+  /// Whether the plaintext is compressed at all
+  bool compressed;
+
+  /// The XZ preset
+  std::uint32_t preset;
+
+  /// The number of threads that XZ may use
+  std::uint32_t threads;
+
+  /// The number of bytes of plaintext that XZ compresses as one block when it uses more than one thread
+  std::uint64_t block_size;
+
+  /// Whether sections are encrypted and authenticated with AES GCM, rather than encrypted with AES CBC
+  bool authenticated;
+
+  /// The number of threads that may encrypt or decrypt the segments of an authenticated section
+  std::uint32_t cipher_threads;
+
+  /// The key of the authenticated sections of one save, which is derived from the key of the vault and the salt of the save
+  cryptography::key section_key;
+
+  /// The header of the file, which every authenticated section authenticates
+  std::string header;
+};
+
+/// Returns whether the sections of vaults of the given version are authenticated
+static bool has_authenticated_sections(const version& vault_version)
+{
+  // Version 1.5 replaced AES CBC, and the key check at the start of every section, by AES GCM
+  return version(1, 5, 0, 0) <= vault_version;
+}
+
+/// Returns how sections of a vault of the given version are encrypted and compressed with the given profile
+static section_codec make_codec(const version& vault_version, vault::compression_profile profile,
+  std::uint32_t threads, std::uint64_t block_size)
+{
+  section_codec codec;
+  codec.compressed = profile != vault::compression_none;
+  codec.threads = threads;
+  codec.block_size = block_size;
+  codec.authenticated = has_authenticated_sections(vault_version);
+  codec.cipher_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  switch (profile)
   {
-    throw version_error("The file was created with a newer version of the application.");
+    case vault::compression_fast: codec.preset = 1; break;
+    case vault::compression_extreme: codec.preset = 9 | LZMA_PRESET_EXTREME; break;
+    default: codec.preset = 6; break;
   }
 
-  // Read the number of PBKDF2 iterations (stored as a big-endian 32-bit integer)
-  std::uint32_t iterations;
-  input_stream.read(reinterpret_cast<char*>(&iterations), 4);
-  iterations = portable_to_internal(iterations);
+  return codec;
+}
 
-  // Followed by the 32 bytes of salt that were used to generate the key
-  for (size_t i = 0; i < key.salt_size; i++)
+/// Derives the key of the authenticated sections of one save from the key of the vault and the salt of the save,
+/// which ends the header. Sections of different saves thus never share a key, and cannot be exchanged.
+static void use_save(section_codec& codec, const cryptography::key& key, const std::string& header)
+{
+  if (!codec.authenticated) return;
+
+  const std::uint8_t* save_salt = reinterpret_cast<const std::uint8_t*>(header.data() + header.size() - vault::save_salt_size);
+  key.derive_subkey("Deadlock sections", save_salt, vault::save_salt_size, codec.section_key);
+  codec.header = header;
+}
+
+/// What a section of a vault holds
+enum section_kind
+{
+  section_directory = 1, ///< The chunk directory, of which there is one
+  section_chunk,         ///< A chunk, numbered in the order of the directory
+  section_record         ///< A record of the journal, numbered in the order it was appended
+};
+
+/// Returns the data that an authenticated section authenticates besides its contents: the header,
+/// what the section holds and its number among the sections that hold the same.
+/// A section thus fails to decrypt if it is moved to another place, or if the version, compression profile
+/// or key check value in the header is changed.
+static std::string section_place(const section_codec& codec, section_kind kind, std::uint64_t index)
+{
+  if (!codec.authenticated) return std::string();
+
+  std::string place = codec.header;
+  place += static_cast<char>(kind);
+  for (int shift = 56; shift >= 0; shift -= 8)
   {
-    key.get_salt()[i] = input_stream.get();
+    place += static_cast<char>(index >> shift);
   }
+  return place;
+}
+
+/// Writes an integer as a big-endian 32-bit integer
+static void write_integer(std::ostream& output_stream, std::uint32_t value)
+{
+  value = internal_to_portable(value);
+  output_stream.write(reinterpret_cast<char*>(&value), 4);
+}
 
-  // Now generate the key
-  key.generate_key(passphrase, iterations);
+/// Reads a big-endian 32-bit integer
+static std::uint32_t read_integer(std::istream& input_stream)
+{
+  std::uint32_t value;
+  if (!input_stream.read(reinterpret_cast<char*>(&value), 4)) throw format_error("The vault ended unexpectedly.");
+  return portable_to_internal(value);
+}
 
-  // Create a decryption stream that reads encrypted data
-  decrypt_stream = new cryptography::aes_cbc_decrypt_stream(input_stream, key);
-  // And a decompression stream that decompresses data
-  decompress_stream = new cryptography::xz_decompress_stream(*decrypt_stream);
+/// Returns roughly how many bytes the entry takes when serialised
+static size_t approximate_size(const data::entry& entry)
+{
+  return entry.get_id().size() + entry.get_username().size() + entry.get_additional_data().size()
+    + entry.approximate_passwords_size();
+}
 
-  // Read 16 bytes before the compressed data from the encryption stream.
-  // Those bytes are used to validate that the encryption key is correct.
-  // (16 is the AES block size.)
+/// Reads the 16 bytes that precede the compressed data, which are the first bytes of the salt,
+/// to validate that the key is correct. (16 is the AES block size.)
+static void check_key(std::istream& decrypt_stream, const cryptography::key& key)
+{
   for (size_t i = 0; i < 16; i++)
   {
-    std::uint8_t c = decrypt_stream->get();
+    std::uint8_t c = decrypt_stream.get();
     if (key.get_salt()[i] != c) throw incorrect_key_error("This key cannot correctly decrypt the data.");
   }
+}
 
-  // Finally, the streams can be used.
-  // This works as follows: file or other stream >> AES CBC decrypt >> XZ decompress >> JSON plaintext
+/// Decompresses what the decryption stream decrypts, validates the key, and lets the reader read the plaintext
+template <typename Reader>
+static void decompress(cryptography::aes_cbc_decrypt_stream& decrypt_stream, const cryptography::key& key,
+  const section_codec& codec, Reader reader)
+{
+  // Uncompressed plaintext is read straight from the decryption stream
+  if (!codec.compressed)
+  {
+    check_key(decrypt_stream, key);
+    reader(static_cast<std::istream&>(decrypt_stream));
+    return;
+  }
+
+  // This works as follows: ciphertext >> AES CBC decrypt >> XZ decompress >> plaintext
+  cryptography::xz_decompress_stream decompress_stream(decrypt_stream, codec.threads);
+
+  check_key(decrypt_stream, key);
+  reader(static_cast<std::istream&>(decompress_stream));
 }
 
-void vault::load(std::istream& input_stream, cryptography::key& key, const data::secure_string& passphrase)
+/// Reads the remaining plaintext into the buffer, in large blocks
+static void read_all(std::istream& plaintext, data::secure_string& buffer)
 {
-  /*
-  // Validate the header
-  char d, l, k, zero;
-  input_stream >> d; input_stream >> l; input_stream >> k; input_stream >> zero;
-  if (d != 'D' || l != 'L' || k != 'K' || zero != 0)
+  // The decryption and decompression streams report damaged data by throwing from underflow,
+  // which the stream would otherwise swallow, so the plaintext would look merely short
+  plaintext.exceptions(std::ios::badbit);
+
+  const size_t block_size = 64 * 1024;
+  size_t length = 0;
+  do
   {
-    throw format_error("The file is not a valid Deadlock vault; the header is incorrect.");
+    buffer.resize(length + block_size);
+    plaintext.read(&buffer[length], block_size);
+    length += static_cast<size_t>(plaintext.gcount());
   }
+  while (plaintext.good());
+  buffer.resize(length);
+}
 
-  // Now read the version
-  version application_version = assembly_information::get_version();
-  file_version.major = input_stream.get(); file_version.minor = input_stream.get();
-  file_version.revision = input_stream.get(); file_version.build = input_stream.get();
+/// Lets the handler see the ciphertext of the section of the given length at the current position of the input stream
+template <typename Handler>
+static void read_section(std::istream& input_stream, size_t length, Handler handler)
+{
+  // Ciphertext in memory can be decrypted where it is
+  detail::memory_streambuffer* memory = dynamic_cast<detail::memory_streambuffer*>(input_stream.rdbuf());
+  if (memory != nullptr)
+  {
+    if (memory->remaining() < length) throw format_error("The vault ended unexpectedly.");
+    const char* ciphertext = memory->current();
+    memory->skip(length);
 
-  // Version checks could be added here to parse old versions
-  // For now, there is only one version, so it does not matter
-  // Forward compatibility is not assumed, reading a newer version is an error.
-  if (application_version < file_version)
+    handler(ciphertext, ciphertext + length);
+    return;
+  }
+
+  // Otherwise, only the section is read, because the decryption reads up to the end of its input
+  std::string ciphertext(length, '\0');
+  if (!input_stream.read(&ciphertext[0], length)) throw format_error("The vault ended unexpectedly.");
+  handler(ciphertext.data(), ciphertext.data() + length);
+}
+
+/// Decrypts the section of the given length at the current position of the input stream,
+/// and lets the reader read the ciphertext through the decryption stream
+template <typename Reader>
+static void decrypt_section_stream(std::istream& input_stream, size_t length, const cryptography::key& key, Reader reader)
+{
+  read_section(input_stream, length, [&](const char* begin, const char* end)
   {
-    throw version_error("The file was created with a newer version of the application.");
+    cryptography::aes_cbc_decrypt_stream decrypt_stream(begin, end, key);
+    reader(decrypt_stream);
+  });
+}
+
+/// Decrypts the section of the given length at the current position of the input stream, but does not decompress it.
+/// This validates the key of a section that is encrypted with AES CBC,
+/// and verifies that an authenticated section was not changed or moved from its place before any of it is decompressed.
+static void decrypt_compressed_section(std::istream& input_stream, size_t length, const cryptography::key& key,
+  const section_codec& codec, const std::string& place, data::secure_string& compressed)
+{
+  if (codec.authenticated)
+  {
+    read_section(input_stream, length, [&](const char* begin, const char* end)
+    {
+      cryptography::decrypt_authenticated(codec.section_key, begin, end - begin, place, codec.cipher_threads, compressed);
+    });
+    return;
   }
 
-  // Read the number of PBKDF2 iterations (stored as a big-endian 32-bit integer)
-  std::uint32_t iterations;
-  input_stream.read(reinterpret_cast<char*>(&iterations), 4);
-  iterations = portable_to_internal(iterations);
+  decrypt_section_stream(input_stream, length, key, [&](cryptography::aes_cbc_decrypt_stream& decrypt_stream)
+  {
+    check_key(decrypt_stream, key);
+    read_all(decrypt_stream, compressed);
+  });
+}
 
-  // Followed by the 32 bytes of salt that were used to generate the key
-  for (size_t i = 0; i < key.salt_size; i++)
+/// Decrypts the section of the given length at the current position of the input stream,
+/// and lets the reader read the plaintext
+template <typename Reader>
+static void decrypt_section(std::istream& input_stream, size_t length, const cryptography::key& key,
+  const section_codec& codec, const std::string& place, Reader reader)
+{
+  // An authenticated section is verified completely before anything reads from it
+  if (codec.authenticated)
   {
-    key.get_salt()[i] = input_stream.get();
+    data::secure_string compressed;
+    decrypt_compressed_section(input_stream, length, key, codec, place, compressed);
+    memory_stream compressed_stream(compressed.data(), compressed.data() + compressed.size());
+
+    if (!codec.compressed)
+    {
+      reader(static_cast<std::istream&>(compressed_stream));
+      return;
+    }
+
+    cryptography::xz_decompress_stream decompress_stream(compressed_stream, codec.threads);
+    reader(static_cast<std::istream&>(decompress_stream));
+    return;
   }
 
-  // Now generate the key
-  key.generate_key(passphrase, iterations);
+  decrypt_section_stream(input_stream, length, key, [&](cryptography::aes_cbc_decrypt_stream& decrypt_stream)
+  {
+    decompress(decrypt_stream, key, codec, reader);
+  });
+}
+
+/// Decrypts the remainder of the input stream, and lets the reader read the plaintext.
+/// Only vaults from before chunks are one section, and those are not authenticated.
+template <typename Reader>
+static void decrypt_remainder(std::istream& input_stream, const cryptography::key& key,
+  const section_codec& codec, Reader reader)
+{
+  detail::memory_streambuffer* memory = dynamic_cast<detail::memory_streambuffer*>(input_stream.rdbuf());
+  if (memory != nullptr)
+  {
+    decrypt_section(input_stream, memory->remaining(), key, codec, std::string(), reader);
+    return;
+  }
 
-  // Create a decryption stream that reads encrypted data
   cryptography::aes_cbc_decrypt_stream decrypt_stream(input_stream, key);
-  // And a decompression stream that decompresses data
-  cryptography::xz_decompress_stream decompress_stream(decrypt_stream);
+  decompress(decrypt_stream, key, codec, reader);
+}
 
-  // Read 16 bytes before the compressed data from the encryption stream.
-  // Those bytes are used to validate that the encryption key is correct.
-  // (16 is the AES block size.)
+/// Writes the 16 bytes that precede the compressed data, which are the first bytes of the salt,
+/// so the key can be validated when decrypting. (16 is the AES block size.)
+static void write_key_check(std::ostream& encrypt_stream, const cryptography::key& key)
+{
   for (size_t i = 0; i < 16; i++)
   {
-    std::uint8_t c = decrypt_stream.get();
-    if (key.get_salt()[i] != c) throw incorrect_key_error("This key cannot correctly decrypt the data.");
+    encrypt_stream.put(key.get_salt()[i]);
+  }
+}
+
+/// Compresses the plaintext of a section; this is the first half of encrypt_section
+static void compress_section(const data::secure_string& plaintext, const section_codec& codec, data::secure_string& compressed)
+{
+  if (!codec.compressed)
+  {
+    compressed = plaintext;
+    return;
+  }
+
+  // A section that fits in one block gains nothing from threads
+  const std::uint32_t threads = codec.block_size != 0 && plaintext.size() <= codec.block_size ? 1 : codec.threads;
+
+  data::secure_stringstream compressed_stream;
+  {
+    cryptography::xz_compress_stream compress_stream(compressed_stream, codec.preset, threads, codec.block_size);
+    compress_stream.write(plaintext.data(), plaintext.size());
+    compress_stream.close();
   }
-  */
+  compressed = compressed_stream.str();
+}
 
-  cryptography::aes_cbc_decrypt_stream* decrypt_stream = nullptr;
-  cryptography::xz_decompress_stream* decompress_stream = nullptr;
+/// Encrypts the compressed plaintext of a section, and returns the ciphertext; this is the second half of encrypt_section.
+/// An authenticated section authenticates its place, which section_place returns.
+static std::string encrypt_compressed_section(const cryptography::key& key, const section_codec& codec,
+  const std::string& place, const data::secure_string& compressed)
+{
+  if (codec.authenticated)
+  {
+    return cryptography::encrypt_authenticated(codec.section_key, compressed.data(), compressed.size(), place, codec.cipher_threads);
+  }
 
-  try
+  std::ostringstream section;
   {
-    // Build streams from which plaintext can be read
-    build_decrypt_stream(input_stream, file_version, key, decrypt_stream, decompress_stream, passphrase);
+    cryptography::aes_cbc_encrypt_stream encrypt_stream(section, key);
+    write_key_check(encrypt_stream, key);
+    encrypt_stream.write(compressed.data(), compressed.size());
+    encrypt_stream.close();
+  }
+  return section.str();
+}
 
-    // Read the obfuscated JSON as follows: file >> AES CBC decrypt >> XZ decompress >> JSON >> deserialise
-    deserialise(*decompress_stream);
+/// Compresses and encrypts what the writer writes, and returns the ciphertext
+template <typename Writer>
+static std::string encrypt_section(const cryptography::key& key, const section_codec& codec, const std::string& place, Writer writer)
+{
+  // An authenticated section is encrypted in one go, because the tags follow the segments they authenticate
+  if (codec.authenticated)
+  {
+    data::secure_stringstream plaintext_stream;
+    writer(static_cast<std::ostream&>(plaintext_stream));
 
-    if (decrypt_stream != nullptr) delete decrypt_stream;
-    if (decompress_stream != nullptr) delete decompress_stream;
+    data::secure_string compressed;
+    compress_section(plaintext_stream.str(), codec, compressed);
+    return encrypt_compressed_section(key, codec, place, compressed);
+  }
+
+  std::ostringstream section;
+
+  // Uncompressed plaintext is written straight to the encryption stream
+  if (!codec.compressed)
+  {
+    cryptography::aes_cbc_encrypt_stream encrypt_stream(section, key);
+    write_key_check(encrypt_stream, key);
+    writer(static_cast<std::ostream&>(encrypt_stream));
+    encrypt_stream.close();
+    return section.str();
   }
-  catch (...)
+
   {
-    // Free resources on exception
-    if (decrypt_stream != nullptr) delete decrypt_stream;
-    if (decompress_stream != nullptr) delete decompress_stream;
+    // This works as follows: plaintext >> XZ compress >> AES CBC encrypt >> section
+    cryptography::aes_cbc_encrypt_stream encrypt_stream(section, key);
+    cryptography::xz_compress_stream compress_stream(encrypt_stream, codec.preset, codec.threads, codec.block_size);
+
+    write_key_check(encrypt_stream, key);
 
-    throw;
+    writer(static_cast<std::ostream&>(compress_stream));
+    compress_stream.close(); // Finalises compression
+    encrypt_stream.close(); // Adds padding for encryption and encrypts the last block
   }
+  return section.str();
 }
 
-void vault::load(const std::string& filename, cryptography::key& key, const data::secure_string& passphrase)
+/// Returns whether the chunks and journal records of vaults of the given version hold binary records, rather than JSON
+static bool has_binary_entries(const version& vault_version)
 {
-  // Open the file
-  std::ifstream file(filename, std::ios::binary);
+  // Version 1.3 replaced JSON
+  return version(1, 3, 0, 0) <= vault_version;
+}
 
-  if (file.good())
+/// Appends the binary records of the entries to the buffer
+static void serialise_entries(data::secure_string& buffer, const data::entry_collection& entries, size_t first, size_t last)
+{
+  serialisation::binary_serialiser serialiser(buffer);
+  for (size_t i = first; i < last; i++)
   {
-    try
+    entries.at(i)->serialise(serialiser);
+  }
+}
+
+/// Writes the binary records of the entries to the plaintext in one go
+static void write_entries(std::ostream& plaintext, const data::entry_collection& entries, size_t first, size_t last)
+{
+  data::secure_string buffer;
+  serialise_entries(buffer, entries, first, last);
+  plaintext.write(buffer.data(), buffer.size());
+}
+
+/// Serialises, compresses and encrypts the chunks, and returns their ciphertexts in order.
+/// The chunk boundaries are the positions of the first entry of every chunk, followed by the number of entries.
+/// Every stage runs on its own thread and hands its buffers to the next stage through a bounded queue,
+/// so a chunk is compressed while the next one is serialised and the previous one is encrypted.
+static std::vector<std::string> encrypt_chunks(const cryptography::key& key, const section_codec& codec,
+  const data::entry_collection& entries, const std::vector<size_t>& boundaries)
+{
+  const size_t number_of_chunks = boundaries.size() - 1;
+  std::vector<std::string> ciphertexts;
+  ciphertexts.reserve(number_of_chunks);
+
+  // A single chunk gains nothing from threads
+  if (number_of_chunks == 1)
+  {
+    data::secure_string plaintext, compressed;
+    serialise_entries(plaintext, entries, boundaries[0], boundaries[1]);
+    compress_section(plaintext, codec, compressed);
+    ciphertexts.push_back(encrypt_compressed_section(key, codec, section_place(codec, section_chunk, 0), compressed));
+    return ciphertexts;
+  }
+
+  // A few chunks in flight per stage are enough to keep every stage busy, while bounding the memory used.
+  // The calling thread collects the ciphertexts; the entries are only read by the serialiser until it is joined.
+  const size_t queue_capacity = 4;
+  run_pipeline<data::secure_string>(queue_capacity,
+    [&](const std::function<bool(data::secure_string&&)>& push)
+    {
+      for (size_t chunk = 0; chunk < number_of_chunks; chunk++)
+      {
+        data::secure_string plaintext;
+        serialise_entries(plaintext, entries, boundaries[chunk], boundaries[chunk + 1]);
+        if (!push(std::move(plaintext))) break;
+      }
+    },
+    [&](data::secure_string& plaintext, data::secure_string& output) { compress_section(plaintext, codec, output); },
+    [&](data::secure_string& input)
+    {
+      ciphertexts.push_back(encrypt_compressed_section(key, codec, section_place(codec, section_chunk, ciphertexts.size()), input));
+    });
+
+  return ciphertexts;
+}
+
+/// Reads the binary records of entries that make up the plaintext
+static void read_entries(const data::secure_string& plaintext, std::vector<data::entry_ptr>& chunk_entries)
+{
+  serialisation::binary_deserialiser deserialiser(plaintext.data(), plaintext.data() + plaintext.size());
+  while (!deserialiser.at_end())
+  {
+    data::entry_ptr chunk_entry = data::make_entry();
+    chunk_entry->deserialise(deserialiser);
+    chunk_entries.push_back(chunk_entry);
+  }
+}
+
+/// Reads the binary records of entries that make up the plaintext, but leaves their passwords encoded
+static void read_entries_lazily(const data::secure_string& plaintext, std::vector<data::entry_ptr>& chunk_entries)
+{
+  serialisation::binary_deserialiser deserialiser(plaintext.data(), plaintext.data() + plaintext.size());
+  while (!deserialiser.at_end())
+  {
+    data::entry_ptr chunk_entry = data::make_entry();
+    chunk_entry->deserialise_lazily(deserialiser);
+    chunk_entries.push_back(chunk_entry);
+  }
+}
+
+/// Reads the entries of a chunk, which is a JSON array before version 1.3, and a sequence of binary records since
+static void read_chunk(std::istream& plaintext, const version& vault_version, std::vector<data::entry_ptr>& chunk_entries)
+{
+  if (has_binary_entries(vault_version))
+  {
+    data::secure_string buffer;
+    read_all(plaintext, buffer);
+    read_entries(buffer, chunk_entries);
+  }
+  else
+  {
+    serialisation::json_value entry_values;
+    plaintext >> entry_values;
+
+    const serialisation::json_value::array_t& entry_array = entry_values;
+    for (size_t i = 0; i < entry_array.size(); i++)
     {
-      load(file, key, passphrase);
+      data::entry_ptr chunk_entry = data::make_entry();
+      chunk_entry->deserialise(entry_array[i]);
+      chunk_entries.push_back(chunk_entry);
     }
-    catch (...)
+  }
+}
+
+/// Decrypts, decompresses and reads the chunks at the current position of the input stream, and adds their entries in order.
+/// Every stage runs on its own thread and hands its buffers to the next stage through a bounded queue,
+/// so a chunk is decompressed while the next one is decrypted and the previous one is read.
+static void decrypt_chunks(std::istream& input_stream, const version& vault_version, const cryptography::key& key,
+  const section_codec& codec, const std::vector<chunk_information>& chunks, data::entry_collection& entries, bool lazy)
+{
+  // Reads the decompressed plaintext of a chunk on the calling thread
+  auto add_entries = [&](data::secure_string& plaintext)
+  {
+    std::vector<data::entry_ptr> chunk_entries;
+    if (has_binary_entries(vault_version) && lazy)
     {
-      file.close();
-      throw;
+      read_entries_lazily(plaintext, chunk_entries);
     }
-    file.close();
+    else if (has_binary_entries(vault_version))
+    {
+      read_entries(plaintext, chunk_entries);
+    }
+    else
+    {
+      memory_stream plaintext_stream(plaintext.data(), plaintext.data() + plaintext.size());
+      read_chunk(plaintext_stream, vault_version, chunk_entries);
+    }
+
+    for (auto e = chunk_entries.begin(); e != chunk_entries.end(); e++)
+    {
+      entries.push_back(*e);
+    }
+  };
+
+  // A single chunk gains nothing from threads
+  if (chunks.size() <= 1)
+  {
+    for (auto c = chunks.begin(); c != chunks.end(); c++)
+    {
+      data::secure_string plaintext;
+      decrypt_section(input_stream, c->length, key, codec, section_place(codec, section_chunk, c - chunks.begin()),
+        [&](std::istream& plaintext_stream) { read_all(plaintext_stream, plaintext); });
+      add_entries(plaintext);
+    }
+    return;
   }
-  else
+
+  // A few chunks in flight per stage are enough to keep every stage busy, while bounding the memory used.
+  // Only the decryptor touches the input stream until it is joined, and the calling thread reads the entries,
+  // because it owns the collection.
+  const size_t queue_capacity = 4;
+  run_pipeline<data::secure_string>(queue_capacity,
+    [&](const std::function<bool(data::secure_string&&)>& push)
+    {
+      for (auto c = chunks.begin(); c != chunks.end(); c++)
+      {
+        data::secure_string output;
+        const std::string place = section_place(codec, section_chunk, c - chunks.begin());
+        decrypt_compressed_section(input_stream, c->length, key, codec, place, output);
+        if (!push(std::move(output))) break;
+      }
+    },
+    [&](data::secure_string& input, data::secure_string& output)
+    {
+      if (codec.compressed)
+      {
+        memory_stream compressed_stream(input.data(), input.data() + input.size());
+        cryptography::xz_decompress_stream decompress_stream(compressed_stream, codec.threads);
+        read_all(decompress_stream, output);
+      }
+      else
+      {
+        output.swap(input);
+      }
+    },
+    add_entries);
+}
+
+/// Reads the chunk directory of a chunked vault, which lists the chunks.
+/// If ids is not null, an entry with only an identifier is added to it for every entry in the vault.
+/// Returns the number of bytes that the directory and the chunks take.
+static size_t read_directory(std::istream& input_stream, const cryptography::key& key, const section_codec& codec,
+  std::vector<chunk_information>& chunks, data::entry_collection* ids)
+{
+  const std::uint32_t length = read_integer(input_stream);
+
+  decrypt_section(input_stream, length, key, codec, section_place(codec, section_directory, 0), [&](std::istream& plaintext)
   {
-    file.close();
-    throw std::runtime_error("Could not open file.");
+    // Before version 1.5 the counts are not authenticated, and the length of the decompressed plaintext is not known,
+    // so nothing is allocated for a count until the data it counts has been read
+    const std::uint32_t number_of_chunks = read_integer(plaintext);
+    chunks.clear();
+    for (std::uint32_t c = 0; c < number_of_chunks; c++)
+    {
+      chunk_information chunk;
+      chunk.number_of_entries = read_integer(plaintext);
+      chunk.length = read_integer(plaintext);
+      chunks.push_back(chunk);
+    }
+
+    // The identifiers come last, so they need not be decompressed if they are not needed
+    if (ids == nullptr) return;
+
+    data::secure_string id;
+    for (auto c = chunks.begin(); c != chunks.end(); c++)
+    {
+      for (std::uint32_t i = 0; i < c->number_of_entries; i++)
+      {
+        // The identifier grows as it is read, so a damaged length runs into the end of the directory instead
+        const std::uint32_t id_length = read_integer(plaintext);
+        id.clear();
+        while (id.size() < id_length)
+        {
+          const size_t offset = id.size();
+          id.resize(offset + std::min<size_t>(id_length - offset, 4096));
+          if (!plaintext.read(&id[offset], id.size() - offset)) throw format_error("The chunk directory ended unexpectedly.");
+        }
+
+        data::entry_ptr id_entry = data::make_entry();
+        id_entry->set_id(id);
+        ids->push_back(id_entry);
+      }
+    }
+  });
+
+  size_t size = 4 + length;
+  for (auto c = chunks.begin(); c != chunks.end(); c++)
+  {
+    size += c->length;
   }
+  return size;
 }
 
-void vault::save(std::ostream& output_stream, const cryptography::key& key)
+/// Encrypts the record with the given number for the journal, which holds the entry at the given position and the position
+static std::string encrypt_record(const cryptography::key& key, const section_codec& codec,
+  const data::entry_collection& entries, size_t position, size_t number)
+{
+  const std::string record = encrypt_section(key, codec, section_place(codec, section_record, number), [&](std::ostream& plaintext)
+  {
+    write_integer(plaintext, static_cast<std::uint32_t>(position));
+    write_entries(plaintext, entries, position, position + 1);
+  });
+
+  // Prefix the length, like the directory, and since version 1.5 its complement, so a damaged length can be told apart
+  // from a record that was cut off
+  std::ostringstream length;
+  write_integer(length, static_cast<std::uint32_t>(record.size()));
+  if (codec.authenticated) write_integer(length, ~static_cast<std::uint32_t>(record.size()));
+  return length.str() + record;
+}
+
+/// Returns the number of bytes of the length that precedes a journal record
+static size_t record_header_size(const section_codec& codec)
+{
+  return codec.authenticated ? 8 : 4;
+}
+
+/// Reads the record with the given number of the journal at the current position of the input stream,
+/// which holds an entry and its position in the vault.
+/// Returns the number of bytes that the record takes.
+static size_t read_record(std::istream& input_stream, const version& vault_version, const cryptography::key& key,
+  const section_codec& codec, size_t number, size_t& position, data::entry_ptr& record_entry)
+{
+  // has_complete_record validated the complement of the length
+  const std::uint32_t length = read_integer(input_stream);
+  if (codec.authenticated) read_integer(input_stream);
+
+  decrypt_section(input_stream, length, key, codec, section_place(codec, section_record, number), [&](std::istream& plaintext)
+  {
+    position = read_integer(plaintext);
+    record_entry = data::make_entry();
+
+    // The entry is stored like the entries of a chunk
+    if (has_binary_entries(vault_version))
+    {
+      data::secure_string buffer;
+      read_all(plaintext, buffer);
+
+      serialisation::binary_deserialiser deserialiser(buffer.data(), buffer.data() + buffer.size());
+      record_entry->deserialise(deserialiser);
+    }
+    else
+    {
+      serialisation::json_value entry_value;
+      plaintext >> entry_value;
+      record_entry->deserialise(entry_value);
+    }
+  });
+
+  return record_header_size(codec) + length;
+}
+
+/// Returns the position of the end of the stream, and leaves the read position where it was
+static std::streamoff get_end(std::istream& input_stream)
+{
+  const std::streamoff position = input_stream.tellg();
+  input_stream.seekg(0, std::ios::end);
+  const std::streamoff end = input_stream.tellg();
+  input_stream.seekg(position);
+  return end;
+}
+
+/// Returns whether a complete journal record follows at the current position of the input stream, which ends at end.
+/// A record that was cut off because the process died or the disk filled up while it was appended is not complete.
+/// The records before it are intact, so it is ignored rather than making the whole vault unreadable.
+/// A record whose length is damaged would hide the records after it, so a format_error is thrown instead
+/// unless the record can only have been cut off.
+static bool has_complete_record(std::istream& input_stream, const section_codec& codec, std::streamoff end)
 {
+  // Bytes too few for a length cannot hold a record either
+  const std::streamoff position = input_stream.tellg();
+  const std::streamoff header_size = static_cast<std::streamoff>(record_header_size(codec));
+  if (end - position < header_size) return false;
+
+  const std::uint32_t length = read_integer(input_stream);
+  const bool checked = codec.authenticated;
+  if (checked && read_integer(input_stream) != static_cast<std::uint32_t>(~length))
+  {
+    throw format_error("The length of a record in the journal is damaged.");
+  }
+  input_stream.seekg(position);
+
+  const std::streamoff remaining = end - position - header_size;
+  if (length <= remaining) return true;
+
+  // A length that matches its complement was written in full, so the record was cut off while it was appended.
+  // A length without one is only trusted if the rest of the file is too short to hold another record:
+  // a CBC section holds at least the IV, the key check and a block of padding.
+  const std::streamoff smallest_record = 4 + 3 * 16;
+  if (checked || remaining < smallest_record) return false;
+  throw format_error("A record in the journal is longer than the rest of the vault.");
+}
+
+/// Puts an entry from the journal at its position in the collection, which either replaces an entry or adds one
+static void apply_record(data::entry_collection& entries, size_t position, data::entry_ptr record_entry)
+{
+  if (position < entries.size()) entries.replace(position, record_entry);
+  else if (position == entries.size()) entries.push_back(record_entry);
+  else throw format_error("The journal refers to an entry that does not exist.");
+}
+
+bool vault::is_chunked(const version& vault_version)
+{
+  // Version 1.2 introduced chunks
+  return version(1, 2, 0, 0) <= vault_version;
+}
+
+version vault::read_version(std::istream& input_stream)
+{
+  // Validate the header
+  char d = 0, l = 0, k = 0, zero = 1;
+  input_stream >> d; input_stream >> l; input_stream >> k; input_stream >> zero;
+  if (d != 'D' || l != 'L' || k != 'K' || zero != 0)
+  {
+    throw format_error("The file is not a valid Deadlock vault; the header is incorrect.");
+  }
+
+  // Now read the version
+  version vault_version;
+  vault_version.major = input_stream.get(); vault_version.minor = input_stream.get();
+  vault_version.revision = input_stream.get(); vault_version.build = input_stream.get();
+
+  return vault_version;
+}
+
+void vault::read_key_parameters(const std::string& filename, std::uint8_t* salt, std::uint32_t& iterations)
+{
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.good()) throw std::runtime_error("Could not open file.");
+
+  // The iterations and the salt follow the version
+  read_version(file);
+  iterations = read_integer(file);
+  if (!file.read(reinterpret_cast<char*>(salt), cryptography::key::salt_size))
+  {
+    throw format_error("The vault ended unexpectedly.");
+  }
+}
+
+/// Returns whether the header of vaults of the given version holds the compression profile
+static bool has_compression_profile(const version& vault_version)
+{
+  // Version 1.4 introduced compression profiles; before, everything was compressed with XZ preset 6
+  return version(1, 4, 0, 0) <= vault_version;
+}
+
+void vault::read_header(std::istream& input_stream, version& vault_version, compression_profile& profile,
+  cryptography::key& key, const data::secure_string* passphrase, std::string& header)
+{
+  vault_version = read_version(input_stream);
+
+  // Older versions can be read, because load checks the version.
+  // Forward compatibility is not assumed, reading a newer version is an error.
+  version application_version = assembly_information::get_version();
+  if (application_version < vault_version)
+  {
+    throw version_error("The file was created with a newer version of the application.");
+  }
+
+  // Read the number of PBKDF2 iterations (stored as a big-endian 32-bit integer)
+  std::uint32_t iterations = read_integer(input_stream);
+
+  // Followed by the 32 bytes of salt that were used to generate the key
+  std::uint8_t salt[cryptography::key::salt_size];
+  if (!input_stream.read(reinterpret_cast<char*>(salt), sizeof(salt)))
+  {
+    throw format_error("The vault ended unexpectedly.");
+  }
+
+  // Followed by one byte for the compression profile
+  profile = compression_default;
+  if (has_compression_profile(vault_version))
+  {
+    const int profile_byte = input_stream.get();
+    if (profile_byte < compression_none || profile_byte > compression_extreme)
+    {
+      throw format_error("The vault uses an unknown compression profile.");
+    }
+    profile = static_cast<compression_profile>(profile_byte);
+  }
+
+  // Followed by a value derived from the key, which tells whether the passphrase is correct
+  std::uint8_t stored_check_value[cryptography::key::check_value_size];
+  if (has_authenticated_sections(vault_version)
+    && !input_stream.read(reinterpret_cast<char*>(stored_check_value), sizeof(stored_check_value)))
+  {
+    throw format_error("The vault ended unexpectedly.");
+  }
+
+  // Followed by the salt of the save
+  std::uint8_t save_salt[save_salt_size];
+  if (has_authenticated_sections(vault_version)
+    && !input_stream.read(reinterpret_cast<char*>(save_salt), sizeof(save_salt)))
+  {
+    throw format_error("The vault ended unexpectedly.");
+  }
+
+  // Now generate the key, unless it was derived before
+  if (passphrase != nullptr)
+  {
+    std::copy(salt, salt + sizeof(salt), key.get_salt());
+    key.generate_key(*passphrase, iterations);
+  }
+  else if (!key.is_derived_from(salt, iterations))
+  {
+    throw incorrect_key_error("The key was not derived for this vault.");
+  }
+
+  // Authenticated sections cannot tell an incorrect key from a changed section, so the key is checked here
+  if (has_authenticated_sections(vault_version))
+  {
+    std::uint8_t check_value[cryptography::key::check_value_size];
+    key.get_check_value(check_value);
+    if (!std::equal(check_value, check_value + sizeof(check_value), stored_check_value))
+    {
+      throw incorrect_key_error("This key cannot correctly decrypt the data.");
+    }
+  }
+
+  // The key matches the header, so the header can be made again from it
+  header.clear();
+  if (has_authenticated_sections(vault_version)) header = make_header(vault_version, profile, key, save_salt);
+}
+
+std::string vault::make_header(const version& header_version, compression_profile profile, const cryptography::key& key,
+  const std::uint8_t* save_salt)
+{
+  std::ostringstream output_stream;
+
   // First, write the header structure
   // In this case, it is "DLK\0", followed by four bytes for the version
   // The version is written to allow future extensions / reading legacy formats
   output_stream.put('D'); output_stream.put('L'); output_stream.put('K'); output_stream.put(0);
-  version file_version = assembly_information::get_version();
   // Write the version bytes independently to avoid endianness issues
-  output_stream.put(file_version.major); output_stream.put(file_version.minor);
-  output_stream.put(file_version.revision); output_stream.put(file_version.build);
+  output_stream.put(header_version.major); output_stream.put(header_version.minor);
+  output_stream.put(header_version.revision); output_stream.put(header_version.build);
 
   // Now for the current version, write the number of PBKDF2 iterations (as a big-endian 32-bit integer)
-  std::uint32_t iterations = key.get_iterations();
-  iterations = internal_to_portable(iterations);
-  output_stream.write(reinterpret_cast<char*>(&iterations), 4);
+  write_integer(output_stream, key.get_iterations());
 
   // Followed by the 32 bytes of salt that were used to generate the key
   for (size_t i = 0; i < key.salt_size; i++)
@@ -348,23 +1078,286 @@ void vault::save(std::ostream& output_stream, const cryptography::key& key)
     output_stream.put(key.get_salt()[i]);
   }
 
-  // Create an encryption stream that saves data encrypted
-  cryptography::aes_cbc_encrypt_stream encrypt_stream(output_stream, key);
-  // And a compression stream that compresses data
-  cryptography::xz_compress_stream compress_stream(encrypt_stream, 6);
+  // Followed by one byte for the compression profile
+  output_stream.put(static_cast<char>(profile));
 
-  // Write 16 bytes before the compressed data to the encryption stream.
-  // Those bytes will be used to validate that the encryption key is correct.
-  // (16 is the AES block size.)
-  for (size_t i = 0; i < 16; i++)
+  // Followed by the value that tells whether a key is correct
+  std::uint8_t check_value[cryptography::key::check_value_size];
+  key.get_check_value(check_value);
+  output_stream.write(reinterpret_cast<const char*>(check_value), sizeof(check_value));
+
+  // Followed by the salt of the save
+  output_stream.write(reinterpret_cast<const char*>(save_salt), save_salt_size);
+
+  return output_stream.str();
+}
+
+void vault::build_decrypt_stream(std::istream& input_stream, version& vault_version, cryptography::key& key,
+  cryptography::aes_cbc_decrypt_stream*& decrypt_stream,
+  cryptography::xz_decompress_stream*& decompress_stream,
+  const data::secure_string& passphrase)
+{
+  compression_profile profile;
+  std::string header;
+  read_header(input_stream, vault_version, profile, key, &passphrase, header);
+
+  if (is_chunked(vault_version))
   {
-    encrypt_stream.put(key.get_salt()[i]);
+    throw format_error("The vault is divided into chunks, which cannot be read as one stream.");
   }
 
-  // Write the JSON as follows: JSON >> XZ compress >> AES CBC encrypt >> file
-  serialise(compress_stream, false, false);
-  compress_stream.close(); // Finalises compression
-  encrypt_stream.close(); // Adds padding for encryption and encrypts the last block
+  // Create a decryption stream that reads encrypted data
+  decrypt_stream = new cryptography::aes_cbc_decrypt_stream(input_stream, key);
+  // And a decompression stream that decompresses data
+  decompress_stream = new cryptography::xz_decompress_stream(*decrypt_stream);
+
+  // Validate that the key is correct
+  check_key(*decrypt_stream, key);
+
+  // Finally, the streams can be used.
+  // This works as follows: file or other stream >> AES CBC decrypt >> XZ decompress >> JSON plaintext
+}
+
+void vault::load(std::istream& input_stream, cryptography::key& key, const data::secure_string& passphrase)
+{
+  read(input_stream, key, &passphrase);
+}
+
+void vault::read(std::istream& input_stream, cryptography::key& key, const data::secure_string* passphrase)
+{
+  read_header(input_stream, file_version, file_compression, key, passphrase, file_header);
+  base_size = 0;
+  journal_size = 0;
+  journal_records = 0;
+  journal_torn = false;
+
+  // The vault is saved the way it was, until the profile is changed
+  compression = file_compression;
+  section_codec codec = make_codec(file_version, file_compression, get_xz_threads(), compression_block_size);
+  use_save(codec, key, file_header);
+
+  // Older vaults are one stream: file >> AES CBC decrypt >> XZ decompress >> JSON >> deserialise
+  if (!is_chunked(file_version))
+  {
+    decrypt_remainder(input_stream, key, codec, [this](std::istream& plaintext) { deserialise(plaintext); });
+    stored_entries = entries.size();
+    return;
+  }
+
+  // Positions in the journal are relative to the first entry of the file
+  const size_t first_position = entries.size();
+
+  // Otherwise, the chunk directory is followed by the chunks, which are read in order
+  std::vector<chunk_information> chunks;
+  base_size = read_directory(input_stream, key, codec, chunks, nullptr);
+
+  decrypt_chunks(input_stream, file_version, key, codec, chunks, entries, lazy_loading);
+
+  // The journal of changes that were made since the chunks were written follows the chunks
+  const std::streamoff end = get_end(input_stream);
+  while (has_complete_record(input_stream, codec, end))
+  {
+    size_t position;
+    data::entry_ptr record_entry;
+    journal_size += read_record(input_stream, file_version, key, codec, journal_records, position, record_entry);
+    apply_record(entries, first_position + position, record_entry);
+    journal_records++;
+  }
+  journal_torn = input_stream.tellg() != end;
+
+  stored_entries = entries.size() - first_position;
+}
+
+void vault::load(const std::string& filename, cryptography::key& key, const data::secure_string& passphrase)
+{
+  // Map the file, so the ciphertext can be decrypted without copying it
+  mapped_file file(filename);
+  memory_stream file_stream(file.data(), file.data() + file.size());
+
+  read(file_stream, key, &passphrase);
+}
+
+void vault::load(const std::string& filename, cryptography::key& derived_key)
+{
+  mapped_file file(filename);
+  memory_stream file_stream(file.data(), file.data() + file.size());
+
+  read(file_stream, derived_key, nullptr);
+}
+
+data::entry_ptr vault::load_match(std::istream& input_stream, cryptography::key& key, const data::secure_string& passphrase,
+  const search& algorithm, const data::secure_string& query)
+{
+  return read_match(input_stream, key, &passphrase, algorithm, query);
+}
+
+data::entry_ptr vault::read_match(std::istream& input_stream, cryptography::key& key, const data::secure_string* passphrase,
+  const search& algorithm, const data::secure_string& query)
+{
+  read_header(input_stream, file_version, file_compression, key, passphrase, file_header);
+  compression = file_compression;
+  section_codec codec = make_codec(file_version, file_compression, get_xz_threads(), compression_block_size);
+  use_save(codec, key, file_header);
+
+  // Older vaults must be read completely
+  if (!is_chunked(file_version))
+  {
+    vault complete_vault;
+    decrypt_remainder(input_stream, key, codec, [&complete_vault](std::istream& plaintext) { complete_vault.deserialise(plaintext); });
+    return algorithm.find_match(query, complete_vault.entries);
+  }
+
+  // The identifiers in the directory are enough to find the best match
+  std::vector<chunk_information> chunks;
+  data::entry_collection ids;
+  read_directory(input_stream, key, codec, chunks, &ids);
+  std::streamoff offset = input_stream.tellg();
+
+  // The entries in the journal take the place of those in the chunks, so the journal must be read completely
+  std::streamoff journal_offset = offset;
+  for (auto c = chunks.begin(); c != chunks.end(); c++)
+  {
+    journal_offset += c->length;
+  }
+  input_stream.seekg(journal_offset);
+
+  std::vector<bool> in_journal(ids.size(), false);
+  const std::streamoff end = get_end(input_stream);
+  for (size_t number = 0; has_complete_record(input_stream, codec, end); number++)
+  {
+    size_t position;
+    data::entry_ptr record_entry;
+    read_record(input_stream, file_version, key, codec, number, position, record_entry);
+    apply_record(ids, position, record_entry);
+
+    in_journal.resize(ids.size(), false);
+    in_journal[position] = true;
+  }
+
+  data::entry_ptr best_match = algorithm.find_match(query, ids);
+  if (best_match == nullptr) return nullptr;
+
+  // An entry from the journal is complete already
+  size_t position = std::find(ids.begin(), ids.end(), best_match) - ids.begin();
+  if (in_journal[position]) return best_match;
+
+  // Find the chunk that contains the entry, and skip the chunks before it
+  auto c = chunks.begin();
+  while (position >= c->number_of_entries)
+  {
+    position -= c->number_of_entries;
+    offset += c->length;
+    c++;
+  }
+  input_stream.seekg(offset);
+
+  // Decrypt only that chunk
+  std::vector<data::entry_ptr> chunk_entries;
+  decrypt_section(input_stream, c->length, key, codec, section_place(codec, section_chunk, c - chunks.begin()),
+    [&](std::istream& plaintext) { read_chunk(plaintext, file_version, chunk_entries); });
+
+  if (position >= chunk_entries.size()) throw format_error("The chunk directory does not match the chunks.");
+  return chunk_entries[position];
+}
+
+data::entry_ptr vault::load_match(const std::string& filename, cryptography::key& key, const data::secure_string& passphrase,
+  const search& algorithm, const data::secure_string& query)
+{
+  // Map the file, so the ciphertext can be decrypted without copying it, and unused chunks are never read
+  mapped_file file(filename);
+  memory_stream file_stream(file.data(), file.data() + file.size());
+
+  return read_match(file_stream, key, &passphrase, algorithm, query);
+}
+
+data::entry_ptr vault::load_match(const std::string& filename, cryptography::key& derived_key,
+  const search& algorithm, const data::secure_string& query)
+{
+  mapped_file file(filename);
+  memory_stream file_stream(file.data(), file.data() + file.size());
+
+  return read_match(file_stream, derived_key, nullptr, algorithm, query);
+}
+
+void vault::save(std::ostream& output_stream, const cryptography::key& key)
+{
+  // Every save has a salt of its own, so it encrypts its sections with a key of its own
+  std::uint8_t save_salt[save_salt_size];
+  cryptography::get_random_bytes(save_salt, sizeof(save_salt));
+  const std::string header = make_header(assembly_information::get_version(), compression, key, save_salt);
+  output_stream.write(header.data(), header.size());
+
+  section_codec codec = make_codec(assembly_information::get_version(), compression, get_xz_threads(), compression_block_size);
+  use_save(codec, key, header);
+
+  // Divide the entries into chunks of roughly chunk_size bytes, which are compressed and encrypted independently
+  std::vector<size_t> boundaries(1, 0);
+  for (size_t first = 0; first < entries.size();)
+  {
+    size_t last = first;
+    size_t size = 0;
+    do
+    {
+      size += approximate_size(*entries.at(last));
+      last++;
+    }
+    while (last < entries.size() && size < chunk_size);
+
+    boundaries.push_back(last);
+    first = last;
+  }
+
+  // Every chunk is a sequence of binary entry records.
+  // The chunks are kept in memory until the directory, which must precede them, is written.
+  const std::vector<std::string> chunk_ciphertexts = entries.size() == 0 ? std::vector<std::string>()
+    : encrypt_chunks(key, codec, entries, boundaries);
+
+  std::vector<chunk_information> chunks;
+  for (size_t i = 0; i < chunk_ciphertexts.size(); i++)
+  {
+    chunk_information chunk;
+    chunk.number_of_entries = static_cast<std::uint32_t>(boundaries[i + 1] - boundaries[i]);
+    chunk.length = static_cast<std::uint32_t>(chunk_ciphertexts[i].size());
+    chunks.push_back(chunk);
+  }
+
+  // The directory lists the chunks, followed by the identifiers of all entries,
+  // so an entry can be found by decrypting only the directory and its chunk
+  const std::string directory = encrypt_section(key, codec, section_place(codec, section_directory, 0), [&](std::ostream& plaintext)
+  {
+    write_integer(plaintext, static_cast<std::uint32_t>(chunks.size()));
+    for (auto c = chunks.begin(); c != chunks.end(); c++)
+    {
+      write_integer(plaintext, c->number_of_entries);
+      write_integer(plaintext, c->length);
+    }
+
+    for (auto e = entries.begin(); e != entries.end(); e++)
+    {
+      const data::secure_string& id = (*e)->get_id();
+      write_integer(plaintext, static_cast<std::uint32_t>(id.size()));
+      plaintext.write(id.data(), id.size());
+    }
+  });
+
+  write_integer(output_stream, static_cast<std::uint32_t>(directory.size()));
+  output_stream.write(directory.data(), directory.size());
+
+  base_size = 4 + directory.size();
+  for (auto c = chunk_ciphertexts.begin(); c != chunk_ciphertexts.end(); c++)
+  {
+    output_stream.write(c->data(), c->size());
+    base_size += c->size();
+  }
+
+  // The file now holds all entries, and no journal
+  file_version = assembly_information::get_version();
+  file_header = header;
+  file_compression = compression;
+  stored_entries = entries.size();
+  journal_size = 0;
+  journal_records = 0;
+  journal_torn = false;
 }
 
 void vault::save(const std::string& filename, const cryptography::key& key)
@@ -391,3 +1384,60 @@ void vault::save(const std::string& filename, const cryptography::key& key)
     throw std::runtime_error("Could not open file for writing.");
   }
 }
+
+void vault::save_entry(const std::string& filename, const cryptography::key& key, const data::entry_ptr& changed_entry)
+{
+  const size_t position = std::find(entries.begin(), entries.end(), changed_entry) - entries.begin();
+  if (position == entries.size())
+  {
+    throw std::invalid_argument("The entry is not part of the vault.");
+  }
+
+  // The journal must be in the format of the rest of the file, so vaults of older versions are rewritten,
+  // and so are vaults whose compression profile was changed, and files that end in a record that was cut off
+  if (file_version < assembly_information::get_version() || file_compression != compression || journal_torn)
+  {
+    save(filename, key);
+    return;
+  }
+
+  // The records are encrypted with the key of the save that wrote the file
+  section_codec codec = make_codec(file_version, file_compression, get_xz_threads(), compression_block_size);
+  use_save(codec, key, file_header);
+
+  // An entry that was added can only be written after the entries that were added before it.
+  // The records are numbered on from those in the file.
+  std::string records;
+  size_t number = journal_records;
+  for (size_t i = std::min(position, stored_entries); i <= position; i++)
+  {
+    records += encrypt_record(key, codec, entries, i, number++);
+  }
+
+  // Fold the journal into the vault once it takes a fair share of the file, because loading must replay it.
+  // A small vault is allowed a journal of one chunk, otherwise it would be rewritten all the time.
+  const size_t journal_limit = base_size / 4 > chunk_size ? base_size / 4 : chunk_size;
+  if (journal_size + records.size() > journal_limit)
+  {
+    save(filename, key);
+    return;
+  }
+
+  // Append the records to the file
+  std::ofstream file(filename, std::ios::binary | std::ios::app);
+  if (!file.good())
+  {
+    throw std::runtime_error("Could not open file for writing.");
+  }
+
+  file.write(records.data(), records.size());
+  file.close();
+  if (file.fail())
+  {
+    throw std::runtime_error("Could not write to file.");
+  }
+
+  journal_size += records.size();
+  journal_records = number;
+  stored_entries = std::max(stored_entries, position + 1);
+}
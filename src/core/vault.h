@@ -17,13 +17,17 @@
 #ifndef _DEADLOCK_CORE_VAULT_H_
 #define _DEADLOCK_CORE_VAULT_H_
 
+#include <algorithm>
+#include <cstdint>
 #include <istream>
 #include <ostream>
+#include <string>
 
 #include <boost/iterator/indirect_iterator.hpp>
 
 #include "version.h"
 #include "circular_buffer.h"
+#include "search.h"
 #include "data/entry_collection.h"
 #include "serialisation/deserialiser.h"
 #include "serialisation/serialiser.h"
@@ -40,6 +44,18 @@ namespace deadlock
     /// properties, and can be written and loaded.
     class vault
     {
+    public:
+
+      /// How strongly the sections of a file are compressed. The profile is stored in the header of the file,
+      /// so loading picks the matching decompression, and saving keeps the profile unless it is changed.
+      enum compression_profile
+      {
+        compression_none,    ///< Not compressed at all, which is fastest for small vaults that are written often
+        compression_fast,    ///< XZ preset 1
+        compression_default, ///< XZ preset 6, which is what vaults before version 1.4 use
+        compression_extreme  ///< XZ preset 9 with the extreme flag, which is slowest and smallest
+      };
+
     protected:
 
       /// The version of the loaded file (if the vault was loaded from a file)
@@ -48,15 +64,51 @@ namespace deadlock
       /// The collection of entries that the vault stores
       data::entry_collection entries;
 
-      /// Reconstructs the vault given the JSON data
-      void deserialise(const serialisation::json_value::object_t& json_data);
+      /// The number of entries in the file that the vault was loaded from or saved to, including those in its journal
+      size_t stored_entries;
+
+      /// The number of bytes of the chunk directory and the chunks in the file
+      size_t base_size;
+
+      /// The number of bytes of the journal in the file, which records the changes since the chunks were written
+      size_t journal_size;
+
+      /// The number of records in the journal in the file, which is also the number of the next record.
+      /// Every record authenticates its number, so records cannot be reordered or replayed.
+      size_t journal_records;
+
+      /// The header of the file that the vault was loaded from or saved to last, if its sections are authenticated.
+      /// It ends in the salt of the save, from which the key of the sections of the file is derived.
+      std::string file_header;
+
+      /// Whether the file ends in a journal record that was cut off while it was appended.
+      /// Appending after it would make the records that follow unreadable, so the next save_entry rewrites the file.
+      bool journal_torn;
+
+      /// The compression profile that the vault is saved with
+      compression_profile compression;
+
+      /// The compression profile of the file that the vault was loaded from or saved to last
+      compression_profile file_compression;
+
+      /// The number of threads that XZ may use to compress or decompress one section of the file
+      size_t compression_threads;
+
+      /// The number of bytes of plaintext that XZ compresses as one block when it uses more than one thread
+      size_t compression_block_size;
+
+      /// Whether load leaves the passwords of entries encoded until they are needed
+      bool lazy_loading;
+
+      /// Returns the number of threads that XZ may use, in the form that XZ takes
+      inline std::uint32_t get_xz_threads() const { return static_cast<std::uint32_t>(compression_threads); }
 
       /// Writes the vault to the serialiser
       /// If obfuscation is false, it will write data as-is.
       /// Otherwise, it will write the data as hexadecimal strings.
       void serialise(serialisation::serialiser& serialiser, bool obfuscation);
 
-      /// Reads the password collection from a stream of JSON
+      /// Reads the password collection from a stream of JSON, adding every entry as soon as it has been read
       void deserialise(std::istream& json_stream);
 
       /// This exports the most recent version of the Deadlock JSON structure.
@@ -64,8 +116,38 @@ namespace deadlock
       /// Otherwise, it will write the data as hexadecimal strings.
       void serialise(std::ostream& json_stream, bool obfuscation, bool human_readable);
 
+      /// Reads the header of a vault up to the encrypted data, and generates the key.
+      /// This puts the version of the vault in vault_version, and its compression profile in profile.
+      /// If passphrase is null, the key is not generated, but it must have been derived from the salt and iterations of the vault.
+      /// If the header holds a key check value, an incorrect_key_error is thrown when the key does not match it.
+      /// If the sections of the vault are authenticated, the header is put in header, and otherwise header is cleared.
+      static void read_header(std::istream& input_stream, version& vault_version, compression_profile& profile,
+        cryptography::key& key, const data::secure_string* passphrase, std::string& header);
+
+      /// Loads an encrypted binary vault from a stream, and derives the key from the passphrase,
+      /// or uses the key as it is if passphrase is null.
+      void read(std::istream& input_stream, cryptography::key& key, const data::secure_string* passphrase);
+
+      /// Loads only the entry whose identifier best matches the query from an encrypted binary vault stream,
+      /// and derives the key from the passphrase, or uses the key as it is if passphrase is null.
+      data::entry_ptr read_match(std::istream& input_stream, cryptography::key& key, const data::secure_string* passphrase,
+        const search& algorithm, const data::secure_string& query);
+
+      /// Returns the header of a vault of the given version, up to the encrypted data, in the layout of version 1.5 and later,
+      /// which ends in the salt of the save
+      static std::string make_header(const version& header_version, compression_profile profile, const cryptography::key& key,
+        const std::uint8_t* save_salt);
+
     public:
 
+      /// The approximate number of bytes of entry data that are compressed and encrypted together.
+      /// A single entry can be read by decrypting only the chunk that contains it.
+      static const size_t chunk_size = 64 * 1024;
+
+      /// The number of random bytes in the header from which the key of the sections of one save is derived,
+      /// so every save encrypts its sections with a key of its own
+      static const size_t save_salt_size = 16;
+
       typedef boost::indirect_iterator<data::entry_collection::entry_iterator> entry_iterator;
       typedef boost::indirect_iterator<data::entry_collection::const_entry_iterator> const_entry_iterator;
 
@@ -75,9 +157,46 @@ namespace deadlock
       /// Returns the file version
       inline const version& get_version() const { return file_version; }
 
+      /// Returns the compression profile that the vault is saved with; after loading, this is the profile of the file
+      inline compression_profile get_compression_profile() const { return compression; }
+
+      /// Sets the compression profile that the vault is saved with.
+      /// The next save_entry rewrites the file completely, because the journal must be compressed like the file.
+      inline void set_compression_profile(compression_profile profile) { compression = profile; }
+
+      /// Returns the number of threads that XZ may use to compress or decompress one section of the file
+      inline size_t get_compression_threads() const { return compression_threads; }
+
+      /// Sets the number of threads that XZ may use to compress or decompress one section of the file.
+      /// With more than one thread, sections larger than the block size are compressed as several independent blocks,
+      /// which XZ compresses and decompresses in parallel. The file can still be read with a single thread.
+      /// Chunks are at most about chunk_size bytes, so mostly the chunk directory of a large vault benefits.
+      inline void set_compression_threads(size_t threads) { compression_threads = std::max<size_t>(1, threads); }
+
+      /// Returns the number of bytes of plaintext that XZ compresses as one block when it uses more than one thread
+      inline size_t get_compression_block_size() const { return compression_block_size; }
+
+      /// Sets the number of bytes of plaintext that XZ compresses as one block when it uses more than one thread.
+      /// Smaller blocks give more parallelism, but compress worse. 0 lets XZ choose, which is several megabytes.
+      inline void set_compression_block_size(size_t block_size) { compression_block_size = block_size; }
+
+      /// Returns whether load leaves the passwords of entries encoded until they are needed
+      inline bool get_lazy_loading() const { return lazy_loading; }
+
+      /// Sets whether load leaves the passwords of entries encoded until they are needed.
+      /// This makes loading faster for commands that only search the vault, or read a few entries.
+      /// Every entry keeps a copy of its own encoded passwords in secure memory until it decodes them,
+      /// and the plaintext of a chunk is released as soon as its entries are read.
+      /// The passwords of an entry must not be read by several threads at once.
+      /// Vaults before version 1.3 are always loaded completely.
+      inline void set_lazy_loading(bool lazy) { lazy_loading = lazy; }
+
       /// Adds a new entry to the collection
       void add_entry(data::entry_ptr new_entry);
 
+      /// Returns the collection of entries, which can be searched efficiently
+      inline const data::entry_collection& get_entries() const { return entries; }
+
       /// Returns an iterator to the first entry
       inline entry_iterator begin() { return entries.begin(); }
 
@@ -114,20 +233,67 @@ namespace deadlock
       /// Saves the vault encrypted to a binary stream
       void save(std::ostream& output_stream, const cryptography::key& key);
 
+      /// Writes an entry of the vault that was added or changed to the file,
+      /// by appending it to the journal of the file instead of rewriting the file.
+      /// The file must be the file that the vault was loaded from or saved to last, with the same key.
+      /// Entries that were added before the entry and not written yet are written too.
+      /// When the journal grows too large, or the file has no journal, the file is saved completely instead.
+      void save_entry(const std::string& filename, const cryptography::key& key, const data::entry_ptr& changed_entry);
+
       /// Loads an encrypted binary vault from a file.
       /// This also generates the correct key.
       void load(const std::string& filename, cryptography::key& key, const data::secure_string& passphrase);
 
       /// Loads an encrypted binary vault from a stream.
       /// This also generates the correct key.
+      /// Since version 1.5, every section of the vault is authenticated, and an authentication_error is thrown
+      /// if one was changed after it was written, or moved to another place in the file or to another file;
+      /// an incorrect passphrase throws an incorrect_key_error. A file that ends within the directory or a chunk
+      /// throws a format_error, but one that ends after a journal record looks like the file before the later records were appended.
       void load(std::istream& input_stream, cryptography::key& key, const data::secure_string& passphrase);
 
+      /// Loads an encrypted binary vault from a file with a key that was derived before, such as one that a key agent kept,
+      /// so the key is not derived again. An incorrect_key_error is thrown if the key does not belong to the vault.
+      void load(const std::string& filename, cryptography::key& derived_key);
+
+      /// Loads only the entry whose identifier best matches the query from an encrypted binary vault file.
+      /// This also generates the correct key. Returns nullptr if nothing matches.
+      /// The entry is not added to the vault.
+      data::entry_ptr load_match(const std::string& filename, cryptography::key& key, const data::secure_string& passphrase,
+        const search& algorithm, const data::secure_string& query);
+
+      /// Loads only the entry whose identifier best matches the query from an encrypted binary vault file,
+      /// with a key that was derived before. An incorrect_key_error is thrown if the key does not belong to the vault.
+      data::entry_ptr load_match(const std::string& filename, cryptography::key& derived_key,
+        const search& algorithm, const data::secure_string& query);
+
+      /// Loads only the entry whose identifier best matches the query from an encrypted binary vault stream.
+      /// Of a chunked vault, only the chunk directory and the chunk that contains the entry are decrypted;
+      /// older vaults are loaded completely. The stream must be seekable.
+      /// This also generates the correct key. Returns nullptr if nothing matches.
+      /// The entry is not added to the vault.
+      data::entry_ptr load_match(std::istream& input_stream, cryptography::key& key, const data::secure_string& passphrase,
+        const search& algorithm, const data::secure_string& query);
+
+      /// Returns whether vaults of the given version are divided into chunks,
+      /// rather than being one encrypted stream of JSON
+      static bool is_chunked(const version& vault_version);
+
+      /// Reads the version of a vault from the start of input_stream, and validates the header.
+      /// This leaves the stream after the version.
+      static version read_version(std::istream& input_stream);
+
+      /// Reads the salt and the number of iterations from the header of a vault file,
+      /// which tell which key belongs to the vault without deriving it
+      static void read_key_parameters(const std::string& filename, std::uint8_t* salt, std::uint32_t& iterations);
+
       /// Builds a stream that reads a Deadlock vault from input_stream,
       /// and allows the plaintext data to be read from the resulting decompression stream.
       /// This will put the correct key in key, and version of the vault in vault_version.
       /// decrypt_stream will contain the decryption stream, which should be deleted after use, but not used directly.
       /// decompress_stream will contain the decompression stream from which the plaintext can be read.
       /// decompress_stream should also be deleted after use.
+      /// Chunked vaults cannot be read as one stream; for those a format_error is thrown.
       static void build_decrypt_stream(std::istream& input_stream, version& vault_version, cryptography::key& key,
         cryptography::aes_cbc_decrypt_stream*& decrypt_stream,
         cryptography::xz_decompress_stream*& decompress_stream, const data::secure_string& passphrase);
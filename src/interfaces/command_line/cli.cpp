@@ -23,13 +23,17 @@
 #include <string>
 #include <boost/chrono.hpp>
 #include <list>
+#include <atomic>
 
 #ifndef _WIN32
+#include <csignal>
+#include <cstring>
 #include <termios.h>
 #endif
 
 #include "../../core/config.h"
 #include "../../core/errors.h"
+#include "../../core/key_agent.h"
 #include "../../core/data/secure_string.h"
 #include "../../core/search.h"
 
@@ -38,6 +42,12 @@ using namespace deadlock::interfaces::command_line;
 using namespace deadlock::core;
 using namespace deadlock::core::data;
 
+/// Rejects keeping a key in the keyring for zero seconds, which the kernel takes to mean that the key never expires
+static void check_keyring_seconds(std::uint32_t seconds_to_live)
+{
+  if (seconds_to_live == 0) throw po::validation_error(po::validation_error::invalid_option_value, "keyring");
+}
+
 int cli::run(int argc, char** argv)
 {
   #ifdef _WIN32
@@ -55,6 +65,8 @@ int cli::run(int argc, char** argv)
     ("new,n", "create a new vault")
     ("key-iterations", po::value<std::uint32_t>(), "the number of iterations for the key-generation algorithm") // TODO
     ("key-time", po::value<double>(), "infer the number of iterations from a time in seconds")
+    ("compression", po::value<std::string>(), "the compression profile: none, fast, default or extreme; " \
+                                              "with --new, or on its own to change the profile of a vault")
 
     ("identify", "show information about the archive")
 
@@ -71,6 +83,8 @@ int cli::run(int argc, char** argv)
 
     ("list,l", po::value<std::string>(), "list the identifiers of all stored entries, " \
                                          "or all the entries that match the search criteria")
+    ("fuzzy", po::value<std::uint32_t>()->implicit_value(2), "tolerate up to this many typos per word when searching")
+    ("all-fields", "search usernames and additional data too, not only identifiers")
 
     ("export", po::value<std::string>(), "export the vault to JSON (removes encryption)")
     ("plain", "save data as plain text instead of hexadecimal representation")
@@ -78,6 +92,13 @@ int cli::run(int argc, char** argv)
 
     ("import", po::value<std::vector<std::string>>(), "append unencrypted JSON vault(s) to the vault")
 
+    ("agent", "run an agent that keeps derived keys for later commands, until it is interrupted")
+    ("agent-ttl", po::value<std::uint32_t>(), "the number of seconds the agent keeps a key, 900 by default")
+    ("keyring", po::value<std::uint32_t>()->implicit_value(900)->notifier(check_keyring_seconds),
+                "keep the derived key in the session keyring of the kernel for this many seconds")
+    ("forget-keys", "make the running agent and the session keyring forget all keys")
+    ("no-agent", "do not use a key that was kept by the agent or the keyring, nor keep the key")
+
     ("vault", po::value<std::string>(), "the vault to operate on")
   ;
 
@@ -136,6 +157,24 @@ int cli::run(int argc, char** argv)
     return handle_new(vm);
   }
 
+  // Change the compression profile of an archive
+  else if (vm.count("compression"))
+  {
+    return handle_compression(vm);
+  }
+
+  // Keep derived keys for later commands
+  else if (vm.count("agent"))
+  {
+    return handle_agent(vm);
+  }
+
+  // Forget the keys that the agent and the keyring keep
+  else if (vm.count("forget-keys"))
+  {
+    return handle_forget_keys(vm);
+  }
+
   // Print help message
   if (vm.count("help"))
   {
@@ -201,6 +240,27 @@ void set_echo(bool do_echo)
 
 #endif
 
+/// The names of the compression profiles on the command line, in the order of vault::compression_profile
+static const char* const compression_profile_names[] = { "none", "fast", "default", "extreme" };
+
+/// Looks up the compression profile given on the command line, and returns whether there is one by that name.
+/// If there is not, it prints an error message.
+static bool parse_compression_profile(const po::variables_map& vm, vault::compression_profile& profile)
+{
+  const std::string& name = vm.at("compression").as<std::string>();
+  for (int p = vault::compression_none; p <= vault::compression_extreme; p++)
+  {
+    if (name == compression_profile_names[p])
+    {
+      profile = static_cast<vault::compression_profile>(p);
+      return true;
+    }
+  }
+
+  std::cerr << "Unknown compression profile '" << name << "'; use none, fast, default or extreme." << std::endl;
+  return false;
+}
+
 secure_string_ptr cli::ask_passphrase() const
 {
   secure_string_ptr passphrase = make_secure_string();
@@ -256,6 +316,33 @@ bool cli::require_vault_filename(const po::variables_map& vm, bool must_exist)
   return true;
 }
 
+bool cli::find_kept_key(const boost::program_options::variables_map& vm)
+{
+  if (vm.count("no-agent")) return false;
+
+  // Keys are kept by salt and iterations, so a vault that was recreated does not get an old key
+  std::uint8_t salt[cryptography::key::salt_size];
+  std::uint32_t iterations;
+  vault::read_key_parameters(vault_filename, salt, iterations);
+
+  // The keyring answers without talking to another process, so it is asked first
+  return key.find_in_keyring(salt, iterations)
+    || key_agent::find_key(key_agent::get_socket_path(), vault_filename, salt, iterations, key);
+}
+
+void cli::keep_key(const boost::program_options::variables_map& vm)
+{
+  if (vm.count("no-agent")) return;
+
+  if (vm.count("keyring") && !key.keep_in_keyring(vm.at("keyring").as<std::uint32_t>()))
+  {
+    std::cerr << "Could not keep the key in the session keyring." << std::endl;
+  }
+
+  // Without an agent this does nothing
+  key_agent::store_key(key_agent::get_socket_path(), vault_filename, key);
+}
+
 bool cli::load_vault(const boost::program_options::variables_map& vm)
 {
   if (!require_vault_filename(vm))
@@ -263,13 +350,31 @@ bool cli::load_vault(const boost::program_options::variables_map& vm)
     return false;
   }
 
-  // Ask the user for his passphrase
-  data::secure_string_ptr passphrase = ask_passphrase();  
+  // A command reads the passwords of a few entries at most, so only those need be decoded;
+  // saving writes the passwords of the others as they were read
+  vault.set_lazy_loading(true);
 
   // Try to load the vault
   try
   {
+    // With a key that was kept, there is no need to ask for the passphrase and derive the key again
+    if (find_kept_key(vm))
+    {
+      try
+      {
+        vault.load(vault_filename, key);
+        return true;
+      }
+      catch (incorrect_key_error&)
+      {
+        // The kept key does not fit, so fall back to the passphrase
+      }
+    }
+
+    // Ask the user for his passphrase
+    data::secure_string_ptr passphrase = ask_passphrase();
     vault.load(vault_filename, key, *passphrase);
+    keep_key(vm);
   }
   // Check for incorrect key
   catch (incorrect_key_error&)
@@ -288,6 +393,54 @@ bool cli::load_vault(const boost::program_options::variables_map& vm)
   return true;  
 }
 
+bool cli::load_match(const boost::program_options::variables_map& vm, const data::secure_string& query, data::entry_ptr& result)
+{
+  if (!require_vault_filename(vm))
+  {
+    return false;
+  }
+
+  // Try to find the entry, decrypting as little of the vault as possible
+  try
+  {
+    deadlock::core::search search;
+
+    // With a key that was kept, there is no need to ask for the passphrase and derive the key again
+    if (find_kept_key(vm))
+    {
+      try
+      {
+        result = vault.load_match(vault_filename, key, search, query);
+        return true;
+      }
+      catch (incorrect_key_error&)
+      {
+        // The kept key does not fit, so fall back to the passphrase
+      }
+    }
+
+    // Ask the user for his passphrase
+    data::secure_string_ptr passphrase = ask_passphrase();
+    result = vault.load_match(vault_filename, key, *passphrase, search, query);
+    keep_key(vm);
+  }
+  // Check for incorrect key
+  catch (incorrect_key_error&)
+  {
+    std::cerr << "The passphrase is incorrect." << std::endl;
+    return false;
+  }
+  // If anything other goes wrong, report error.
+  catch (std::runtime_error& ex)
+  {
+    std::cerr << "Could not open vault." << std::endl;
+    std::cerr << ex.what() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
 bool cli::set_fields(const po::variables_map& vm, data::entry_ptr entr)
 {
   bool anything_set = false;
@@ -347,6 +500,14 @@ int cli::handle_new(const po::variables_map& vm)
     return EXIT_FAILURE;
   }
 
+  // Use the default compression profile, unless specified otherwise
+  vault::compression_profile profile = vault::compression_default;
+  if (vm.count("compression") && !parse_compression_profile(vm, profile))
+  {
+    return EXIT_FAILURE;
+  }
+  vault.set_compression_profile(profile);
+
   data::secure_string_ptr passphrase = ask_passphrase();  
 
   // Use 100 000 iterations by default
@@ -401,6 +562,8 @@ int cli::handle_new(const po::variables_map& vm)
   }
   std::cout << "\b\b\b\b, done." << std::endl;
 
+  keep_key(vm);
+
   return EXIT_SUCCESS;
 }
 
@@ -477,6 +640,21 @@ int cli::handle_export_raw(const std::string& input_filename, const std::string&
 
       try
       {
+        // A chunked vault is not one stream of plaintext, so write its entries as plain JSON instead
+        file_version = vault::read_version(input_file);
+        input_file.seekg(0);
+        if (vault::is_chunked(file_version))
+        {
+          std::cout << "Decrypting vault ...";
+          vault.load(input_file, key, *passphrase);
+          vault.export_json(output_file, false);
+          std::cout << "\b\b\b\b, done." << std::endl;
+
+          output_file.close();
+          input_file.close();
+          return EXIT_SUCCESS;
+        }
+
         // Build streams from which plaintext can be read
         vault::build_decrypt_stream(input_file, file_version, key, decrypt_stream, decompress_stream, *passphrase);
 
@@ -565,6 +743,7 @@ int cli::handle_identify(const po::variables_map& vm)
   {
     std::cout << "Deadlock " << vault.get_version() << " vault." << std::endl;
     std::cout << "PBKDF2 iterations: " << key.get_iterations() << "." << std::endl;
+    std::cout << "Compression: " << compression_profile_names[vault.get_compression_profile()] << "." << std::endl;
     return EXIT_SUCCESS;
   }
   // If anything other goes wrong, report error.
@@ -575,6 +754,7 @@ int cli::handle_identify(const po::variables_map& vm)
   }
   std::cout << "Deadlock " << vault.get_version() << " vault." << std::endl;
   std::cout << "PBKDF2 iterations: " << key.get_iterations() << "." << std::endl;
+  std::cout << "Compression: " << compression_profile_names[vault.get_compression_profile()] << "." << std::endl;
   // If there is no error, the passphrase was "no_passphrase"
   std::cout << "You should use a stronger passphrase." << std::endl;
   return EXIT_SUCCESS;
@@ -622,7 +802,7 @@ int cli::handle_add(const po::variables_map& vm)
   std::cout << "'" << *id << "' added, encrypting and writing vault ...";
   try
   {
-    vault.save(vault_filename, key);
+    vault.save_entry(vault_filename, key, new_entry);
   }
   catch (const std::runtime_error& ex)
   {
@@ -725,7 +905,18 @@ int cli::handle_list(const po::variables_map& vm)
     std::list<data::entry_ptr> results;
 
     // Now execute the search
-    search.find_matches(*query, vault.begin(), vault.end(), std::back_inserter(results));
+    if (vm.count("all-fields"))
+    {
+      search.find_matches(*query, vault.get_entries(), deadlock::core::field_weights(), std::back_inserter(results));
+    }
+    else if (vm.count("fuzzy"))
+    {
+      search.find_fuzzy_matches(*query, vault.get_entries(), vm.at("fuzzy").as<std::uint32_t>(), std::back_inserter(results));
+    }
+    else
+    {
+      search.find_matches(*query, vault.get_entries(), std::back_inserter(results));
+    }
 
     // And print the identifiers of the matches, one per line
     for (auto i = results.begin(); i != results.end(); i++)
@@ -745,22 +936,32 @@ int cli::handle_show(const po::variables_map& vm)
     return EXIT_FAILURE;
   }
 
-  // Open the vault
-  if(!load_vault(vm))
-  {
-    return EXIT_FAILURE;
-  }
-
   // Retrieve the identifier from the command line and store it in a secure string.
   // The secure string is simply easier to use in combination with the rest of the application;
   // it adds no value since the data is insecure anyway.
   data::secure_string_ptr query = data::make_secure_string(vm.at("show").as<std::string>());
 
-  // Create a search algorithm
-  deadlock::core::search search;
+  data::entry_ptr result;
 
-  // Now execute the search
-  data::entry_ptr result = search.find_match(*query, vault.begin(), vault.end());
+  if (vm.count("fuzzy"))
+  {
+    // Fuzzy search needs every entry, so open the whole vault
+    if(!load_vault(vm))
+    {
+      return EXIT_FAILURE;
+    }
+
+    deadlock::core::search search;
+    result = search.find_fuzzy_match(*query, vault.get_entries(), vm.at("fuzzy").as<std::uint32_t>());
+  }
+  else
+  {
+    // Otherwise, only the entry that matches needs to be decrypted
+    if (!load_match(vm, *query, result))
+    {
+      return EXIT_FAILURE;
+    }
+  }
 
   if (result != nullptr)
   {
@@ -856,7 +1057,7 @@ int cli::handle_set(const po::variables_map& vm)
   deadlock::core::search search;
 
   // Now execute the search
-  data::entry_ptr result = search.find_match(*query, vault.begin(), vault.end());
+  data::entry_ptr result = search.find_match(*query, vault.get_entries());
 
   if (result != nullptr)
   {
@@ -867,7 +1068,7 @@ int cli::handle_set(const po::variables_map& vm)
       std::cout << "'" << result->get_id() << "' updated, encrypting and writing vault ...";
       try
       {
-        vault.save(vault_filename, key);
+        vault.save_entry(vault_filename, key, result);
       }
       catch (const std::runtime_error& ex)
       {
@@ -892,3 +1093,112 @@ int cli::handle_set(const po::variables_map& vm)
     return EXIT_FAILURE;
   }
 }
+
+int cli::handle_compression(const po::variables_map& vm)
+{
+  // Make sure the user specified a vault to use
+  if (!require_vault_filename(vm))
+  {
+    return EXIT_FAILURE;
+  }
+
+  vault::compression_profile profile;
+  if (!parse_compression_profile(vm, profile))
+  {
+    return EXIT_FAILURE;
+  }
+
+  // Open the vault
+  if (!load_vault(vm))
+  {
+    return EXIT_FAILURE;
+  }
+
+  // The whole vault must be compressed anew
+  vault.set_compression_profile(profile);
+  std::cout << "Compressing with the " << compression_profile_names[profile] << " profile, encrypting and writing vault ...";
+  try
+  {
+    vault.save(vault_filename, key);
+  }
+  catch (const std::runtime_error& ex)
+  {
+    std::cout << std::endl;
+    std::cerr << "Failed to write vault." << std::endl;
+    std::cerr << ex.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "\b\b\b\b, done." << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+/// Set when the agent is asked to stop
+static std::atomic<bool> agent_stopped(false);
+
+#ifndef _WIN32
+
+/// Stops the agent on SIGINT and SIGTERM
+static void stop_agent(int)
+{
+  agent_stopped = true;
+}
+
+#endif
+
+int cli::handle_agent(const po::variables_map& vm)
+{
+  std::uint32_t seconds_to_live = 900;
+  if (vm.count("agent-ttl"))
+  {
+    seconds_to_live = vm.at("agent-ttl").as<std::uint32_t>();
+  }
+
+  const std::string socket_path = key_agent::get_socket_path();
+  try
+  {
+    key_agent agent(socket_path, seconds_to_live);
+
+    #ifndef _WIN32
+    // Without SA_RESTART, a signal interrupts waiting for requests, so the agent stops right away
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_agent;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    #endif
+
+    std::cout << "Keeping keys for " << seconds_to_live << " seconds; listening on " << socket_path << "." << std::endl;
+    agent.run(agent_stopped);
+  }
+  catch (const std::runtime_error& ex)
+  {
+    std::cerr << "Could not run the key agent." << std::endl;
+    std::cerr << ex.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int cli::handle_forget_keys(const po::variables_map&)
+{
+  const size_t forgotten = cryptography::key::forget_keyring();
+  if (forgotten > 0)
+  {
+    std::cout << "Removed " << forgotten << " keys from the session keyring." << std::endl;
+  }
+
+  if (key_agent::forget_keys(key_agent::get_socket_path()))
+  {
+    std::cout << "The key agent forgot all keys." << std::endl;
+  }
+  else if (forgotten == 0)
+  {
+    std::cerr << "No keys were kept." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -58,6 +58,20 @@ namespace deadlock
           /// If not, it prints an error message and returns false.
           bool load_vault(const boost::program_options::variables_map& vm);
 
+          /// Loads only the entry that best matches the query from the vault into result,
+          /// asks the user for a passphrase in the process, and returns whether the operation was successful.
+          /// If not, it prints an error message and returns false.
+          bool load_match(const boost::program_options::variables_map& vm, const core::data::secure_string& query,
+            core::data::entry_ptr& result);
+
+          /// Looks for the key of the vault in the session keyring and then asks the key agent,
+          /// unless --no-agent was given, and returns whether the key was kept.
+          bool find_kept_key(const boost::program_options::variables_map& vm);
+
+          /// Keeps the key of the vault in the session keyring if --keyring was given,
+          /// and gives it to the key agent if one is running, unless --no-agent was given
+          void keep_key(const boost::program_options::variables_map& vm);
+
           /// Sets the vault filename if it is present,
           /// otherwise prints a message and returns false.
           bool require_vault_filename(const boost::program_options::variables_map& vm, bool must_exist = true);
@@ -92,6 +106,15 @@ namespace deadlock
 
           /// Handles the 'set' logic
           int handle_set(const boost::program_options::variables_map& vm);
+
+          /// Handles changing the compression profile of a vault
+          int handle_compression(const boost::program_options::variables_map& vm);
+
+          /// Runs the key agent until it is interrupted
+          int handle_agent(const boost::program_options::variables_map& vm);
+
+          /// Makes the key agent and the session keyring forget all keys
+          int handle_forget_keys(const boost::program_options::variables_map& vm);
       };
     }
   }
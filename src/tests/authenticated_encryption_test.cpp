@@ -0,0 +1,406 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "authenticated_encryption_test.h"
+#include "../core/core.h"
+#include "../core/errors.h"
+#include "../core/cryptography/aes_instructions.h"
+#include "../core/cryptography/authenticated_encryption.h"
+#include "../core/cryptography/cryptography_initialisation.h"
+
+extern "C"
+{
+  #include <tomcrypt.h>
+}
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace deadlock::core;
+using namespace deadlock::tests;
+
+/// Converts a string of hexadecimal digits to the bytes it represents
+static std::string from_hex(const char* hex)
+{
+  std::string bytes(std::strlen(hex) / 2, '\0');
+  for (size_t i = 0; i < bytes.size(); i++)
+  {
+    bytes[i] = static_cast<char>(std::stoi(std::string(hex + 2 * i, 2), nullptr, 16));
+  }
+  return bytes;
+}
+
+/// Encrypts and decrypts a test vector of the GCM specification with LibTomCrypt, and with the AES instructions if there are any
+static void test_vector(const char* key_hex, const char* nonce_hex, const char* associated_hex, const char* plaintext_hex,
+  const char* ciphertext_hex, const char* tag_hex)
+{
+  const std::string key = from_hex(key_hex), nonce = from_hex(nonce_hex), associated_data = from_hex(associated_hex);
+  const std::string plaintext = from_hex(plaintext_hex), ciphertext = from_hex(ciphertext_hex), tag = from_hex(tag_hex);
+  const std::uint8_t* key_bytes = reinterpret_cast<const std::uint8_t*>(key.data());
+  const std::uint8_t* nonce_bytes = reinterpret_cast<const std::uint8_t*>(nonce.data());
+
+  std::string output(plaintext.size() + 1, '\0');
+  std::uint8_t computed_tag[16];
+  unsigned long computed_tag_size = sizeof(computed_tag);
+
+  gcm_state state;
+  gcm_init(&state, cryptography::detail::_initialisation::aes_index, key_bytes, static_cast<int>(key.size()));
+  gcm_add_iv(&state, nonce_bytes, nonce.size());
+  gcm_add_aad(&state, reinterpret_cast<const unsigned char*>(associated_data.data()), static_cast<unsigned long>(associated_data.size()));
+  gcm_process(&state, reinterpret_cast<unsigned char*>(const_cast<char*>(plaintext.data())), static_cast<unsigned long>(plaintext.size()),
+    reinterpret_cast<unsigned char*>(&output[0]), GCM_ENCRYPT);
+  gcm_done(&state, computed_tag, &computed_tag_size);
+
+  if (output.compare(0, plaintext.size(), ciphertext) != 0 || std::memcmp(computed_tag, tag.data(), 16) != 0)
+    throw std::runtime_error("LibTomCrypt did not encrypt a test vector correctly.");
+
+  if (!cryptography::detail::has_gcm_instructions()) return;
+
+  cryptography::detail::aes_gcm_block_cipher cipher(key_bytes);
+  cipher.encrypt(nonce_bytes, associated_data.data(), associated_data.size(), plaintext.data(), &output[0], plaintext.size(), computed_tag);
+  if (output.compare(0, plaintext.size(), ciphertext) != 0 || std::memcmp(computed_tag, tag.data(), 16) != 0)
+    throw std::runtime_error("The AES instructions did not encrypt a test vector correctly.");
+
+  cipher.decrypt(nonce_bytes, associated_data.data(), associated_data.size(), ciphertext.data(), &output[0], ciphertext.size(), computed_tag);
+  if (output.compare(0, ciphertext.size(), plaintext) != 0 || std::memcmp(computed_tag, tag.data(), 16) != 0)
+    throw std::runtime_error("The AES instructions did not decrypt a test vector correctly.");
+}
+
+/// Encrypts the plaintext segment by segment with LibTomCrypt, the way a section is encrypted, with the given nonce prefix
+static std::string encrypt_with_libtomcrypt(const cryptography::key& key, const std::string& prefix, const std::string& associated_data,
+  const std::string& plaintext)
+{
+  const size_t segments = plaintext.empty() ? 1 : (plaintext.size() + cryptography::segment_size - 1) / cryptography::segment_size;
+  std::string section = prefix;
+
+  gcm_state state;
+  gcm_init(&state, cryptography::detail::_initialisation::aes_index, key.get_key(), key.key_size);
+  for (size_t s = 0; s < segments; s++)
+  {
+    std::uint8_t nonce[12];
+    std::memcpy(nonce, prefix.data(), cryptography::nonce_prefix_size);
+    nonce[7] = 0; nonce[8] = 0; nonce[9] = static_cast<std::uint8_t>(s >> 8); nonce[10] = static_cast<std::uint8_t>(s);
+    nonce[11] = s + 1 == segments ? 1 : 0;
+
+    const size_t offset = s * cryptography::segment_size;
+    const size_t length = std::min(cryptography::segment_size, plaintext.size() - offset);
+    std::string ciphertext(length + cryptography::tag_size, '\0');
+    unsigned long tag_size = cryptography::tag_size;
+
+    gcm_reset(&state);
+    gcm_add_iv(&state, nonce, sizeof(nonce));
+    gcm_add_aad(&state, reinterpret_cast<const unsigned char*>(associated_data.data()), static_cast<unsigned long>(associated_data.size()));
+    gcm_process(&state, reinterpret_cast<unsigned char*>(const_cast<char*>(plaintext.data() + offset)), static_cast<unsigned long>(length),
+      reinterpret_cast<unsigned char*>(&ciphertext[0]), GCM_ENCRYPT);
+    gcm_done(&state, reinterpret_cast<unsigned char*>(&ciphertext[length]), &tag_size);
+
+    section += ciphertext;
+  }
+  return section;
+}
+
+/// Validates that the section is rejected with the associated data, and that none of its plaintext is kept
+static void expect_rejected(const cryptography::key& key, const std::string& section, const std::string& associated_data,
+  const char* change)
+{
+  data::secure_string plaintext;
+  try
+  {
+    cryptography::decrypt_authenticated(key, section.data(), section.size(), associated_data, 4, plaintext);
+  }
+  catch (authentication_error&)
+  {
+    if (!plaintext.empty()) throw std::runtime_error("The plaintext of a rejected section was kept.");
+    return;
+  }
+  throw std::runtime_error(std::string("A section was accepted although ") + change + ".");
+}
+
+/// Changes one byte of a file
+static void damage_file(const std::string& filename, std::streamoff position)
+{
+  std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+  file.seekg(position);
+  const char c = static_cast<char>(file.get());
+  file.seekp(position);
+  file.put(static_cast<char>(c ^ 0x01));
+}
+
+/// Returns the contents of a file
+static std::string read_file(const std::string& filename)
+{
+  std::ifstream file(filename, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+/// Replaces the contents of a file
+static void write_file(const std::string& filename, const std::string& contents)
+{
+  std::ofstream file(filename, std::ios::binary);
+  file.write(contents.data(), contents.size());
+}
+
+/// Validates that loading the vault fails because a section is not authentic
+static void expect_vault_rejected(const std::string& filename, const data::secure_string& passphrase, const char* change)
+{
+  try
+  {
+    vault rejected;
+    cryptography::key rejected_key;
+    rejected.load(filename, rejected_key, passphrase);
+  }
+  catch (authentication_error&)
+  {
+    return;
+  }
+  throw std::runtime_error(std::string("A vault was loaded although ") + change + ".");
+}
+
+/// Validates that the sections of a vault cannot be moved to another place in it
+static void test_moved_sections(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  const std::string filename = "test_authenticated_encryption_places.dlk";
+
+  // Entries of equal size, which are not compressed, fill chunks of equal size.
+  // An entry takes about 4200 bytes, so 16 of them fill a chunk.
+  vault places;
+  places.set_compression_profile(vault::compression_none);
+  for (size_t i = 0; i < 32; i++)
+  {
+    data::entry_ptr etr = data::make_entry();
+    etr->set_id(*data::make_secure_string("Placed Key " + std::to_string(10 + i)));
+    etr->set_password(*data::make_secure_string(std::string(4200, static_cast<char>('a' + i % 26))));
+    places.add_entry(etr);
+  }
+  places.save(filename, key);
+  const std::string base = read_file(filename);
+
+  // The two chunks follow the header and the directory, whose length precedes it
+  const size_t body = 8 + 4 + cryptography::key::salt_size + 1 + cryptography::key::check_value_size + vault::save_salt_size;
+  const size_t chunks = body + 4 + ((static_cast<std::uint8_t>(base[body]) << 24) | (static_cast<std::uint8_t>(base[body + 1]) << 16)
+    | (static_cast<std::uint8_t>(base[body + 2]) << 8) | static_cast<std::uint8_t>(base[body + 3]));
+  const size_t chunk_length = (base.size() - chunks) / 2;
+  if ((base.size() - chunks) % 2 != 0) throw std::runtime_error("The chunks of the vault are not of equal size.");
+
+  write_file(filename, base.substr(0, chunks) + base.substr(chunks + chunk_length) + base.substr(chunks, chunk_length));
+  expect_vault_rejected(filename, passphrase, "its chunks were swapped");
+
+  // Every change to an entry appends a record to the journal
+  write_file(filename, base);
+  places.get_entries().at(3)->set_username("Glottis");
+  places.save_entry(filename, key, places.get_entries().at(3));
+  const size_t first_end = read_file(filename).size();
+  places.get_entries().at(5)->set_username("Domino");
+  places.save_entry(filename, key, places.get_entries().at(5));
+  const std::string journalled = read_file(filename);
+  const std::string first_record = journalled.substr(base.size(), first_end - base.size());
+  const std::string second_record = journalled.substr(first_end);
+
+  vault reloaded;
+  cryptography::key reloaded_key;
+  reloaded.load(filename, reloaded_key, passphrase);
+  if (reloaded.get_entries().at(5)->get_username() != "Domino") throw std::runtime_error("The journal was not replayed.");
+
+  write_file(filename, base + second_record + first_record);
+  expect_vault_rejected(filename, passphrase, "its journal records were reordered");
+
+  write_file(filename, base + first_record + first_record);
+  expect_vault_rejected(filename, passphrase, "a journal record was replayed");
+}
+
+/// Saves a vault, and validates that loading it fails with the right error when it was changed or the passphrase is wrong
+static void test_vault(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  const std::string filename = "test_authenticated_encryption.dlk";
+
+  vault first;
+  for (size_t i = 0; i < 1000; i++)
+  {
+    data::entry_ptr etr = data::make_entry();
+    etr->set_id(*data::make_secure_string("Authenticated Key " + std::to_string(i)));
+    etr->set_username("Manny Calavera");
+    etr->set_password(*data::make_secure_string("number " + std::to_string(i * 7919)));
+    first.add_entry(etr);
+  }
+  first.save(filename, key);
+
+  std::streamoff size;
+  {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    size = file.tellg();
+  }
+
+  vault second;
+  cryptography::key second_key;
+  second.load(filename, second_key, passphrase);
+  if (second.get_entries().size() != first.get_entries().size()) throw std::runtime_error("Incorrect number of entries encountered.");
+
+  try
+  {
+    vault third;
+    cryptography::key third_key;
+    third.load(filename, third_key, "incorrect horse battery staple");
+    throw std::logic_error("A vault was loaded with an incorrect passphrase.");
+  }
+  catch (incorrect_key_error&)
+  {
+    // This is expected
+  }
+
+  // A change anywhere after the key check value is noticed before the changed section is used;
+  // the first change is in the salt of the save, the second in the directory, the others in a chunk
+  const std::streamoff check_value_end = 8 + 4 + cryptography::key::salt_size + 1 + cryptography::key::check_value_size;
+  const std::streamoff body = check_value_end + vault::save_salt_size;
+  const std::streamoff positions[] = { body - 1, body + 4 + 20, size / 2, size - 1 };
+  for (size_t p = 0; p < sizeof(positions) / sizeof(positions[0]); p++)
+  {
+    damage_file(filename, positions[p]);
+    try
+    {
+      vault damaged;
+      cryptography::key damaged_key;
+      damaged.load(filename, damaged_key, passphrase);
+      throw std::logic_error("A vault was loaded although it was changed.");
+    }
+    catch (authentication_error&)
+    {
+      // This is expected
+    }
+    damage_file(filename, positions[p]);
+  }
+
+  // A change to the key check value of the header looks like an incorrect passphrase
+  damage_file(filename, check_value_end - 1);
+  try
+  {
+    vault damaged;
+    cryptography::key damaged_key;
+    damaged.load(filename, damaged_key, passphrase);
+    throw std::logic_error("A vault was loaded although its key check value was changed.");
+  }
+  catch (incorrect_key_error&)
+  {
+    // This is expected
+  }
+  damage_file(filename, check_value_end - 1);
+
+  // Every save encrypts with a key of its own, so the sections of one save cannot be put after the header of another
+  const std::string first_file = read_file(filename);
+  first.save(filename, key);
+  const std::string second_file = read_file(filename);
+  if (first_file.compare(0, body, second_file, 0, body) == 0) throw std::runtime_error("Two saves have the same salt.");
+
+  write_file(filename, second_file.substr(0, body) + first_file.substr(body));
+  expect_vault_rejected(filename, passphrase, "it holds the sections of another save");
+}
+
+std::string authenticated_encryption_test::get_name()
+{
+  return "authenticated_encryption";
+}
+
+void authenticated_encryption_test::run()
+{
+  // Test cases 13 to 16 of the GCM specification, which use a 256-bit key and a 96-bit nonce; only the last has additional data
+  const char* zero_key = "0000000000000000000000000000000000000000000000000000000000000000";
+  test_vector(zero_key, "000000000000000000000000", "", "", "", "530f8afbc74536b9a963b4f1c4cb738b");
+  test_vector(zero_key, "000000000000000000000000", "", "00000000000000000000000000000000",
+    "cea7403d4d606b6e074ec5d3baf39d18", "d0d1c8a799996bf0265b98b5d48ab919");
+  test_vector("feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "",
+    "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+    "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662898015ad",
+    "b094dac5d93471bdec1a502270e3cc6c");
+  test_vector("feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+    "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+    "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+    "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+    "76fc6ece0f4e1768cddf8853bb2d551b");
+
+  // Create a key
+  cryptography::key key;
+  key.set_salt_random();
+  data::secure_string_ptr passphrase = data::make_secure_string("correct horse battery staple");
+  std::uint32_t iterations = key.get_required_iterations(passphrase->length(), 0.1);
+  key.generate_key(*passphrase, iterations);
+
+  // Sections of every size around the segment size decrypt to what was encrypted, on one thread or several
+  const std::string place = "a place in a vault";
+  const size_t segment = cryptography::segment_size;
+  const size_t sizes[] = { 0, 1, 16, segment - 1, segment, segment + 1, 5 * segment + 17, 40 * segment };
+  const size_t threads[] = { 1, 4 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    std::string original(sizes[i], '\0');
+    for (size_t j = 0; j < original.size(); j++) original[j] = static_cast<char>((j * 13) % 0xfd);
+
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+    {
+      const std::string section = cryptography::encrypt_authenticated(key, original.data(), original.size(), place, threads[t]);
+      const size_t segments = original.empty() ? 1 : (original.size() + segment - 1) / segment;
+      if (section.size() != cryptography::nonce_prefix_size + original.size() + segments * cryptography::tag_size)
+        throw std::runtime_error("Unexpected size of an authenticated section.");
+
+      data::secure_string plaintext;
+      cryptography::decrypt_authenticated(key, section.data(), section.size(), place, threads[t], plaintext);
+      if (plaintext.size() != original.size() || !std::equal(plaintext.begin(), plaintext.end(), original.begin()))
+        throw std::runtime_error("Data was not decrypted correctly.");
+
+      // Whichever way the segments were encrypted, they are what LibTomCrypt makes of them
+      if (section != encrypt_with_libtomcrypt(key, section.substr(0, cryptography::nonce_prefix_size), place, original))
+        throw std::runtime_error("A section was not encrypted like LibTomCrypt encrypts it.");
+    }
+  }
+
+  // Changes to a section of three segments are detected
+  std::string original(2 * segment + 100, '\0');
+  for (size_t j = 0; j < original.size(); j++) original[j] = static_cast<char>(j % 251);
+  const std::string section = cryptography::encrypt_authenticated(key, original.data(), original.size(), place, 1);
+  const size_t stride = segment + cryptography::tag_size;
+  const size_t prefix = cryptography::nonce_prefix_size;
+
+  std::string changed = section;
+  changed[3] ^= 0x01;
+  expect_rejected(key, changed, place, "its nonce was changed");
+
+  changed = section;
+  changed[prefix + stride + 1000] ^= 0x01;
+  expect_rejected(key, changed, place, "its ciphertext was changed");
+
+  changed = section;
+  changed[section.size() - 1] ^= 0x80;
+  expect_rejected(key, changed, place, "a tag was changed");
+
+  expect_rejected(key, section.substr(0, section.size() - 1), place, "it was truncated");
+  expect_rejected(key, section.substr(0, prefix + 2 * stride), place, "its last segment was dropped");
+  expect_rejected(key, section.substr(0, 10), place, "it is too short to hold a tag");
+
+  changed = section.substr(0, prefix) + section.substr(prefix + stride, stride) + section.substr(prefix, stride) + section.substr(prefix + 2 * stride);
+  expect_rejected(key, changed, place, "its segments were reordered");
+
+  const std::string other = cryptography::encrypt_authenticated(key, original.data(), original.size(), place, 1);
+  changed = section.substr(0, prefix + stride) + other.substr(prefix + stride, stride) + section.substr(prefix + 2 * stride);
+  expect_rejected(key, changed, place, "a segment of another section was put in it");
+  expect_rejected(key, section, "another place", "it was moved to another place");
+  expect_rejected(key, section, "", "it was decrypted without the data it authenticates");
+
+  test_vault(key, *passphrase);
+  test_moved_sections(key, *passphrase);
+}
@@ -19,8 +19,10 @@
 #include "../core/cryptography/xz_compress_stream.h"
 #include "../core/cryptography/xz_decompress_stream.h"
 
+#include <cstdint>
 #include <stdexcept>
 #include <sstream>
+#include <string>
 
 using namespace deadlock::core;
 using namespace deadlock::tests;
@@ -119,4 +121,31 @@ void compression_stream_test::run()
     std::string result; std::getline(decompression_stream, result);
     if (result != "hullo, world") throw std::runtime_error("Compression or decompression failed for little data.");
   }
+
+  {
+    // Test multi-threaded compression, which must remain readable with a single thread
+
+    // Enough data for many blocks
+    std::string data;
+    for (size_t i = 0; i < 20000; i++) data += std::to_string(i * 7919) + ' ';
+
+    // A stream to hold the compressed data
+    std::stringstream compressed_data_stream;
+
+    // A stream that compresses blocks of 4 kiB on 4 threads
+    cryptography::xz_compress_stream compression_stream(compressed_data_stream, 6, 4, 4096);
+    compression_stream << data;
+    compression_stream.close();
+
+    // Decompress with one thread, and with several
+    for (std::uint32_t threads = 1; threads <= 4; threads += 3)
+    {
+      compressed_data_stream.clear();
+      compressed_data_stream.seekg(0, std::ios_base::beg);
+
+      cryptography::xz_decompress_stream decompression_stream(compressed_data_stream, threads);
+      std::string result; std::getline(decompression_stream, result);
+      if (result != data) throw std::runtime_error("Multi-threaded compression or decompression failed.");
+    }
+  }
 }
@@ -18,7 +18,10 @@
 #include "../core/core.h"
 #include "../core/cryptography/aes_cbc_encrypt_stream.h"
 #include "../core/cryptography/aes_cbc_decrypt_stream.h"
+#include "../core/cryptography/aes_instructions.h"
 
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 #include <sstream>
 
@@ -181,4 +184,96 @@ void cryptography_stream_test::run()
         throw std::runtime_error("Unexpected decrypted size.");
     }
   }
+
+  // Pass 5: amounts around the size that is decrypted at a time, read from a stream and from memory
+  {
+    const unsigned int amounts[] = { 16383, 16384, 16385, 16399, 16400, 32767, 32768, 100000 };
+    for (size_t a = 0; a < sizeof(amounts) / sizeof(amounts[0]); a++)
+    {
+      std::string original(amounts[a], '\0');
+      for (size_t i = 0; i < original.size(); i++) original[i] = static_cast<char>((i * 7) % 0xfb);
+
+      std::stringstream encrypted_data_stream;
+      cryptography::aes_cbc_encrypt_stream enc_stream(encrypted_data_stream, key);
+      enc_stream.write(original.data(), original.size());
+      enc_stream.close();
+      const std::string ciphertext = encrypted_data_stream.str();
+
+      std::stringstream from_stream;
+      cryptography::aes_cbc_decrypt_stream stream_dec(encrypted_data_stream, key);
+      from_stream << stream_dec.rdbuf();
+
+      std::stringstream from_memory;
+      cryptography::aes_cbc_decrypt_stream memory_dec(ciphertext.data(), ciphertext.data() + ciphertext.size(), key);
+      from_memory << memory_dec.rdbuf();
+
+      if (from_stream.str() != original || from_memory.str() != original)
+        throw std::runtime_error("Data was not decrypted correctly.");
+    }
+  }
+
+  // Pass 6: the AES instructions decrypt the same as LibTomCrypt
+  if (cryptography::detail::has_aes_instructions())
+  {
+    const size_t blocks = 37;
+    char ciphertext[blocks * 16], expected[blocks * 16], plaintext[blocks * 16];
+    char iv[16], expected_iv[16];
+    for (size_t i = 0; i < sizeof(ciphertext); i++) ciphertext[i] = static_cast<char>(i * 31 + 5);
+    for (size_t i = 0; i < 16; i++) iv[i] = static_cast<char>(i * 3);
+
+    symmetric_key skey;
+    aes_setup(key.get_key(), key.key_size, 0, &skey);
+    for (size_t b = 0; b < blocks; b++)
+    {
+      aes_ecb_decrypt(reinterpret_cast<const unsigned char*>(ciphertext + b * 16), reinterpret_cast<unsigned char*>(expected + b * 16), &skey);
+      const char* previous = b == 0 ? iv : ciphertext + (b - 1) * 16;
+      for (size_t i = 0; i < 16; i++) expected[b * 16 + i] ^= previous[i];
+    }
+    aes_done(&skey);
+    std::memcpy(expected_iv, ciphertext + (blocks - 1) * 16, 16);
+
+    cryptography::detail::aes_cbc_block_decryptor decryptor(key.get_key());
+    decryptor.decrypt(ciphertext, plaintext, blocks, iv);
+
+    if (std::memcmp(plaintext, expected, sizeof(expected)) != 0 || std::memcmp(iv, expected_iv, 16) != 0)
+      throw std::runtime_error("The AES instructions did not decrypt correctly.");
+
+    // And encrypting the plaintext again gives the ciphertext
+    char encrypted[blocks * 16];
+    for (size_t i = 0; i < 16; i++) iv[i] = static_cast<char>(i * 3);
+    cryptography::detail::aes_cbc_block_encryptor encryptor(key.get_key());
+    encryptor.encrypt(plaintext, encrypted, blocks, iv);
+
+    if (std::memcmp(encrypted, ciphertext, sizeof(ciphertext)) != 0 || std::memcmp(iv, expected_iv, 16) != 0)
+      throw std::runtime_error("The AES instructions did not encrypt correctly.");
+  }
+
+  // Pass 7: writes of all sizes, mixed with single characters
+  {
+    std::string original(200000, '\0');
+    for (size_t i = 0; i < original.size(); i++) original[i] = static_cast<char>((i * 13) % 0xfd);
+
+    std::stringstream encrypted_data_stream;
+    cryptography::aes_cbc_encrypt_stream enc_stream(encrypted_data_stream, key);
+    const size_t sizes[] = { 1, 15, 17, 16, 5000, 16384, 20000, 3, 40000 };
+    size_t written = 0;
+    for (size_t i = 0; written < original.size(); i++)
+    {
+      const size_t size = std::min(sizes[i % (sizeof(sizes) / sizeof(sizes[0]))], original.size() - written);
+      if (size == 1) enc_stream.put(original[written]);
+      else enc_stream.write(original.data() + written, size);
+      written += size;
+    }
+    enc_stream.close();
+
+    if (encrypted_data_stream.str().size() != 16 + original.size() + 16 - original.size() % 16)
+      throw std::runtime_error("Unexpected encrypted size.");
+
+    std::stringstream decrypted;
+    cryptography::aes_cbc_decrypt_stream dec_stream(encrypted_data_stream, key);
+    decrypted << dec_stream.rdbuf();
+
+    if (decrypted.str() != original)
+      throw std::runtime_error("Data was not decrypted correctly.");
+  }
 }
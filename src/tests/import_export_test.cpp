@@ -16,9 +16,11 @@
 
 #include "import_export_test.h"
 #include "../core/core.h"
+#include "../core/errors.h"
 
 #include <stdexcept>
 #include <sstream>
+#include <string>
 
 using namespace deadlock::core;
 using namespace deadlock::tests;
@@ -80,4 +82,43 @@ void import_export_test::run()
 
   it++;
   if (it != third.end()) throw std::runtime_error("Incorrect number of entries encountered.");
+
+  // Members other than the version and entries are skipped, wherever they are
+  std::stringstream extra_members;
+  extra_members << "{ \"comment\": { \"entries\": [1, 2] }, \"version\": \"1.0.0.0\", \"entries\": [ "
+    << "{ \"id\": \"Fictional Identifier 3\", \"passwords\": [ { \"store_time\": 0, \"password\": \"hunter2\" } ] } ], "
+    << "\"tags\": [\"a\", \"b\"] }";
+  vault fourth;
+  fourth.import_json(extra_members);
+  if (fourth.get_entries().size() != 1 || fourth.get_entries().at(0)->get_password().get_password() != "hunter2")
+    throw std::runtime_error("Entries not read correctly around other members.");
+
+  // A document without entries is not an export
+  std::stringstream no_entries("{ \"version\": \"1.0.0.0\" }");
+  bool threw = false;
+  try { fourth.import_json(no_entries); }
+  catch (format_error&) { threw = true; }
+  if (!threw) throw std::runtime_error("A document without entries was accepted.");
+
+  // Anything but whitespace between the tokens is an error, and a failed import adds no entries,
+  // even when it fails after some entries were read
+  const char* ill_formed[] =
+  {
+    "{ \"version\": \"1.0.0.0\", \"entries\": [ { \"id\": \"a\", \"passwords\": [] } x { \"id\": \"b\", \"passwords\": [] } ] }",
+    "{ \"version\": \"1.0.0.0\" x \"entries\": [] }",
+    "{ \"version\" x: \"1.0.0.0\", \"entries\": [] }",
+    "x { \"version\": \"1.0.0.0\", \"entries\": [] }",
+    "{ \"version\": \"1.0.0.0\", \"entries\": [ { \"id\": \"a\", \"passwords\": [] }, ] }",
+    "{ \"version\": \"1.0.0.0\", \"entries\": [ { \"id\": \"a\", \"passwords\": [] }, { \"id\": \"b\", \"passwords\": [] }",
+    "{ \"version\": \"1.0.0.0\", \"entries\": [ { \"id\": \"a\", \"passwords\": [] } ] x }"
+  };
+  for (size_t i = 0; i < sizeof(ill_formed) / sizeof(ill_formed[0]); i++)
+  {
+    std::stringstream document(ill_formed[i]);
+    threw = false;
+    try { fourth.import_json(document); }
+    catch (std::runtime_error&) { threw = true; }
+    if (!threw) throw std::runtime_error("An ill-formed document was accepted: " + std::string(ill_formed[i]));
+    if (fourth.get_entries().size() != 1) throw std::runtime_error("A failed import added entries.");
+  }
 }
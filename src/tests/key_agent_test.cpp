@@ -0,0 +1,229 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "key_agent_test.h"
+#include "../core/core.h"
+#include "../core/endianness.h"
+#include "../core/key_agent.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+#endif
+
+#ifdef __linux__
+  #include <linux/keyctl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+using namespace deadlock::core;
+using namespace deadlock::tests;
+
+std::string key_agent_test::get_name()
+{
+  return "key_agent";
+}
+
+/// Returns whether the agent gives the key that was derived from the salt for the vault
+static bool agent_has_key(const std::string& socket_path, const std::string& vault_filename, const cryptography::key& key)
+{
+  cryptography::key found;
+  if (!key_agent::find_key(socket_path, vault_filename, key.get_salt(), key.get_iterations(), found)) return false;
+
+  if (!std::equal(key.get_key(), key.get_key() + cryptography::key::key_size, found.get_key()))
+    throw std::runtime_error("The agent gave a different key.");
+  if (!found.is_derived_from(key.get_salt(), key.get_iterations()))
+    throw std::runtime_error("The key from the agent does not know its salt.");
+
+  return true;
+}
+
+#ifndef _WIN32
+/// Asks the agent to store the key for the vault, like key_agent::store_key, but disconnects after half the key
+static void store_half_a_key(const std::string& socket_path, const std::string& vault_filename, const cryptography::key& key)
+{
+  char* resolved = realpath(vault_filename.c_str(), nullptr);
+  const std::string path = resolved != nullptr ? resolved : vault_filename;
+  std::free(resolved);
+
+  const std::uint32_t path_length = internal_to_portable(static_cast<std::uint32_t>(path.size()));
+  const std::uint32_t iterations = internal_to_portable(key.get_iterations());
+  std::string request(1, 'S');
+  request.append(reinterpret_cast<const char*>(&path_length), 4);
+  request += path;
+  request.append(reinterpret_cast<const char*>(key.get_salt()), cryptography::key::salt_size);
+  request.append(reinterpret_cast<const char*>(&iterations), 4);
+  request.append(reinterpret_cast<const char*>(key.get_key()), cryptography::key::key_size / 2);
+
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+  const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection < 0) throw std::runtime_error("Could not create a socket.");
+  const bool sent = connect(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0
+    && write(connection, request.data(), request.size()) == static_cast<ssize_t>(request.size());
+  close(connection);
+  if (!sent) throw std::runtime_error("Could not send a request to the agent.");
+}
+#endif
+
+/// Runs the requests against an agent that runs on another thread
+static void test_agent(const std::string& socket_path)
+{
+  cryptography::key key, other_key;
+  key.set_salt_random();
+  key.generate_key(*data::make_secure_string("correct horse battery staple"), 1);
+  other_key.set_salt_random();
+  other_key.generate_key(*data::make_secure_string("correct horse battery staple"), 1);
+
+  if (agent_has_key(socket_path, "test_key_agent.dlk", key)) throw std::runtime_error("The agent had a key before it was given one.");
+  if (!key_agent::store_key(socket_path, "test_key_agent.dlk", key)) throw std::runtime_error("The agent did not take the key.");
+  if (!agent_has_key(socket_path, "test_key_agent.dlk", key)) throw std::runtime_error("The agent did not keep the key.");
+
+  // The key belongs to one vault, with one salt and number of iterations
+  if (agent_has_key(socket_path, "test_key_agent_other.dlk", key)) throw std::runtime_error("The agent gave the key for another vault.");
+  if (agent_has_key(socket_path, "test_key_agent.dlk", other_key)) throw std::runtime_error("The agent gave the key for another salt.");
+  cryptography::key found;
+  if (key_agent::find_key(socket_path, "test_key_agent.dlk", key.get_salt(), key.get_iterations() + 1, found))
+    throw std::runtime_error("The agent gave the key for another number of iterations.");
+
+  // Storing a new key for the vault keeps both, because the file may be replaced by an older copy
+  if (!key_agent::store_key(socket_path, "test_key_agent.dlk", other_key)) throw std::runtime_error("The agent did not take the key.");
+  if (!agent_has_key(socket_path, "test_key_agent.dlk", key) || !agent_has_key(socket_path, "test_key_agent.dlk", other_key))
+    throw std::runtime_error("The agent did not keep both keys.");
+
+#ifndef _WIN32
+  // A client that disconnects while it sends a key leaves the key that was stored before
+  store_half_a_key(socket_path, "test_key_agent.dlk", key);
+  if (!agent_has_key(socket_path, "test_key_agent.dlk", key)) throw std::runtime_error("A key that was sent halfway replaced a stored key.");
+#endif
+
+  if (!key_agent::forget_keys(socket_path)) throw std::runtime_error("The agent did not forget the keys.");
+  if (agent_has_key(socket_path, "test_key_agent.dlk", key)) throw std::runtime_error("The agent still had a key after forgetting.");
+
+  // A key is forgotten when its time is up
+  key_agent::store_key(socket_path, "test_key_agent.dlk", key);
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  if (agent_has_key(socket_path, "test_key_agent.dlk", key)) throw std::runtime_error("The agent kept a key after it expired.");
+}
+
+/// Keeps a key in the session keyring, where there is one
+static void test_keyring()
+{
+#ifdef __linux__
+  // Forgetting the keyring revokes every key that was kept, so the test runs in a new, anonymous session keyring,
+  // which is only seen by this process, instead of the keyring that holds the keys of the user
+  if (syscall(SYS_keyctl, KEYCTL_JOIN_SESSION_KEYRING, nullptr) < 0) return;
+#endif
+
+  cryptography::key key, other_key;
+  key.set_salt_random();
+  key.generate_key(*data::make_secure_string("correct horse battery staple"), 1);
+  other_key.set_salt_random();
+  other_key.generate_key(*data::make_secure_string("correct horse battery staple"), 1);
+
+  // Without a keyring, or if the sandbox forbids it, nothing is kept
+  if (!key.keep_in_keyring(60)) return;
+
+  cryptography::key found;
+  if (!found.find_in_keyring(key.get_salt(), key.get_iterations())) throw std::runtime_error("The keyring did not keep the key.");
+  if (!std::equal(key.get_key(), key.get_key() + cryptography::key::key_size, found.get_key()) || !found.is_derived_from(key.get_salt(), key.get_iterations()))
+    throw std::runtime_error("The keyring gave a different key.");
+
+  if (found.find_in_keyring(other_key.get_salt(), other_key.get_iterations())) throw std::runtime_error("The keyring gave the key for another salt.");
+  if (found.find_in_keyring(key.get_salt(), key.get_iterations() + 1)) throw std::runtime_error("The keyring gave the key for another number of iterations.");
+
+  // Forgetting removes every key that was kept
+  other_key.keep_in_keyring(60);
+  if (cryptography::key::forget_keyring() < 2) throw std::runtime_error("The keyring did not forget the keys.");
+  if (found.find_in_keyring(other_key.get_salt(), other_key.get_iterations())) throw std::runtime_error("The keyring still had a key after forgetting.");
+
+  // A key is removed when its time is up
+  key.keep_in_keyring(1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  if (found.find_in_keyring(key.get_salt(), key.get_iterations())) throw std::runtime_error("The keyring kept a key after it expired.");
+}
+
+void key_agent_test::run()
+{
+  test_keyring();
+
+#ifndef _WIN32
+  const std::string socket_path = "test_key_agent.sock";
+
+  // Without an agent, there are no keys, but nothing fails either
+  cryptography::key key;
+  key.set_salt_random();
+  if (key_agent::find_key(socket_path, "test_key_agent.dlk", key.get_salt(), 1, key)) throw std::runtime_error("A key was found without an agent.");
+  if (key_agent::forget_keys(socket_path)) throw std::runtime_error("Keys were forgotten without an agent.");
+
+  std::atomic<bool> stopped(false);
+  std::exception_ptr error;
+  key_agent agent(socket_path, 1);
+
+  // A second agent must not take over the socket
+  try
+  {
+    key_agent second_agent(socket_path, 1);
+    throw std::logic_error("A second agent took over the socket.");
+  }
+  catch (std::runtime_error&)
+  {
+    // This is expected
+  }
+
+  std::thread agent_thread([&]()
+  {
+    try
+    {
+      agent.run(stopped);
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+  });
+
+  try
+  {
+    test_agent(socket_path);
+  }
+  catch (...)
+  {
+    stopped = true;
+    agent_thread.join();
+    throw;
+  }
+
+  stopped = true;
+  agent_thread.join();
+  if (error) std::rethrow_exception(error);
+#endif
+}
@@ -18,10 +18,15 @@
 #include <stdexcept>
 
 #include "test.h"
+#include "authenticated_encryption_test.h"
 #include "import_export_test.h"
 #include "compression_stream_test.h"
 #include "cryptography_stream_test.h"
+#include "key_agent_test.h"
+#include "pipeline_test.h"
 #include "save_load_test.h"
+#include "search_test.h"
+#include "search_session_test.h"
 
 using namespace deadlock::tests;
 
@@ -33,7 +38,12 @@ int main(int, char**)
     new import_export_test(),
     new compression_stream_test(),
     new cryptography_stream_test(),
-    new save_load_test()
+    new authenticated_encryption_test(),
+    new pipeline_test(),
+    new save_load_test(),
+    new key_agent_test(),
+    new search_test(),
+    new search_session_test()
   };
 
   const size_t number_of_tests = sizeof(unit_tests) / sizeof(test*);
@@ -0,0 +1,101 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "pipeline_test.h"
+#include "../core/pipeline.h"
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace deadlock::core;
+using namespace deadlock::tests;
+
+std::string pipeline_test::get_name()
+{
+  return "pipeline";
+}
+
+/// The error a stage throws when it was told to fail
+class injected_failure : public std::runtime_error
+{
+public:
+  explicit injected_failure(size_t stage) : std::runtime_error("Stage " + std::to_string(stage) + " failed.") { }
+};
+
+/// Passes the given number of items through a pipeline, and makes the given stage fail at the given item.
+/// Returns the items the sink received.
+static std::vector<std::string> run_items(size_t number_of_items, size_t failing_stage, size_t failing_item)
+{
+  std::vector<std::string> received;
+  run_pipeline<std::string>(2,
+    [&](const std::function<bool(std::string&&)>& push)
+    {
+      for (size_t i = 0; i < number_of_items; i++)
+      {
+        if (failing_stage == 0 && i == failing_item) throw injected_failure(0);
+        if (!push(std::to_string(i))) break;
+      }
+    },
+    [&](std::string& input, std::string& output)
+    {
+      if (failing_stage == 1 && input == std::to_string(failing_item)) throw injected_failure(1);
+      output = input + "!";
+    },
+    [&](std::string& output)
+    {
+      if (failing_stage == 2 && received.size() == failing_item) throw injected_failure(2);
+      received.push_back(output);
+    });
+  return received;
+}
+
+void pipeline_test::run()
+{
+  // Far more items than fit in the queues arrive in order
+  const size_t number_of_items = 10000;
+  std::vector<std::string> received = run_items(number_of_items, 3, 0);
+  if (received.size() != number_of_items) throw std::runtime_error("Incorrect number of items received.");
+  for (size_t i = 0; i < number_of_items; i++)
+  {
+    if (received[i] != std::to_string(i) + "!") throw std::runtime_error("Items were received out of order.");
+  }
+
+  // A pipeline without items finishes
+  if (!run_items(0, 3, 0).empty()) throw std::runtime_error("Items were received from an empty source.");
+
+  // A failure at the first item, while the queues fill up, and at the last item of every stage surfaces as exception,
+  // and the other stages stop instead of waiting forever
+  const size_t failing_items[] = { 0, 1, 3, 500, number_of_items - 1 };
+  for (size_t stage = 0; stage < 3; stage++)
+  {
+    for (size_t i = 0; i < sizeof(failing_items) / sizeof(failing_items[0]); i++)
+    {
+      try
+      {
+        run_items(number_of_items, stage, failing_items[i]);
+        throw std::logic_error("A failing stage was not reported.");
+      }
+      catch (injected_failure& ex)
+      {
+        if (std::string(ex.what()) != "Stage " + std::to_string(stage) + " failed.")
+          throw std::runtime_error("The failure of another stage was reported.");
+      }
+    }
+  }
+}
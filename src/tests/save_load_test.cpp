@@ -16,13 +16,833 @@
 
 #include "save_load_test.h"
 #include "../core/core.h"
+#include "../core/endianness.h"
+#include "../core/errors.h"
+#include "../core/cryptography/aes_cbc_encrypt_stream.h"
+#include "../core/cryptography/xz_compress_stream.h"
+#include "../core/search.h"
+#include "../core/serialisation/binary_serialiser.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
 
 using namespace deadlock::core;
 using namespace deadlock::tests;
 
+/// Validates that two entries hold the same data
+static void check_entry(const data::entry& loaded, const data::entry& original)
+{
+  if (loaded.get_id() != original.get_id()) throw std::runtime_error("Identifier not retrieved correctly.");
+  if (loaded.get_username() != original.get_username()) throw std::runtime_error("Username not retrieved correctly.");
+  if (loaded.get_password().get_password() != original.get_password().get_password()) throw std::runtime_error("Password not retrieved correctly.");
+  if (loaded.get_additional_data() != original.get_additional_data()) throw std::runtime_error("Additional data not retrieved correctly.");
+
+  // Including the history of passwords
+  if (loaded.passwords_end() - loaded.passwords_begin() != original.passwords_end() - original.passwords_begin())
+    throw std::runtime_error("Password history not retrieved correctly.");
+  for (auto l = loaded.passwords_begin(), o = original.passwords_begin(); l != loaded.passwords_end(); l++, o++)
+  {
+    if (l->get_password() != o->get_password()) throw std::runtime_error("Password not retrieved correctly.");
+    if (l->get_stored_time() != o->get_stored_time()) throw std::runtime_error("Password timestamp not retrieved correctly.");
+  }
+}
+
+/// Validates that the file holds the same entries as the vault
+static void check_file(const std::string& filename, const vault& original, const data::secure_string& passphrase)
+{
+  vault loaded;
+  cryptography::key key;
+  loaded.load(filename, key, passphrase);
+
+  if (loaded.get_entries().size() != original.get_entries().size()) throw std::runtime_error("Incorrect number of entries encountered.");
+  for (size_t i = 0; i < original.get_entries().size(); i++)
+  {
+    check_entry(*loaded.get_entries().at(i), *original.get_entries().at(i));
+  }
+}
+
+/// Saves a vault that spans many chunks, and loads it completely and one entry at a time
+static void test_chunks(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  vault first, second;
+  const size_t number_of_entries = 3000;
+
+  for (size_t i = 0; i < number_of_entries; i++)
+  {
+    data::entry_ptr etr = data::make_entry();
+    etr->set_id(*data::make_secure_string("Chunked Key " + std::to_string(i)));
+    etr->set_username(*data::make_secure_string("user " + std::to_string(i * 7)));
+    etr->set_password(*data::make_secure_string("password " + std::to_string(i * 13)));
+    etr->set_additional_data(data::secure_string(i % 100, 'x'));
+    if (i % 10 == 0) etr->set_password(*data::make_secure_string("newer password " + std::to_string(i)));
+    first.add_entry(etr);
+  }
+
+  // The entries take far more than one chunk
+  first.save("test_save_load_chunks.dlk", key);
+
+  // Load everything, the entries must be in the same order
+  cryptography::key second_key;
+  second.load("test_save_load_chunks.dlk", second_key, passphrase);
+  if (second.get_entries().size() != number_of_entries) throw std::runtime_error("Incorrect number of entries encountered.");
+  for (size_t i = 0; i < number_of_entries; i++)
+  {
+    check_entry(*second.get_entries().at(i), *first.get_entries().at(i));
+  }
+
+  // A stream that is not in memory is read one section at a time
+  std::ifstream file("test_save_load_chunks.dlk", std::ios::binary);
+  vault streamed;
+  cryptography::key streamed_key;
+  streamed.load(file, streamed_key, passphrase);
+  if (streamed.get_entries().size() != number_of_entries) throw std::runtime_error("Incorrect number of entries encountered.");
+  for (size_t i = 0; i < number_of_entries; i++)
+  {
+    check_entry(*streamed.get_entries().at(i), *first.get_entries().at(i));
+  }
+
+  file.clear();
+  file.seekg(0);
+  data::entry_ptr streamed_match = streamed.load_match(file, streamed_key, passphrase, search(), "Chunked Key 2017");
+  if (streamed_match == nullptr) throw std::runtime_error("Entry was not found in a chunked vault.");
+  check_entry(*streamed_match, *first.get_entries().at(2017));
+  file.close();
+
+  // Look up entries in the first, a middle, and the last chunk
+  search algorithm;
+  const size_t positions[] = { 0, 1, 1500, 2017, number_of_entries - 1 };
+  for (size_t i = 0; i < sizeof(positions) / sizeof(positions[0]); i++)
+  {
+    const data::entry& original = *first.get_entries().at(positions[i]);
+
+    vault third;
+    cryptography::key third_key;
+    data::entry_ptr match = third.load_match("test_save_load_chunks.dlk", third_key, passphrase, algorithm, original.get_id());
+    if (match == nullptr) throw std::runtime_error("Entry was not found in a chunked vault.");
+    check_entry(*match, original);
+  }
+
+  // Compressing with several threads splits the chunk directory into blocks, which one thread can still read
+  first.set_compression_threads(4);
+  first.set_compression_block_size(4096);
+  first.save("test_save_load_chunks_threaded.dlk", key);
+  check_file("test_save_load_chunks_threaded.dlk", first, passphrase);
+
+  // Loading lazily leaves the passwords encoded until they are read, and saving writes them as they were read
+  vault lazy;
+  cryptography::key lazy_key;
+  lazy.set_lazy_loading(true);
+  lazy.load("test_save_load_chunks.dlk", lazy_key, passphrase);
+  check_entry(*lazy.get_entries().at(1234), *first.get_entries().at(1234));
+  lazy.save("test_save_load_chunks_lazy.dlk", key);
+  check_file("test_save_load_chunks_lazy.dlk", first, passphrase);
+
+  // A new password is added to the decoded history
+  data::entry_ptr changed = lazy.get_entries().at(20);
+  changed->set_password("lazily changed");
+  if (changed->passwords_end() - changed->passwords_begin() != 3 || changed->passwords_begin()[2].get_password() != "password 260")
+    throw std::runtime_error("Password history not retrieved correctly.");
+
+  // Something that does not match anything
+  vault fourth;
+  cryptography::key fourth_key;
+  if (fourth.load_match("test_save_load_chunks.dlk", fourth_key, passphrase, algorithm, "qqqqqq") != nullptr)
+    throw std::runtime_error("Found an entry that does not match.");
+
+  // The directory must not be readable with another passphrase
+  try
+  {
+    vault fifth;
+    cryptography::key fifth_key;
+    fifth.load_match("test_save_load_chunks.dlk", fifth_key, "Tr0ub4dor&3", algorithm, "Chunked Key 1");
+    throw std::logic_error("A chunked vault was read with an incorrect passphrase.");
+  }
+  catch (incorrect_key_error&)
+  {
+    // This is expected
+  }
+}
+
+/// Returns the size of a file in bytes
+static std::streamoff file_size(const std::string& filename)
+{
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  return file.tellg();
+}
+
+/// Saves and loads a vault that is many times larger than the chunks in flight in the save and load pipelines
+static void test_large_save(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  vault first;
+  const size_t number_of_entries = 4000;
+
+  // Data that does not compress keeps the chunks large
+  std::uint32_t state = 2718;
+  for (size_t i = 0; i < number_of_entries; i++)
+  {
+    data::secure_string additional_data(1000, ' ');
+    for (size_t j = 0; j < additional_data.size(); j++)
+    {
+      state = state * 1103515245 + 12345;
+      additional_data[j] = static_cast<char>('!' + (state >> 16) % 90);
+    }
+
+    data::entry_ptr etr = data::make_entry();
+    etr->set_id(*data::make_secure_string("Large Key " + std::to_string(i)));
+    etr->set_password(*data::make_secure_string("password " + std::to_string(i)));
+    etr->set_additional_data(additional_data);
+    first.add_entry(etr);
+  }
+
+  first.save("test_save_load_large.dlk", key);
+
+  vault second;
+  cryptography::key second_key;
+  second.load("test_save_load_large.dlk", second_key, passphrase);
+  if (second.get_entries().size() != number_of_entries) throw std::runtime_error("Incorrect number of entries encountered.");
+  for (size_t i = 0; i < number_of_entries; i++)
+  {
+    check_entry(*second.get_entries().at(i), *first.get_entries().at(i));
+  }
+}
+
+/// Damages a copy of the chunked vault written by test_chunks, and validates that loading it fails rather than hangs,
+/// whichever stage of loading notices the damage
+static void test_damaged_chunks(const data::secure_string& passphrase)
+{
+  std::string contents;
+  {
+    std::ifstream file("test_save_load_chunks.dlk", std::ios::binary);
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+  }
+
+  // Cut off the last chunk halfway
+  {
+    std::ofstream file("test_save_load_damaged.dlk", std::ios::binary);
+    file.write(contents.data(), contents.size() - 100);
+  }
+  try
+  {
+    vault damaged;
+    cryptography::key damaged_key;
+    damaged.load("test_save_load_damaged.dlk", damaged_key, passphrase);
+    throw std::logic_error("A truncated vault was loaded.");
+  }
+  catch (format_error&)
+  {
+    // This is expected
+  }
+
+  // Change a byte in a chunk halfway the file, which garbles the compressed data
+  bool loaded = false;
+  {
+    std::string damaged_contents = contents;
+    damaged_contents[damaged_contents.size() / 2] ^= 0x55;
+    std::ofstream file("test_save_load_damaged.dlk", std::ios::binary);
+    file.write(damaged_contents.data(), damaged_contents.size());
+  }
+  try
+  {
+    vault damaged;
+    cryptography::key damaged_key;
+    damaged.load("test_save_load_damaged.dlk", damaged_key, passphrase);
+    loaded = true;
+  }
+  catch (std::exception&)
+  {
+    // This is expected
+  }
+  if (loaded) throw std::logic_error("A damaged vault was loaded.");
+}
+
+/// Writes changes to single entries to the journal of a vault, and folds the journal into the vault
+static void test_journal(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  const std::string filename = "test_save_load_journal.dlk";
+  vault first;
+
+  for (size_t i = 0; i < 300; i++)
+  {
+    data::entry_ptr etr = data::make_entry();
+    etr->set_id(*data::make_secure_string("Journal Key " + std::to_string(i)));
+    etr->set_password(*data::make_secure_string("password " + std::to_string(i)));
+    first.add_entry(etr);
+  }
+  first.save(filename, key);
+  const std::streamoff base_size = file_size(filename);
+
+  // Change an entry, which only appends a record
+  vault second;
+  cryptography::key second_key;
+  second.load(filename, second_key, passphrase);
+  data::entry_ptr changed = second.get_entries().at(42);
+  changed->set_username("LeChuck");
+  changed->set_password("a new password");
+  second.save_entry(filename, second_key, changed);
+  if (file_size(filename) <= base_size || file_size(filename) > base_size + 1024)
+    throw std::runtime_error("A changed entry was not appended to the journal.");
+  check_file(filename, second, passphrase);
+
+  // Add three entries, but write only the last, which writes the others too
+  for (size_t i = 0; i < 3; i++)
+  {
+    data::entry_ptr etr = data::make_entry();
+    etr->set_id(*data::make_secure_string("Added Key " + std::to_string(i)));
+    etr->set_password("added");
+    second.add_entry(etr);
+  }
+  second.save_entry(filename, second_key, second.get_entries().at(302));
+  check_file(filename, second, passphrase);
+
+  // Writing an older entry again after that must not write the added entries again
+  const std::streamoff journal_size = file_size(filename);
+  second.save_entry(filename, second_key, changed);
+  if (file_size(filename) - journal_size > 512) throw std::runtime_error("Entries were written to the journal twice.");
+  check_file(filename, second, passphrase);
+
+  // A lookup sees the entries in the journal
+  search algorithm;
+  vault third;
+  cryptography::key third_key;
+  data::entry_ptr match = third.load_match(filename, third_key, passphrase, algorithm, "journal key 42");
+  if (match == nullptr) throw std::runtime_error("Entry was not found in the journal.");
+  check_entry(*match, *changed);
+  match = third.load_match(filename, third_key, passphrase, algorithm, "added key 1");
+  if (match == nullptr) throw std::runtime_error("Entry was not found in the journal.");
+  check_entry(*match, *second.get_entries().at(301));
+  match = third.load_match(filename, third_key, passphrase, algorithm, "journal key 43");
+  if (match == nullptr) throw std::runtime_error("Entry was not found in a chunk.");
+  check_entry(*match, *second.get_entries().at(43));
+
+  // Changing an entry over and over eventually folds the journal into the vault, which makes the file smaller
+  vault fourth;
+  cryptography::key fourth_key;
+  fourth.load(filename, fourth_key, passphrase);
+  std::uint32_t state = 1;
+  bool compacted = false;
+  for (size_t i = 0; i < 200 && !compacted; i++)
+  {
+    data::secure_string data;
+    for (size_t j = 0; j < 1000; j++)
+    {
+      state = state * 1103515245 + 12345;
+      data += static_cast<char>('a' + (state >> 16) % 26);
+    }
+
+    const std::streamoff previous_size = file_size(filename);
+    fourth.get_entries().at(7)->set_additional_data(data);
+    fourth.save_entry(filename, fourth_key, fourth.get_entries().at(7));
+    compacted = file_size(filename) < previous_size;
+  }
+  if (!compacted) throw std::runtime_error("The journal was never folded into the vault.");
+  check_file(filename, fourth, passphrase);
+}
+
+/// Loads a vault whose last journal record was cut off while it was appended
+static void test_torn_journal(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  const std::string filename = "test_save_load_torn.dlk";
+  vault first;
+  for (size_t i = 0; i < 10; i++)
+  {
+    data::entry_ptr etr = data::make_entry();
+    etr->set_id(*data::make_secure_string("Torn Key " + std::to_string(i)));
+    etr->set_password(*data::make_secure_string("password " + std::to_string(i)));
+    first.add_entry(etr);
+  }
+  first.save(filename, key);
+
+  // One record that stays, and one that is cut off
+  first.get_entries().at(3)->set_password("kept");
+  first.save_entry(filename, key, first.get_entries().at(3));
+  const std::streamoff complete_size = file_size(filename);
+
+  vault expected;
+  cryptography::key expected_key;
+  expected.load(filename, expected_key, passphrase);
+
+  first.get_entries().at(5)->set_password("cut off");
+  first.save_entry(filename, key, first.get_entries().at(5));
+
+  std::ifstream torn_file(filename, std::ios::binary);
+  const std::string torn((std::istreambuf_iterator<char>(torn_file)), std::istreambuf_iterator<char>());
+  torn_file.close();
+
+  // Cut off inside the length of the record, inside its complement, and inside the record, like a crash while it was written
+  const std::streamoff sizes[] = { complete_size + 2, complete_size + 4, complete_size + 6, complete_size + 8,
+    static_cast<std::streamoff>(torn.size()) - 1 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(std::streamoff); i++)
+  {
+    std::ofstream(filename, std::ios::binary | std::ios::trunc).write(torn.data(), sizes[i]);
+
+    check_file(filename, expected, passphrase);
+
+    search algorithm;
+    vault matched;
+    cryptography::key matched_key;
+    data::entry_ptr match = matched.load_match(filename, matched_key, passphrase, algorithm, "torn key 3");
+    if (match == nullptr) throw std::runtime_error("Entry was not found before a torn record.");
+    check_entry(*match, *expected.get_entries().at(3));
+
+    // Appending after the torn record would hide the new one, so the file is rewritten instead
+    vault changed;
+    cryptography::key changed_key;
+    changed.load(filename, changed_key, passphrase);
+    changed.get_entries().at(7)->set_password("after the crash");
+    changed.save_entry(filename, changed_key, changed.get_entries().at(7));
+    check_file(filename, changed, passphrase);
+  }
+}
+
+/// Saves a vault with every compression profile, loads it without being told the profile, and changes the profile
+static void test_compression_profiles(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  const std::string filename = "test_save_load_profiles.dlk";
+  vault first;
+
+  for (size_t i = 0; i < 500; i++)
+  {
+    data::entry_ptr etr = data::make_entry();
+    etr->set_id(*data::make_secure_string("Profile Key " + std::to_string(i)));
+    etr->set_password(*data::make_secure_string("password " + std::to_string(i)));
+    etr->set_additional_data(data::secure_string(100, 'p'));
+    first.add_entry(etr);
+  }
+
+  const vault::compression_profile profiles[] =
+    { vault::compression_none, vault::compression_fast, vault::compression_default, vault::compression_extreme };
+  std::streamoff sizes[4];
+  for (size_t p = 0; p < 4; p++)
+  {
+    first.set_compression_profile(profiles[p]);
+    first.save(filename, key);
+    sizes[p] = file_size(filename);
+    check_file(filename, first, passphrase);
+
+    vault loaded;
+    cryptography::key loaded_key;
+    loaded.load(filename, loaded_key, passphrase);
+    if (loaded.get_compression_profile() != profiles[p]) throw std::runtime_error("Compression profile not retrieved correctly.");
+  }
+
+  // The entries are repetitive, so compression must pay off
+  if (sizes[0] <= sizes[1] || sizes[0] <= sizes[2]) throw std::runtime_error("Compression did not make the vault smaller.");
+
+  // Changing the profile of a loaded vault rewrites the file on the next change, instead of appending to the journal
+  vault second;
+  cryptography::key second_key;
+  second.load(filename, second_key, passphrase);
+  second.set_compression_profile(vault::compression_none);
+  data::entry_ptr changed = second.get_entries().at(7);
+  changed->set_password("a new password");
+  second.save_entry(filename, second_key, changed);
+  if (file_size(filename) < sizes[0]) throw std::runtime_error("Changing the compression profile did not rewrite the vault.");
+  check_file(filename, second, passphrase);
+
+  // After that, changes go to the journal again, compressed like the file
+  changed->set_password("another new password");
+  second.save_entry(filename, second_key, changed);
+  check_file(filename, second, passphrase);
+
+  vault third;
+  cryptography::key third_key;
+  third.load(filename, third_key, passphrase);
+  if (third.get_compression_profile() != vault::compression_none) throw std::runtime_error("Compression profile not retrieved correctly.");
+}
+
+/// Returns a big-endian 32-bit integer as a string of four bytes
+static std::string portable_integer(std::uint32_t value)
+{
+  value = internal_to_portable(value);
+  return std::string(reinterpret_cast<const char*>(&value), 4);
+}
+
+/// Writes the header of a vault of version 1.minor
+static void write_header(std::ostream& file, const cryptography::key& key, char minor)
+{
+  file.put('D'); file.put('L'); file.put('K'); file.put(0);
+  file.put(1); file.put(minor); file.put(0); file.put(0);
+
+  file << portable_integer(key.get_iterations());
+  file.write(reinterpret_cast<const char*>(key.get_salt()), key.salt_size);
+}
+
+/// Compresses and encrypts the plaintext like a vault does, preceded by the bytes that validate the key
+static std::string encrypt(const cryptography::key& key, const std::string& plaintext)
+{
+  std::ostringstream ciphertext;
+  {
+    cryptography::aes_cbc_encrypt_stream encrypt_stream(ciphertext, key);
+    cryptography::xz_compress_stream compress_stream(encrypt_stream, 6);
+    encrypt_stream.write(reinterpret_cast<const char*>(key.get_salt()), 16);
+    compress_stream << plaintext;
+    compress_stream.close();
+    encrypt_stream.close();
+  }
+  return ciphertext.str();
+}
+
+/// Writes the contents to the file, and validates that loading it fails with a format_error
+static void expect_damaged_journal(const std::string& filename, const std::string& contents, const data::secure_string& passphrase,
+  const char* change)
+{
+  std::ofstream(filename, std::ios::binary | std::ios::trunc).write(contents.data(), contents.size());
+  try
+  {
+    vault damaged;
+    cryptography::key damaged_key;
+    damaged.load(filename, damaged_key, passphrase);
+  }
+  catch (format_error&)
+  {
+    return;
+  }
+  throw std::runtime_error(std::string("A vault was loaded although ") + change + ".");
+}
+
+/// Damages the length of a record in the middle of the journal, and validates that loading fails,
+/// rather than dropping that record and those after it as if it had been cut off
+static void test_damaged_journal(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  const std::string filename = "test_save_load_damaged_journal.dlk";
+  vault first;
+  for (size_t i = 0; i < 10; i++)
+  {
+    data::entry_ptr etr = data::make_entry();
+    etr->set_id(*data::make_secure_string("Damaged Key " + std::to_string(i)));
+    etr->set_password(*data::make_secure_string("password " + std::to_string(i)));
+    first.add_entry(etr);
+  }
+  first.save(filename, key);
+  const size_t base_size = static_cast<size_t>(file_size(filename));
+
+  for (size_t i = 2; i < 8; i += 2)
+  {
+    first.get_entries().at(i)->set_password("journalled");
+    first.save_entry(filename, key, first.get_entries().at(i));
+  }
+
+  std::string contents;
+  {
+    std::ifstream file(filename, std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+
+  // The first record follows the chunks, and its length is followed by its complement
+  std::string damaged = contents;
+  damaged[base_size] ^= 0x40;
+  expect_damaged_journal(filename, damaged, passphrase, "the length of a record reaches past the end");
+
+  damaged = contents;
+  damaged[base_size + 3] ^= 0x01;
+  expect_damaged_journal(filename, damaged, passphrase, "the length of a record was changed");
+
+  // Before version 1.5 a length has no complement, so it is only taken for a record that was cut off
+  // if the rest of the file is too short to hold another record
+  std::string chunk_plaintext, records;
+  {
+    data::secure_string chunk;
+    serialisation::binary_serialiser serialiser(chunk);
+    first.get_entries().at(0)->serialise(serialiser);
+    chunk_plaintext.assign(chunk.data(), chunk.size());
+  }
+  for (std::uint32_t position = 0; position < 2; position++)
+  {
+    data::secure_string record_entry;
+    serialisation::binary_serialiser serialiser(record_entry);
+    first.get_entries().at(position)->serialise(serialiser);
+    const std::string record = encrypt(key, portable_integer(position) + std::string(record_entry.data(), record_entry.size()));
+    records += portable_integer(static_cast<std::uint32_t>(record.size())) + record;
+  }
+
+  const std::string chunk = encrypt(key, chunk_plaintext);
+  const data::secure_string& id = first.get_entries().at(0)->get_id();
+  const std::string directory = encrypt(key, portable_integer(1) + portable_integer(1) + portable_integer(static_cast<std::uint32_t>(chunk.size()))
+    + portable_integer(static_cast<std::uint32_t>(id.size())) + id.c_str());
+
+  std::ostringstream cbc_file;
+  write_header(cbc_file, key, 4);
+  cbc_file.put(static_cast<char>(vault::compression_default));
+  cbc_file << portable_integer(static_cast<std::uint32_t>(directory.size())) << directory << chunk;
+  const std::string cbc_base = cbc_file.str();
+
+  std::ofstream(filename, std::ios::binary | std::ios::trunc).write((cbc_base + records).data(), cbc_base.size() + records.size());
+  vault cbc;
+  cryptography::key cbc_key;
+  cbc.load(filename, cbc_key, passphrase);
+  if (cbc.get_entries().size() != 2) throw std::runtime_error("The journal of a CBC vault was not replayed.");
+
+  damaged = cbc_base + records;
+  damaged[cbc_base.size()] ^= 0x40;
+  expect_damaged_journal(filename, damaged, passphrase, "the length of a record without a complement reaches past the end");
+}
+
+/// Writes a vault in the format of version 1.4 with the given directory plaintext and no chunks,
+/// and validates that loading it, or only the entry that matches, fails with a format_error
+static void expect_damaged_directory(const cryptography::key& key, const data::secure_string& passphrase,
+  const std::string& directory_plaintext, bool match, const char* change)
+{
+  const std::string filename = "test_save_load_damaged_directory.dlk";
+  {
+    const std::string directory = encrypt(key, directory_plaintext);
+    std::ofstream file(filename, std::ios::binary);
+    write_header(file, key, 4);
+    file.put(static_cast<char>(vault::compression_default));
+    file << portable_integer(static_cast<std::uint32_t>(directory.size())) << directory;
+  }
+
+  try
+  {
+    vault damaged;
+    cryptography::key damaged_key;
+    search algorithm;
+    if (match) damaged.load_match(filename, damaged_key, passphrase, algorithm, "damaged");
+    else damaged.load(filename, damaged_key, passphrase);
+  }
+  catch (format_error&)
+  {
+    return;
+  }
+  throw std::runtime_error(std::string("A vault was loaded although ") + change + ".");
+}
+
+/// Damages the counts in the directory of a vault whose sections are not authenticated, which must fail
+/// with a format_error rather than allocate what the count claims
+static void test_damaged_directory(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  expect_damaged_directory(key, passphrase, portable_integer(0x7fffffff) + portable_integer(1) + portable_integer(100), false,
+    "its directory claims more chunks than it lists");
+  expect_damaged_directory(key, passphrase, portable_integer(1) + portable_integer(1) + portable_integer(100)
+    + portable_integer(0xfffffff0) + "damaged", true, "an identifier in its directory claims more bytes than there are");
+}
+
+/// Writes a vault in the format of version 1.2, which stored chunks and journal records as JSON, and loads it
+static void test_json_chunks(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  const std::string filename = "test_save_load_json_chunks.dlk";
+  const std::string chunk = "[{\"id\":\"JSON Key 1\",\"username\":\"Stan\",\"passwords\":[{\"password\":\"first\",\"store_time\":1000}]},"
+    "{\"id\":\"JSON Key 2\",\"passwords\":[{\"password\":\"third\",\"store_time\":3000},{\"password\":\"second\",\"store_time\":2000}]}]";
+  const std::string record = portable_integer(0) +
+    "{\"id\":\"JSON Key 1\",\"additional_data\":\"changed\",\"passwords\":[{\"password\":\"fourth\",\"store_time\":4000}]}";
+
+  {
+    const std::string chunk_ciphertext = encrypt(key, chunk);
+    const std::string directory = encrypt(key, portable_integer(1) + portable_integer(2) +
+      portable_integer(static_cast<std::uint32_t>(chunk_ciphertext.size())) +
+      portable_integer(10) + "JSON Key 1" + portable_integer(10) + "JSON Key 2");
+    const std::string record_ciphertext = encrypt(key, record);
+
+    std::ofstream file(filename, std::ios::binary);
+    write_header(file, key, 2);
+    file << portable_integer(static_cast<std::uint32_t>(directory.size())) << directory << chunk_ciphertext;
+    file << portable_integer(static_cast<std::uint32_t>(record_ciphertext.size())) << record_ciphertext;
+  }
+
+  vault first;
+  cryptography::key first_key;
+  first.load(filename, first_key, passphrase);
+  if (first.get_entries().size() != 2) throw std::runtime_error("Incorrect number of entries encountered.");
+
+  const data::entry& changed = *first.get_entries().at(0);
+  if (changed.get_id() != "JSON Key 1" || changed.get_username() != "" || changed.get_additional_data() != "changed" ||
+    changed.get_password().get_password() != "fourth" || changed.get_password().get_stored_time() != 4000)
+    throw std::runtime_error("Journal record not retrieved correctly.");
+
+  const data::entry& unchanged = *first.get_entries().at(1);
+  if (unchanged.get_id() != "JSON Key 2" || unchanged.get_password().get_password() != "third" ||
+    unchanged.get_password().get_stored_time() != 3000 || unchanged.passwords_end() - unchanged.passwords_begin() != 2)
+    throw std::runtime_error("Entry not retrieved correctly.");
+
+  vault second;
+  cryptography::key second_key;
+  data::entry_ptr match = second.load_match(filename, second_key, passphrase, search(), "json key 2");
+  if (match == nullptr) throw std::runtime_error("Entry was not found in a vault with JSON chunks.");
+  check_entry(*match, unchanged);
+
+  // A journal record cannot be written in the old format, so the vault is saved in the current format
+  first.get_entries().at(1)->set_password("fifth");
+  first.save_entry(filename, first_key, first.get_entries().at(1));
+
+  std::ifstream file(filename, std::ios::binary);
+  if (vault::read_version(file) < assembly_information::get_version()) throw std::runtime_error("An old vault was not rewritten.");
+  file.close();
+  check_file(filename, first, passphrase);
+}
+
+/// Writes a vault in the format of version 1.4, whose sections were encrypted with AES CBC, and loads it
+static void test_cbc_chunks(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  const std::string filename = "test_save_load_cbc_chunks.dlk";
+  vault original;
+  for (size_t i = 0; i < 4; i++)
+  {
+    data::entry_ptr etr = data::make_entry();
+    etr->set_id(*data::make_secure_string("CBC Key " + std::to_string(i)));
+    etr->set_username("LeChuck");
+    etr->set_password(*data::make_secure_string("chained block " + std::to_string(i)));
+    original.add_entry(etr);
+  }
+
+  {
+    // Two chunks of two entries, so they are decrypted on a thread of their own
+    std::string chunk_ciphertexts[2], directory_plaintext = portable_integer(2);
+    for (size_t c = 0; c < 2; c++)
+    {
+      data::secure_string chunk;
+      serialisation::binary_serialiser serialiser(chunk);
+      original.get_entries().at(2 * c)->serialise(serialiser);
+      original.get_entries().at(2 * c + 1)->serialise(serialiser);
+
+      chunk_ciphertexts[c] = encrypt(key, std::string(chunk.data(), chunk.size()));
+      directory_plaintext += portable_integer(2) + portable_integer(static_cast<std::uint32_t>(chunk_ciphertexts[c].size()));
+    }
+    for (auto e = original.begin(); e != original.end(); e++)
+    {
+      directory_plaintext += portable_integer(static_cast<std::uint32_t>(e->get_id().size())) + e->get_id().c_str();
+    }
+    const std::string directory = encrypt(key, directory_plaintext);
+
+    std::ofstream file(filename, std::ios::binary);
+    write_header(file, key, 4);
+    file.put(static_cast<char>(vault::compression_default));
+    file << portable_integer(static_cast<std::uint32_t>(directory.size())) << directory << chunk_ciphertexts[0] << chunk_ciphertexts[1];
+  }
+
+  vault first;
+  cryptography::key first_key;
+  first.load(filename, first_key, passphrase);
+  if (first.get_entries().size() != 4) throw std::runtime_error("Incorrect number of entries encountered.");
+  for (size_t i = 0; i < 4; i++)
+  {
+    check_entry(*first.get_entries().at(i), *original.get_entries().at(i));
+  }
+
+  // A journal record cannot be encrypted like the rest of the file, so the vault is saved in the current format
+  first.get_entries().at(3)->set_password("authenticated");
+  first.save_entry(filename, first_key, first.get_entries().at(3));
+
+  std::ifstream file(filename, std::ios::binary);
+  if (vault::read_version(file) < assembly_information::get_version()) throw std::runtime_error("An old vault was not rewritten.");
+  file.close();
+  check_file(filename, first, passphrase);
+}
+
+/// Writes a vault in the format of version 1.1, which was one stream of JSON, and loads it
+static void test_unchunked(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  vault first, second, third;
+
+  data::entry_ptr etr = data::make_entry();
+  etr->set_id("Unchunked Key");
+  etr->set_username("Elaine Marley");
+  etr->set_password("not a chunk in sight");
+  first.add_entry(etr);
+
+  std::stringstream json;
+  first.export_json(json, false);
+
+  {
+    std::ofstream file("test_save_load_unchunked.dlk", std::ios::binary);
+    write_header(file, key, 1);
+    file << encrypt(key, json.str());
+  }
+
+  cryptography::key second_key;
+  second.load("test_save_load_unchunked.dlk", second_key, passphrase);
+  if (vault::is_chunked(second.get_version())) throw std::runtime_error("Version not retrieved correctly.");
+  if (second.get_entries().size() != 1) throw std::runtime_error("Incorrect number of entries encountered.");
+  check_entry(*second.get_entries().at(0), *etr);
+
+  cryptography::key third_key;
+  data::entry_ptr match = third.load_match("test_save_load_unchunked.dlk", third_key, passphrase, search(), "unchunked");
+  if (match == nullptr) throw std::runtime_error("Entry was not found in an unchunked vault.");
+  check_entry(*match, *etr);
+
+  // Changing an entry cannot be written to a journal, so the vault is saved in the current format
+  data::entry_ptr loaded = second.get_entries().at(0);
+  loaded->set_password("chunked now");
+  second.save_entry("test_save_load_unchunked.dlk", second_key, loaded);
+
+  std::ifstream file("test_save_load_unchunked.dlk", std::ios::binary);
+  if (!vault::is_chunked(vault::read_version(file))) throw std::runtime_error("An unchunked vault was not rewritten.");
+  file.close();
+  check_file("test_save_load_unchunked.dlk", second, passphrase);
+}
+
+/// Tests loading a vault with a key that was derived before, without the passphrase
+static void test_derived_key(const cryptography::key& key, const data::secure_string& passphrase)
+{
+  vault original;
+  data::entry_ptr etr = data::make_entry();
+  etr->set_id("Derived Key");
+  etr->set_password("no passphrase needed");
+  original.add_entry(etr);
+  original.save("test_save_load_derived.dlk", key);
+
+  // The salt and iterations of the vault identify the key
+  std::uint8_t salt[cryptography::key::salt_size];
+  std::uint32_t iterations;
+  vault::read_key_parameters("test_save_load_derived.dlk", salt, iterations);
+  if (iterations != key.get_iterations() || !std::equal(salt, salt + sizeof(salt), key.get_salt()))
+    throw std::runtime_error("The key parameters were not read correctly.");
+
+  cryptography::key restored;
+  restored.restore_key(salt, iterations, key.get_key());
+  if (!restored.is_derived_from(key.get_salt(), key.get_iterations())) throw std::runtime_error("The restored key does not know its salt.");
+
+  vault loaded;
+  loaded.load("test_save_load_derived.dlk", restored);
+  if (loaded.get_entries().size() != 1) throw std::runtime_error("Incorrect number of entries encountered.");
+  check_entry(*loaded.get_entries().at(0), *etr);
+
+  vault matched;
+  search algorithm;
+  data::entry_ptr match = matched.load_match("test_save_load_derived.dlk", restored, algorithm, *data::make_secure_string("derived"));
+  if (match == nullptr) throw std::runtime_error("No entry was found with a derived key.");
+  check_entry(*match, *etr);
+
+  // A key for another salt is refused before anything is decrypted
+  cryptography::key other_salt;
+  salt[0] ^= 1;
+  other_salt.restore_key(salt, iterations, key.get_key());
+  try
+  {
+    vault refused;
+    refused.load("test_save_load_derived.dlk", other_salt);
+    throw std::logic_error("A key for another salt was accepted.");
+  }
+  catch (incorrect_key_error&)
+  {
+    // This is expected
+  }
+
+  // So is a key with the right salt but the wrong bytes
+  std::uint8_t wrong_key[cryptography::key::key_size];
+  std::copy(key.get_key(), key.get_key() + sizeof(wrong_key), wrong_key);
+  wrong_key[0] ^= 1;
+  cryptography::key wrong;
+  wrong.restore_key(key.get_salt(), key.get_iterations(), wrong_key);
+  try
+  {
+    vault refused;
+    refused.load("test_save_load_derived.dlk", wrong);
+    throw std::logic_error("An incorrect key was accepted.");
+  }
+  catch (incorrect_key_error&)
+  {
+    // This is expected
+  }
+
+  // And the passphrase still works
+  check_file("test_save_load_derived.dlk", original, passphrase);
+}
+
 std::string save_load_test::get_name()
 {
   return "save_load";
@@ -85,4 +905,31 @@ void save_load_test::run()
   vault third, fourth;
   third.save("test_save_load_empty.dlk", key);
   fourth.load("test_save_load_empty.dlk", key, *passphrase);
+  if (fourth.begin() != fourth.end()) throw std::runtime_error("Incorrect number of entries encountered.");
+
+  // An empty file is not a vault
+  std::ofstream("test_save_load_nothing.dlk", std::ios::binary).close();
+  try
+  {
+    vault fifth;
+    fifth.load("test_save_load_nothing.dlk", key, *passphrase);
+    throw std::logic_error("An empty file was loaded as vault.");
+  }
+  catch (format_error&)
+  {
+    // This is expected
+  }
+
+  test_chunks(key, *passphrase);
+  test_large_save(key, *passphrase);
+  test_damaged_chunks(*passphrase);
+  test_journal(key, *passphrase);
+  test_torn_journal(key, *passphrase);
+  test_compression_profiles(key, *passphrase);
+  test_json_chunks(key, *passphrase);
+  test_cbc_chunks(key, *passphrase);
+  test_damaged_journal(key, *passphrase);
+  test_damaged_directory(key, *passphrase);
+  test_unchunked(key, *passphrase);
+  test_derived_key(key, *passphrase);
 }
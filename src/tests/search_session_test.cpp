@@ -0,0 +1,111 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "search_session_test.h"
+#include "../core/core.h"
+#include "../core/search.h"
+#include "../core/search_session.h"
+
+#include <stdexcept>
+#include <iterator>
+#include <vector>
+
+using namespace deadlock::core;
+using namespace deadlock::tests;
+
+std::string search_session_test::get_name()
+{
+  return "search_session";
+}
+
+/// Verifies that the session gives the same result as a new search
+void check_session_query(search_session& session, const search& s, const vault& v, const data::secure_string& query)
+{
+  std::vector<data::entry_ptr> expected, actual, expected_top, actual_top;
+  s.find_matches(query, v.get_entries(), std::back_inserter(expected));
+  session.find_matches(query, std::back_inserter(actual));
+
+  if (expected != actual)
+    throw std::runtime_error("Session search differs from search for '" + std::string(query.c_str()) + "'.");
+
+  s.find_best_matches(query, v.get_entries(), 3, std::back_inserter(expected_top));
+  session.find_best_matches(query, 3, std::back_inserter(actual_top));
+
+  if (expected_top != actual_top || session.find_match(query) != s.find_match(query, v.get_entries()))
+    throw std::runtime_error("Session top matches differ from search for '" + std::string(query.c_str()) + "'.");
+}
+
+/// Types the query one character at a time, and then deletes it again
+void type_query(search_session& session, const search& s, const vault& v, const char* query)
+{
+  const data::secure_string full = query;
+
+  for (size_t i = 0; i <= full.size(); i++) check_session_query(session, s, v, full.substr(0, i));
+  for (size_t i = full.size(); i > 0; i--) check_session_query(session, s, v, full.substr(0, i - 1));
+}
+
+void search_session_test::run()
+{
+  const char* words[] =
+  {
+    "GitHub", "Enterprise", "mail", "google", "com", "Hub", "example", "org", "Bank", "of", "x"
+  };
+  const size_t number_of_words = sizeof(words) / sizeof(const char*);
+
+  vault v;
+  search s;
+
+  std::uint32_t state = 54321;
+  for (size_t i = 0; i < 500; i++)
+  {
+    data::secure_string_ptr id = data::make_secure_string();
+    state = state * 1103515245 + 12345;
+    size_t length = 1 + (state >> 16) % 3;
+    for (size_t j = 0; j < length; j++)
+    {
+      state = state * 1103515245 + 12345;
+      if (j > 0) *id += ((state >> 8) % 2) ? " " : ".";
+      *id += words[(state >> 16) % number_of_words];
+    }
+
+    data::entry_ptr etr = data::make_entry();
+    etr->set_id(*id);
+    v.add_entry(etr);
+  }
+
+  search_session session(s, v.get_entries());
+
+  // Extending a word can make entries match that did not match before, such as 'hu' and 'hub' for 'GitHub'
+  type_query(session, s, v, "github enterprise");
+  type_query(session, s, v, "hub hub. x");
+  type_query(session, s, v, "Mail.google.com");
+  type_query(session, s, v, "GHE");
+
+  // Replacing a word in the middle
+  check_session_query(session, s, v, "bank of example");
+  check_session_query(session, s, v, "bank org example");
+  check_session_query(session, s, v, "x org example");
+
+  // Changes to the collection must be noticed
+  check_session_query(session, s, v, "zebra hub");
+  v.get_entries().at(7)->set_id("Zebra hub");
+  check_session_query(session, s, v, "zebra hub");
+
+  data::entry_ptr etr = data::make_entry();
+  etr->set_id("zebra.hub");
+  v.add_entry(etr);
+  check_session_query(session, s, v, "zebra hub");
+}
@@ -0,0 +1,399 @@
+// Deadlock – fast search-based password manager
+// Copyright (C) 2012 Ruud van Asseldonk
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "search_test.h"
+#include "../core/core.h"
+#include "../core/search.h"
+#include "../core/data/edit_distance.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <iterator>
+#include <vector>
+
+using namespace deadlock::core;
+using namespace deadlock::tests;
+
+std::string search_test::get_name()
+{
+  return "search";
+}
+
+/// Exposes the word matching of the search algorithm
+class word_matching_search : public search
+{
+public:
+  using search::match_words;
+  using search::match_entry;
+  using search::match_field;
+};
+
+/// The original, character by character word matching, which match_words must agree with
+int reference_match_words(const data::secure_string& needle, const data::secure_string& haystack)
+{
+  size_t min_length = std::min(needle.length(), haystack.length());
+  size_t max_length = std::max(needle.length(), haystack.length());
+
+  int front_bonus = 0;
+  for (size_t i = 0; i < min_length; i++)
+  {
+    if (needle[i] == haystack[i]) front_bonus++;
+    else { front_bonus = 0; break; }
+  }
+
+  int match = front_bonus;
+  if (needle.length() == haystack.length() && front_bonus == static_cast<int>(min_length))
+  {
+    match += 15;
+  }
+  else if (needle.length() <= haystack.length())
+  {
+    int end_bonus = 0;
+    for (size_t i = 0; i < min_length; i++)
+    {
+      if (haystack[max_length - 1 - i] == needle[min_length - 1 - i]) end_bonus++;
+      else { end_bonus = 0; break; }
+    }
+    match += end_bonus;
+  }
+
+  return match;
+}
+
+/// Compares match_words with the reference for words around the block sizes of the vector instructions,
+/// with a difference at every possible place
+void check_match_words()
+{
+  word_matching_search s;
+  const data::secure_string base = "https://accounts.example.com/signin/v2/identifier?service=mail&continue=";
+
+  for (size_t n = 0; n <= base.size(); n++)
+  {
+    for (size_t h = 0; h <= base.size(); h += 1 + h / 8)
+    {
+      const data::secure_string needle = base.substr(0, n);
+      const data::secure_string haystack = base.substr(0, h);
+      const data::secure_string suffix = base.substr(base.size() - n);
+
+      // Equal, prefixes and suffixes of each other, and with one character changed
+      std::vector<std::pair<data::secure_string, data::secure_string>> pairs;
+      pairs.push_back(std::make_pair(needle, haystack));
+      pairs.push_back(std::make_pair(suffix, base.substr(base.size() - h)));
+      for (size_t i = 0; i < n; i += 1 + i / 4)
+      {
+        data::secure_string changed = needle;
+        changed[i] = '#';
+        pairs.push_back(std::make_pair(changed, haystack));
+        pairs.push_back(std::make_pair(haystack, changed));
+
+        changed = suffix;
+        changed[i] = '#';
+        pairs.push_back(std::make_pair(changed, base));
+      }
+
+      for (auto p = pairs.begin(); p != pairs.end(); p++)
+      {
+        if (s.match_words(p->first, p->second) != reference_match_words(p->first, p->second))
+          throw std::runtime_error("Word match differs from reference for '" + std::string(p->first.c_str()) +
+                                   "' and '" + std::string(p->second.c_str()) + "'.");
+      }
+    }
+  }
+}
+
+/// Verifies that searching several fields with the index gives the same result as scoring every entry
+void check_field_query(const search& s, const vault& v, const field_weights& weights, const char* query)
+{
+  word_matching_search scorer;
+  data::secure_string_ptr q = data::make_secure_string(query);
+  const data::normalised_string query_normalised(*q);
+
+  // Score every entry, and order by probability and then by position, like the search does
+  std::vector<std::pair<int, size_t>> scores;
+  for (size_t i = 0; i < v.get_entries().size(); i++)
+  {
+    const data::entry& entr = *v.get_entries().at(i);
+    const data::normalised_string id(entr.get_id()), username(entr.get_username()), additional_data(entr.get_additional_data());
+
+    int probability = weights.id * scorer.match_entry(*q, query_normalised.view(), entr, id.view()) +
+      weights.username * scorer.match_field(*q, query_normalised.view(), entr.get_username(), username.view()) +
+      weights.additional_data * scorer.match_field(*q, query_normalised.view(), entr.get_additional_data(), additional_data.view());
+
+    if (probability > 0) scores.push_back(std::make_pair(-probability, i));
+  }
+  std::sort(scores.begin(), scores.end());
+
+  std::vector<data::entry_ptr> expected, actual;
+  for (auto i = scores.begin(); i != scores.end(); i++) expected.push_back(v.get_entries().at(i->second));
+  s.find_matches(*q, v.get_entries(), weights, std::back_inserter(actual));
+
+  if (expected != actual)
+    throw std::runtime_error(std::string("Field search differs from scoring every entry for '") + query + "'.");
+
+  if (s.find_match(*q, v.get_entries(), weights) != (expected.empty() ? nullptr : expected.front()))
+    throw std::runtime_error(std::string("Best field match differs from scoring every entry for '") + query + "'.");
+}
+
+/// Verifies that a fuzzy search without typos gives the same result as a normal search,
+/// and that a fuzzy search finds every entry with a word within the edit distance of a query word
+void check_fuzzy_query(const search& s, const vault& v, const char* query)
+{
+  data::secure_string_ptr q = data::make_secure_string(query);
+
+  std::vector<data::entry_ptr> expected, exact;
+  s.find_matches(*q, v.get_entries(), std::back_inserter(expected));
+  s.find_fuzzy_matches(*q, v.get_entries(), 0, std::back_inserter(exact));
+
+  if (expected != exact)
+    throw std::runtime_error(std::string("Fuzzy search without typos differs from search for '") + query + "'.");
+
+  std::vector<data::entry_ptr> fuzzy;
+  s.find_fuzzy_matches(*q, v.get_entries(), 2, std::back_inserter(fuzzy));
+
+  // Compare against the edit distance of every pair of words
+  const data::normalised_string query_normalised(*q);
+  const data::normalised_id query_view = query_normalised.view();
+  std::vector<size_t> row;
+  for (auto i = v.begin(); i != v.end(); i++)
+  {
+    const data::normalised_string id_normalised(i->get_id());
+    const data::normalised_id id = id_normalised.view();
+
+    bool similar = false;
+    for (size_t n = 0; n < query_view.number_of_words; n++)
+    {
+      for (size_t h = 0; h < id.number_of_words; h++)
+      {
+        similar = similar || data::edit_distance(query_view.word(n), query_view.words[n].length,
+                                                 id.word(h), id.words[h].length, row) <= 2;
+      }
+    }
+
+    const bool found = std::find(fuzzy.begin(), fuzzy.end(), *i.base()) != fuzzy.end();
+    if (similar && !found)
+      throw std::runtime_error(std::string("Fuzzy search missed '") + i->get_id().c_str() + "' for '" + query + "'.");
+  }
+}
+
+/// Verifies that searching the collection gives the same result as searching every entry,
+/// and that searching in parallel gives the same result as searching serially
+void check_query(const search& s, const search& parallel, const vault& v, const char* query)
+{
+  data::secure_string_ptr q = data::make_secure_string(query);
+
+  std::vector<data::entry_ptr> expected, actual;
+  s.find_matches(*q, v.begin(), v.end(), std::back_inserter(expected));
+  s.find_matches(*q, v.get_entries(), std::back_inserter(actual));
+
+  if (expected != actual)
+    throw std::runtime_error(std::string("Indexed search differs from full search for '") + query + "'.");
+
+  if (s.find_match(*q, v.begin(), v.end()) != s.find_match(*q, v.get_entries()))
+    throw std::runtime_error(std::string("Indexed best match differs from full search for '") + query + "'.");
+
+  if (s.find_match(*q, v.get_entries()) != (expected.empty() ? nullptr : expected.front()))
+    throw std::runtime_error(std::string("Best match is not the first match for '") + query + "'.");
+
+  // The top k must be the first k of all matches, also when many matches are equally probable
+  const size_t ks[] = { 0, 1, 2, 10, 100, 100000 };
+  for (size_t i = 0; i < sizeof(ks) / sizeof(size_t); i++)
+  {
+    const size_t k = std::min(ks[i], expected.size());
+    std::vector<data::entry_ptr> top_range, top_collection;
+    s.find_best_matches(*q, v.begin(), v.end(), ks[i], std::back_inserter(top_range));
+    s.find_best_matches(*q, v.get_entries(), ks[i], std::back_inserter(top_collection));
+
+    if (top_range.size() != k || !std::equal(expected.begin(), expected.begin() + k, top_range.begin()) ||
+        top_range != top_collection)
+      throw std::runtime_error(std::string("Top matches differ from all matches for '") + query + "'.");
+
+    std::vector<data::entry_ptr> top_parallel_range, top_parallel_collection;
+    parallel.find_best_matches(*q, v.begin(), v.end(), ks[i], std::back_inserter(top_parallel_range));
+    parallel.find_best_matches(*q, v.get_entries(), ks[i], std::back_inserter(top_parallel_collection));
+
+    if (top_parallel_range != top_range || top_parallel_collection != top_range)
+      throw std::runtime_error(std::string("Parallel top matches differ from serial top matches for '") + query + "'.");
+  }
+
+  std::vector<data::entry_ptr> parallel_range, parallel_collection;
+  parallel.find_matches(*q, v.begin(), v.end(), std::back_inserter(parallel_range));
+  parallel.find_matches(*q, v.get_entries(), std::back_inserter(parallel_collection));
+
+  if (parallel_range != expected || parallel_collection != expected ||
+      parallel.find_match(*q, v.get_entries()) != s.find_match(*q, v.get_entries()))
+    throw std::runtime_error(std::string("Parallel search differs from serial search for '") + query + "'.");
+}
+
+void search_test::run()
+{
+  check_match_words();
+
+  const char* words[] =
+  {
+    "GitHub", "Enterprise", "mail", "google", "com", "www", "example", "org", "Bank", "of",
+    "Monkey", "Island", "Black", "Mesa", "admin", "svc-deploy", "Staging", "db", "VPN", "x"
+  };
+  const size_t number_of_words = sizeof(words) / sizeof(const char*);
+
+  const char* queries[] =
+  {
+    "github", "GitHub", "gh", "hub", "mail.google.com", "google mail", "x", "bank of",
+    "Black Mesa", "deploy", "zzz", "m", "", " ", ".", "a b c d e f", "ithub", "githubber", "ank",
+    "examples.orgs", "xx x", "gh", "GHE", "bom", "mi", "sd"
+  };
+  const size_t number_of_queries = sizeof(queries) / sizeof(const char*);
+
+  vault v;
+  search s;
+  s.set_number_of_threads(1);
+
+  // Split even the smallest searches, in an odd number of parts
+  search parallel;
+  parallel.set_number_of_threads(7);
+  parallel.set_parallel_threshold(0);
+
+  // Generate identifiers of one to four words with a simple deterministic generator
+  std::uint32_t state = 12345;
+  for (size_t i = 0; i < 2000; i++)
+  {
+    data::secure_string_ptr id = data::make_secure_string();
+    state = state * 1103515245 + 12345;
+    size_t length = 1 + (state >> 16) % 4;
+    for (size_t j = 0; j < length; j++)
+    {
+      state = state * 1103515245 + 12345;
+      if (j > 0) *id += ((state >> 8) % 2) ? " " : ".";
+      *id += words[(state >> 16) % number_of_words];
+    }
+
+    data::entry_ptr etr = data::make_entry();
+    etr->set_id(*id);
+    v.add_entry(etr);
+  }
+
+  // A few entries that consist of separators only
+  data::entry_ptr dot = data::make_entry();
+  dot->set_id(".");
+  v.add_entry(dot);
+
+  for (size_t i = 0; i < number_of_queries; i++) check_query(s, parallel, v, queries[i]);
+
+  // Acronyms follow capitals inside words too
+  {
+    vault acronyms;
+    const char* ids[] = { "gh-pages", "Google Mail", "GitHub Enterprise", "Ghent" };
+    for (size_t i = 0; i < sizeof(ids) / sizeof(const char*); i++)
+    {
+      data::entry_ptr etr = data::make_entry();
+      etr->set_id(ids[i]);
+      acronyms.add_entry(etr);
+    }
+
+    if (s.find_match("gh", acronyms.get_entries())->get_id() != "GitHub Enterprise")
+      throw std::runtime_error("Acronym 'gh' did not find 'GitHub Enterprise'.");
+
+    if (s.find_match("gm", acronyms.get_entries())->get_id() != "Google Mail")
+      throw std::runtime_error("Acronym 'gm' did not find 'Google Mail'.");
+
+    check_query(s, parallel, acronyms, "gh");
+    check_query(s, parallel, acronyms, "ghe");
+  }
+
+  // Usernames and additional data
+  {
+    const char* usernames[] = { "", "svc-deploy", "admin@example.org", "Ruud", "root" };
+    const char* notes[] = { "", "Recovery codes in the safe", "Staging only. Rotate monthly", "GitHub hub" };
+    size_t n = 0;
+    for (auto i = v.begin(); i != v.end(); i++, n++)
+    {
+      i->set_username(usernames[n % 5]);
+      if (n % 7 == 0) i->set_additional_data(notes[n % 4]);
+    }
+
+    const char* field_queries[] = { "svc-deploy", "deploy", "admin", "example.org", "staging", "hub", "codes safe", "ruud", "." };
+    const field_weights weights[] = { field_weights(), field_weights(1, 0, 0), field_weights(0, 1, 0), field_weights(0, 0, 3) };
+    for (size_t i = 0; i < sizeof(field_queries) / sizeof(const char*); i++)
+    {
+      for (size_t j = 0; j < sizeof(weights) / sizeof(field_weights); j++) check_field_query(s, v, weights[j], field_queries[i]);
+    }
+
+    // Searching only the identifier is a normal search
+    std::vector<data::entry_ptr> expected, actual;
+    s.find_matches("github", v.get_entries(), std::back_inserter(expected));
+    s.find_matches("github", v.get_entries(), field_weights(1, 0, 0), std::back_inserter(actual));
+    if (expected != actual) throw std::runtime_error("Searching only the identifier field differs from a normal search.");
+
+    // Changing a username must update the index
+    v.get_entries().at(3)->set_username("svc-release");
+    check_field_query(s, v, field_weights(0, 1, 0), "svc-release");
+    if (s.find_match("svc-release", v.get_entries(), field_weights()) != v.get_entries().at(3))
+      throw std::runtime_error("Changed username was not found.");
+  }
+
+  // Resolving many queries at once
+  {
+    std::vector<data::secure_string> batch(queries, queries + number_of_queries);
+    batch.push_back("gtihub");
+    batch.push_back("github");
+
+    std::vector<data::entry_ptr> expected, from_range, from_collection;
+    for (auto q = batch.begin(); q != batch.end(); q++) expected.push_back(s.find_match(*q, v.get_entries()));
+    s.find_match_batch(batch.begin(), batch.end(), v.begin(), v.end(), std::back_inserter(from_range));
+    s.find_match_batch(batch.begin(), batch.end(), v.get_entries(), std::back_inserter(from_collection));
+
+    if (expected != from_range || expected != from_collection)
+      throw std::runtime_error("Batch search differs from searching every query.");
+  }
+
+  // Typos
+  const char* typos[] = { "gtihub", "gogle mial", "entreprise", "Blakc", "xx", "svc-depoly", "zzz", "github" };
+  for (size_t i = 0; i < sizeof(typos) / sizeof(const char*); i++) check_fuzzy_query(s, v, typos[i]);
+
+  if (s.find_match("gtihub", v.get_entries()) != nullptr || s.find_fuzzy_match("gtihub", v.get_entries(), 2) == nullptr ||
+      s.find_fuzzy_match("gtihub", v.get_entries(), 2)->get_id().find("GitHub") == data::secure_string::npos)
+    throw std::runtime_error("Fuzzy search did not find 'GitHub' for 'gtihub'.");
+
+  // Changing identifiers must update the index
+  for (auto i = v.begin(); i != v.end(); i++)
+  {
+    if (i->get_id().find("Monkey") != data::secure_string::npos) i->set_id("Zebra crossing");
+  }
+
+  check_query(s, parallel, v, "zebra");
+  check_query(s, parallel, v, "monkey");
+  check_query(s, parallel, v, "crossing");
+
+  if (s.find_match("zebra", v.get_entries()) == nullptr)
+    throw std::runtime_error("Renamed entry was not found.");
+
+  // Renaming every entry a few times makes the identifier column reclaim the replaced identifiers
+  for (size_t round = 0; round < 3; round++)
+  {
+    for (auto i = v.begin(); i != v.end(); i++)
+    {
+      data::secure_string_ptr id = data::make_secure_string(i->get_id());
+      id->insert(0, round % 2 ? "Mail." : "Hub ");
+      i->set_id(*id);
+    }
+  }
+
+  for (size_t i = 0; i < number_of_queries; i++) check_query(s, parallel, v, queries[i]);
+
+  // Fuzzy search must follow the renames too
+  for (size_t i = 0; i < sizeof(typos) / sizeof(const char*); i++) check_fuzzy_query(s, v, typos[i]);
+  check_fuzzy_query(s, v, "zebar crosing");
+  check_fuzzy_query(s, v, "monkee");
+}